@@ -6,8 +6,19 @@
 
 #include "../headFile/Bplus_Tree.h"
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <fcntl.h>
 #include <list>
+#include <mutex>
+#include <set>
 #include <stdlib.h>
+#include <thread>
+#if defined(_WIN32)
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 /*减少名称冲突的可能性，避免使用using namespace std*/
 using std::binary_search;
 using std::copy;
@@ -55,6 +66,17 @@ namespace bpt
         return upper_bound(begin(node), end(node) - 1, key);
     }
 
+    //--------------------------------
+    //返回node中子节点为child的元素
+    //--------------------------------
+    inline index_t *find_child(internal_node_t &node, off_t child)
+    {
+        index_t *i = begin(node);
+        while (i != end(node) && i->child != child)
+            ++i;
+        return i;
+    }
+
     //--------------------------------
     //返回node元素大于key的第一个地址
     //--------------------------------
@@ -63,6 +85,23 @@ namespace bpt
         return lower_bound(begin(node), end(node), key);
     }
 
+    //--------------------------------
+    //记录一次操作的耗时（离开作用域时计入直方图）
+    //--------------------------------
+    struct op_timer
+    {
+        latency_hist_t &hist;
+        std::chrono::steady_clock::time_point start;
+
+        op_timer(latency_hist_t &h) : hist(h), start(std::chrono::steady_clock::now()) {}
+        ~op_timer()
+        {
+            hist.add(std::chrono::duration<double, std::micro>(
+                         std::chrono::steady_clock::now() - start)
+                         .count());
+        }
+    };
+
     //----------------------------------
     // B+树类的内部函数实现
     //----------------------------------
@@ -72,15 +111,22 @@ namespace bpt
     // 参数说明：
     //  p：存储数据的文件路径
     //  force_empty:  文件是否为空
+    //  compress: 新建文件时是否压缩存储叶子节点（已有文件以meta中的记录为准）
+    //  buffered: 新建文件时是否使用带消息缓冲区的写优化模式（同上）
     //----------------------------------
-    bplus_tree::bplus_tree(const char *p, bool force_empty)
-        : fp(NULL), fp_level(0)
+    bplus_tree::bplus_tree(const char *p, bool force_empty, bool compress, bool buffered)
+        : cache(BP_CACHE_PAGES), memtable_keys(0), relaxed_pending(0), batch_level(0), fp(NULL),
+          fp_level(0)
     {
+        reset_stats();
         memset(path, 0, sizeof(path));
         strcpy(path, p);
 
         if (!force_empty)
         {
+            //上次提交时没有写完的数据先从日志中补上
+            replay_journal();
+
             //read tree from file
             if (map(&meta, OFFSET_META) != 0)
                 force_empty = true;
@@ -88,13 +134,23 @@ namespace bpt
 
         if (force_empty)
         {
+            //旧文件的日志不再有意义
+            char journal[sizeof(path) + 16];
+            journal_path(journal, sizeof(journal));
+            ::remove(journal);
+
             //创建一个用于读写的空文件
             open_file("w+");
-            init_from_empty();
+            init_from_empty((compress ? BP_FLAG_COMPRESS : 0) | (buffered ? BP_FLAG_BUFFERED : 0));
             close_file();
         }
     }
 
+    bplus_tree::~bplus_tree()
+    {
+        merge_memtable();
+    }
+
     //-------------------------------
     //查找函数的实现
     //参数说明：
@@ -103,36 +159,222 @@ namespace bpt
     //-------------------------------
     int bplus_tree::search(const key_t &key, value_t *value) const
     {
+        op_timer timer(io_stats.latency[BP_OP_SEARCH]);
+
+        //事务中修改过的关键字以写集合为准
+        if (txn)
+        {
+            auto it = txn->find(key);
+            if (it != txn->end())
+            {
+                if (it->second.removed)
+                    return -1;
+                *value = it->second.value;
+                return 0;
+            }
+        }
+
+        //内存表中的修改比树中的新，删除后没有再插入、或者不论原来是否存在结果都相同时不用读树
+        auto mem = memtable.find(key);
+        if (mem != memtable.end())
+        {
+            const msg_effect_t &e = mem->second;
+            if (!e.absent_found && e.present_state == 0)
+                return -1;
+            if (e.absent_found && e.present_state == 1 &&
+                memcmp(&e.absent_value, &e.present_value, sizeof(value_t)) == 0)
+            {
+                *value = e.present_value;
+                return 0;
+            }
+        }
+
         //首先定位到叶子节点的首部
-        leaf_node_t leaf;
+        pooled<leaf_node_t> leaf_image(pool);
+        leaf_node_t &leaf = *leaf_image;
         map(&leaf, search_leaf(key));
 
         //然后从头开始遍历叶子节点的值是否与所要找的key相等
+        int ret = -1;
         record_t *record = find(leaf, key);
         if (record != leaf.children + leaf.n)
         {
             *value = record->value;
-            return keycmp(record->key, key);
+            ret = keycmp(record->key, key);
         }
-        else
-            return -1;
+
+        //缓冲模式下再合并路径上还没有写入叶子节点的消息，最后合并内存表
+        if (buffered())
+            apply_messages(key, ret, value);
+        if (mem != memtable.end())
+            mem->second.resolve(ret, value);
+        return ret;
+    }
+
+    //-------------------------------
+    //预取节点头部以及二分查找最先访问的几个位置
+    //-------------------------------
+    template <class T>
+    inline void prefetch_node(const T *node)
+    {
+        BP_PREFETCH(node);
+        BP_PREFETCH(node->children + BP_ORDER / 4);
+        BP_PREFETCH(node->children + BP_ORDER / 2);
+        BP_PREFETCH(node->children + BP_ORDER * 3 / 4);
+    }
+
+    //-------------------------------
+    //批量查找
+    //所有关键字同步地一层一层往下走：
+    //  1、每一层先发起本层还未缓存的节点的异步读取
+    //  2、每BP_BATCH_GROUP个关键字为一组，先对组内所有节点的缓存镜像发出预取，
+    //     再依次在镜像上查找，这样多个内存访问的延迟可以重叠
+    //  3、不在缓存中的节点最后再按普通方式读取
+    //参数说明：
+    //  keys：   要查找的关键字
+    //  values： 查找结果
+    //  results：每个关键字的返回值（与search相同）
+    //  n：      关键字个数
+    //返回：找到的关键字个数
+    //-------------------------------
+    int bplus_tree::search_batch(const key_t *keys, value_t *values, int *results,
+                                 size_t n) const
+    {
+        op_timer timer(io_stats.latency[BP_OP_SEARCH_BATCH]);
+        std::vector<off_t> offsets(n, meta.root_offset);
+        const char *pages[BP_BATCH_GROUP];
+        int found = 0;
+
+        //在内节点中找到下一层的位置
+        auto step_index = [&](size_t i, internal_node_t &node) {
+            offsets[i] = find(node, keys[i])->child;
+        };
+
+        //在叶子节点中取出结果
+        auto step_leaf = [&](size_t i, leaf_node_t &leaf) {
+            record_t *record = find(leaf, keys[i]);
+            if (record != leaf.children + leaf.n)
+            {
+                values[i] = record->value;
+                results[i] = keycmp(record->key, keys[i]);
+                found += results[i] == 0;
+            }
+            else
+                results[i] = -1;
+        };
+
+        //第0层到第height-1层为内节点，第height层为叶子节点
+        for (size_t level = 0; level <= meta.height; ++level)
+        {
+            bool is_leaf = level == meta.height;
+            size_t size = is_leaf ? sizeof(leaf_node_t) : sizeof(internal_node_t);
+            prefetch(offsets.data(), n, is_leaf);
+
+            for (size_t g = 0; g < n; g += BP_BATCH_GROUP)
+            {
+                size_t k = std::min(n - g, (size_t)BP_BATCH_GROUP);
+
+                //取得组内节点的缓存镜像并发出预取，暂时不访问
+                for (size_t j = 0; j < k; ++j)
+                {
+                    off_t offset = offsets[g + j];
+                    pages[j] = inflight.count(offset) ? NULL : cache.get(offset, size);
+                    if (pages[j] == NULL)
+                        continue;
+                    if (is_leaf)
+                        prefetch_node((const leaf_node_t *)pages[j]);
+                    else
+                        prefetch_node((const internal_node_t *)pages[j]);
+                }
+
+                //直接在缓存镜像上查找（只读，不复制节点）
+                for (size_t j = 0; j < k; ++j)
+                {
+                    if (pages[j] == NULL)
+                        continue;
+                    if (is_leaf)
+                        step_leaf(g + j, *(leaf_node_t *)pages[j]);
+                    else
+                        step_index(g + j, *(internal_node_t *)pages[j]);
+                }
+
+                //读取不在缓存中的节点（会放入缓存并可能淘汰其他页，所以放在最后）
+                for (size_t j = 0; j < k; ++j)
+                {
+                    if (pages[j] != NULL)
+                        continue;
+                    if (is_leaf)
+                    {
+                        pooled<leaf_node_t> leaf_image(pool);
+                        leaf_node_t &leaf = *leaf_image;
+                        map(&leaf, offsets[g + j]);
+                        step_leaf(g + j, leaf);
+                    }
+                    else
+                    {
+                        internal_node_t node;
+                        map(&node, offsets[g + j]);
+                        step_index(g + j, node);
+                    }
+                }
+            }
+        }
+        drain_prefetch();
+
+        //缓冲模式下合并路径上的消息
+        for (size_t i = 0; buffered() && i < n; ++i)
+        {
+            found -= results[i] == 0;
+            apply_messages(keys[i], results[i], &values[i]);
+            found += results[i] == 0;
+        }
+
+        //再合并内存表
+        for (size_t i = 0; !memtable.empty() && i < n; ++i)
+        {
+            auto it = memtable.find(keys[i]);
+            if (it == memtable.end())
+                continue;
+            found -= results[i] == 0;
+            it->second.resolve(results[i], &values[i]);
+            found += results[i] == 0;
+        }
+
+        //事务中修改过的关键字以写集合为准
+        for (size_t i = 0; txn && i < n; ++i)
+        {
+            auto it = txn->find(keys[i]);
+            if (it == txn->end())
+                continue;
+            found -= results[i] == 0;
+            if (it->second.removed)
+                results[i] = -1;
+            else
+            {
+                values[i] = it->second.value;
+                results[i] = 0;
+                ++found;
+            }
+        }
+        return found;
     }
 
     //-------------------------------------
-    //范围查找的实现
-    //将从left到right的max个数据传到values中
-    //同时利用一个变量记录后面是否存在数据
+    //范围扫描：沿叶子链表从left走到right，每找到一个数据调用一次emit
     //参数说明：
     //  left: 数据左边界（在next不为NULL下，返回该范围之后的第一个数据）
     //  right: 数据右边界
-    //  values: 查找结果数组
-    //  max:   查找结果个数
+    //  max:   最多扫描的数据个数
     //  next:  最后一个数据后面是否存在数据（若传入NULL则不记录）
-    //返回: 查找数据的实际个数
+    //  emit:  emit(record, i)，i为数据的序号
+    //返回: 扫描数据的实际个数
     //-------------------------------------
-    int bplus_tree::search_range(key_t *left, const key_t &right,
-                                 value_t *values, size_t max, bool *next) const
+    template <class Emit>
+    int bplus_tree::scan_range(key_t *left, const key_t &right, size_t max, bool *next,
+                               Emit emit) const
     {
+        op_timer timer(io_stats.latency[BP_OP_SEARCH_RANGE]);
+
         //如果范围不合法
         if (left == NULL || keycmp(*left, right) > 0)
             return -1;
@@ -143,13 +385,31 @@ namespace bpt
         off_t off = off_left;
 
         size_t i = 0;
-        record_t *Begin, *End;
+        record_t *Begin = NULL, *End = NULL;
+
+        pooled<leaf_node_t> leaf_image(pool);
+        leaf_node_t &leaf = *leaf_image;
 
-        leaf_node_t leaf;
+        //扫描期间保持文件打开
+        open_file();
+
+        //顺序预读：读到第二个叶子节点时认为是顺序扫描，开始预读后面的叶子节点，
+        //每次预读的叶子节点被访问完后窗口翻倍
+        off_t ra_index = search_index(*left); //当前预读位置所在的最底层内节点
+        size_t ra_window = 0, ra_ahead = 0;
 
         //从off开始查找值为values的节点
         while (off != off_right && off != 0 && i < max)
         {
+            if (off != off_left && ra_ahead == 0)
+            {
+                ra_window = ra_window == 0 ? BP_READAHEAD_MIN
+                                           : std::min(ra_window * 2, (size_t)BP_READAHEAD_MAX);
+                ra_ahead = readahead(ra_index, off, off_right, ra_window);
+            }
+            if (ra_ahead > 0)
+                --ra_ahead;
+
             map(&leaf, off);
 
             if (off_left == off)
@@ -159,13 +419,14 @@ namespace bpt
 
             End = leaf.children + leaf.n; //当前叶子节点的元素个数右边界
             for (; Begin != End && i < max; ++Begin, ++i)
-                values[i] = Begin->value; //把值传到values中
+                emit(*Begin, i);
 
             off = leaf.next;
         }
 
         //如果left所在的叶子节点到right所在的前一个叶子节点遍历完后还是没有达到max个数据
         //则将叶子节点right上的数据也存到结果数组中
+        bool finished = false;
         if (i < max)
         {
             map(&leaf, off_right);
@@ -173,13 +434,29 @@ namespace bpt
             Begin = find(leaf, *left);
             End = upper_bound(begin(leaf), end(leaf), right);
             for (; Begin != End && i < max; ++Begin, ++i)
-                values[i] = Begin->value;
+                emit(*Begin, i);
+            finished = Begin == End;
+        }
+
+        //恰好在某个叶子节点末尾取满max个数据时，后面的数据在下一个非空的叶子节点上
+        while (next != NULL && !finished && Begin == End && off != 0)
+        {
+            map(&leaf, off);
+            Begin = off == off_left ? find(leaf, *left) : begin(leaf);
+            End = off == off_right ? upper_bound(begin(leaf), end(leaf), right)
+                                   : leaf.children + leaf.n;
+            if (off == off_right)
+                break;
+            off = leaf.next;
         }
 
+        drain_prefetch();
+        close_file();
+
         //如果传入参数不为NULL，则判断在查找完left到right范围内的数据后面是否还有数据
         if (next != NULL)
         {
-            if (i == max && Begin != End)
+            if (!finished && Begin != End)
             {
                 *next = true;
                 *left = Begin->key;
@@ -190,715 +467,3376 @@ namespace bpt
         return i;
     }
 
-    //------------------------------
-    //删除数据
-    //参数说明：
-    //  key: 所要删除的数据
-    //-------------------------------
-    int bplus_tree::remove(const key_t &key)
+    //-------------------------------------
+    //范围读取：把树中按顺序传来的记录与写集合（事务）或缓冲的消息合并
+    //  写集合中的每个关键字通过resolve(树中的记录)得到最终结果，不存在的跳过
+    //-------------------------------------
+    template <class Map, class Visit>
+    struct write_set_merger
     {
-        internal_node_t parent;
-        leaf_node_t leaf;
+        typename Map::const_iterator it, last; //写集合中还没有输出的部分
+        Visit &visit;
 
-        //找到父结点所在位置
-        off_t parent_off = search_index(key);
-        map(&parent, parent_off);
+        /* 传入树中的下一个记录 */
+        void put(const record_t &r)
+        {
+            for (; it != last && keycmp(it->first, r.key) < 0; ++it)
+                entry(NULL);
+            if (it != last && keycmp(it->first, r.key) == 0)
+            {
+                entry(&r);
+                ++it;
+            }
+            else
+                visit(r);
+        }
 
-        //找到key所在的模糊子节点所对应的存储地址
-        index_t *where = find(parent, key);
-        off_t offset = where->child;
-        map(&leaf, offset);
+        /* 树中的记录已经传完：输出写集合中小于bound（NULL表示全部）的部分 */
+        void finish(const key_t *bound)
+        {
+            for (; it != last && (bound == NULL || keycmp(it->first, *bound) < 0); ++it)
+                entry(NULL);
+        }
 
-        //判断子节点中是否存在key
-        if (!binary_search(begin(leaf), end(leaf), key))
-            return -1;
+        void entry(const record_t *base)
+        {
+            record_t r;
+            if (!it->second.resolve(base, r.value))
+                return;
+            r.key = it->first;
+            visit(r);
+        }
+    };
 
-        size_t min_n = meta.leaf_node_num == 1 ? 0 : meta.order / 2;
-        assert(leaf.n >= min_n && leaf.n <= meta.order);
+    //-------------------------------------
+    //合并了写集合（事务）或缓冲的消息的范围查找，参数与返回值同scan_range
+    //写集合在范围内有changes个关键字时，树中最多有changes个记录被删掉，
+    //所以从树中多取changes个记录，合并后一定能凑够max个结果（如果有的话）
+    //-------------------------------------
+    template <class Map, class Emit>
+    int bplus_tree::merge_range(const Map &changes_set, key_t *left, const key_t &right,
+                                size_t max, bool *next, Emit emit) const
+    {
+        if (left == NULL || keycmp(*left, right) > 0)
+            return -1;
 
-        //删除key（覆盖数据的方式）
-        record_t *to_delete = find(leaf, key);
-        copy(to_delete + 1, end(leaf), to_delete);
-        leaf.n--;
+        auto first = changes_set.lower_bound(*left);
+        auto last = changes_set.upper_bound(right);
+        size_t changes = std::distance(first, last);
+        if (changes == 0)
+            return scan_range(left, right, max, next, emit);
+
+        std::vector<record_t> merged;
+        auto collect = [&merged](const record_t &r) {
+            merged.push_back(r);
+        };
+        write_set_merger<Map, decltype(collect)> merger = {first, last, collect};
+
+        key_t from = *left;
+        bool more = false;
+        size_t want = max > (size_t)-1 - changes ? (size_t)-1 : max + changes;
+        scan_range(&from, right, want, &more, [&merger](const record_t &r, size_t) {
+            merger.put(r);
+        });
+        //树中还有没读到的记录时，写集合只能合并到from之前
+        merger.finish(more ? &from : NULL);
+
+        size_t n = std::min(max, merged.size());
+        for (size_t i = 0; i < n; ++i)
+            emit(merged[i], i);
 
-        //删除后判断是否需要合并或者借用兄弟节点
-        if (leaf.n < min_n)
+        if (next != NULL)
         {
-            bool borrowed = false;
+            *next = merged.size() > n || more;
+            if (merged.size() > n)
+                *left = merged[n].key;
+            else if (more)
+                *left = from;
+        }
+        return n;
+    }
 
-            //借用左边的兄弟节点
-            if (leaf.prev != 0)
-                borrowed = borrow_key(false, leaf);
+    //-------------------------------------
+    //范围查找的分派：事务中合并写集合，缓冲模式或使用内存表时合并缓冲区中的消息和内存表
+    //-------------------------------------
+    template <class Emit>
+    int bplus_tree::read_range(key_t *left, const key_t &right, size_t max, bool *next,
+                               Emit emit) const
+    {
+        if (txn)
+            return merge_range(*txn, left, right, max, next, emit);
+        if ((!buffered() && memtable.empty()) || left == NULL || keycmp(*left, right) > 0)
+            return scan_range(left, right, max, next, emit);
+
+        effect_map_t effects;
+        collect_changes(*left, right, effects);
+        return merge_range(effects, left, right, max, next, emit);
+    }
 
-            //借用右边的兄弟节点
-            if (!borrowed && leaf.next != 0)
-                borrowed = borrow_key(true, leaf);
+    //-------------------------------------
+    //[left, right]内还没有写入叶子节点的修改：先是缓冲区中的消息，再是更新的内存表
+    //-------------------------------------
+    void bplus_tree::collect_changes(const key_t &left, const key_t &right,
+                                     effect_map_t &effects) const
+    {
+        if (buffered())
+            collect_messages(meta.root_offset, meta.height, left, right, effects);
 
-            //合并节点
-            if (!borrowed)
-            {
-                assert(leaf.next != 0 || leaf.prev != 0);
-                key_t index_key;
+        auto end = memtable.upper_bound(right);
+        for (auto it = memtable.lower_bound(left); it != end; ++it)
+            effect_of(effects, it->first).then(it->second);
+    }
 
-                //如果该叶子节点是最后一个元素，则与前一个节点进行合并
-                if (where == end(parent) - 1)
-                {
-                    assert(leaf.prev != 0);
-                    leaf_node_t prev;
-                    map(&prev, leaf.prev);        //读取prev的数据
-                    index_key = begin(prev)->key; //得到前一节点的key
-
-                    merge_leafs(&prev, &leaf);
-                    node_remove(&prev, &leaf);
-                    unmap(&prev, leaf.prev);
-                }
-                //如果不是，则与后一个节点进行合并
-                else
-                {
-                    assert(leaf.next != 0);
-                    leaf_node_t next;
-                    map(&next, leaf.next);
-                    index_key = begin(next)->key;
-
-                    merge_leafs(&leaf, &next);
-                    node_remove(&leaf, &next);
-                    unmap(&leaf, offset);
-                }
+    //-------------------------------------
+    //范围查找的实现
+    //将从left到right的max个数据传到values中
+    //同时利用一个变量记录后面是否存在数据
+    //参数说明：
+    //  left: 数据左边界（在next不为NULL下，返回该范围之后的第一个数据）
+    //  right: 数据右边界
+    //  values: 查找结果数组
+    //  max:   查找结果个数
+    //  next:  最后一个数据后面是否存在数据（若传入NULL则不记录）
+    //返回: 查找数据的实际个数
+    //-------------------------------------
+    int bplus_tree::search_range(key_t *left, const key_t &right,
+                                 value_t *values, size_t max, bool *next) const
+    {
+        auto emit = [values](const record_t &r, size_t i) {
+            values[i] = r.value;
+        };
+        return read_range(left, right, max, next, emit);
+    }
 
-                //删除父结点
-                remove_from_index(parent_off, parent, index_key);
-            }
-            else //如果无法借用兄弟节点
+    //-------------------------------------
+    //范围查找，结果中包含关键字
+    //参数与返回值同上，records为查找结果数组
+    //-------------------------------------
+    int bplus_tree::search_range(key_t *left, const key_t &right,
+                                 record_t *records, size_t max, bool *next) const
+    {
+        auto emit = [records](const record_t &r, size_t i) {
+            records[i] = r;
+        };
+        return read_range(left, right, max, next, emit);
+    }
+
+    //-------------------------------------
+    //零复制查找：ref指向缓存中钉住的叶子节点页里的记录
+    //有没写入叶子节点的修改（事务、缓冲模式、内存表）或缓存关闭时，ref持有合并后结果的副本
+    //返回值：
+    //  0表示找到，否则表示不存在
+    //-------------------------------------
+    int bplus_tree::search(const key_t &key, record_ref &ref) const
+    {
+        ref.release();
+        if (!pinnable())
+        {
+            value_t value;
+            int ret = search(key, &value);
+            if (ret == 0)
             {
-                unmap(&leaf, offset);
+                ref.own.reset(new record_t);
+                ref.own->key = key;
+                ref.own->value = value;
+                ref.rec = ref.own.get();
             }
+            return ret;
         }
-        else //如果当前节点比最少限制要多，则直接删除即可
+
+        op_timer timer(io_stats.latency[BP_OP_SEARCH]);
+        off_t offset = search_leaf(key);
+        const leaf_node_t *leaf = pin_leaf(offset);
+        if (leaf == NULL)
+            return -1;
+
+        const record_t *end = leaf->children + leaf->n;
+        const record_t *record = std::lower_bound(leaf->children, end, key);
+        if (record == end || keycmp(record->key, key) != 0)
         {
-            unmap(&leaf, offset);
+            cache.unpin(offset, (const char *)leaf);
+            return -1;
         }
 
+        ref.cache = &cache;
+        ref.offset = offset;
+        ref.page = (const char *)leaf;
+        ref.rec = record;
         return 0;
     }
 
-    //----------------------------
-    //插入数据
-    //参数说明:
-    //  key:所要插入的键
-    //  value:所要插入的值
-    //---------------------------
-    int bplus_tree::insert(const key_t &key, value_t value)
+    //-------------------------------------
+    //零复制范围查找：refs依次指向left到right之间的记录，每个ref钉住所在的叶子节点页
+    //参数与返回值同search_range
+    //-------------------------------------
+    int bplus_tree::search_range(key_t *left, const key_t &right,
+                                 record_ref *refs, size_t max, bool *next) const
     {
-        //首先判断在数据库中是否存在key对应的数据
-        off_t parent = search_index(key);
-        off_t offset = search_leaf(parent, key);
-        leaf_node_t leaf;
-        map(&leaf, offset);
+        for (size_t i = 0; i < max; ++i)
+            refs[i].release();
 
-        if (binary_search(begin(leaf), end(leaf), key))
-            return 1;
-
-        //判断当前节点数是否等于阶数
-        if (leaf.n == meta.order)
+        if (!pinnable())
         {
-            /* 分离节点 */
-
-            //创建新的节点
-            leaf_node_t new_leaf;
-            node_create(offset, &leaf, &new_leaf);
+            auto emit = [refs](const record_t &r, size_t i) {
+                refs[i].own.reset(new record_t(r));
+                refs[i].rec = refs[i].own.get();
+            };
+            return read_range(left, right, max, next, emit);
+        }
 
-            //找到分离的中间节点
-            size_t point = leaf.n / 2;
-            //如果key的值比下标point对应的key要大，则需要将point往右移一位
-            bool place_right = keycmp(key, leaf.children[point].key) > 0;
-            if (place_right)
-                ++point;
+        op_timer timer(io_stats.latency[BP_OP_SEARCH_RANGE]);
+        if (left == NULL || keycmp(*left, right) > 0)
+            return -1;
 
-            //分离操作（将leaf右半部分的值移到新节点的子节点下）
-            copy(leaf.children + point, leaf.children + leaf.n,
-                 new_leaf.children);
-            new_leaf.n = leaf.n - point; //更新节点数
-            leaf.n = point;
+        //沿叶子链表逐个钉住叶子节点，取满max个后再找到下一个数据为止
+        size_t i = 0;
+        bool more = false;
+        for (off_t off = search_leaf(*left); off != 0 && !more;)
+        {
+            const leaf_node_t *leaf = pin_leaf(off);
+            if (leaf == NULL)
+                break;
+
+            const record_t *b = std::lower_bound(leaf->children, leaf->children + leaf->n, *left);
+            const record_t *e = leaf->children + leaf->n;
+            bool done = false;
+            size_t first = i;
+            for (; b != e; ++b)
+            {
+                if (keycmp(b->key, right) > 0)
+                {
+                    done = true;
+                    break;
+                }
+                if (i == max)
+                {
+                    more = true;
+                    *left = b->key;
+                    break;
+                }
+                refs[i].cache = &cache;
+                refs[i].offset = off;
+                refs[i].page = (const char *)leaf;
+                refs[i].rec = b;
+                ++i;
+            }
 
-            /* 插入节点 */
-            if (place_right)
-                insert_record_no_split(&new_leaf, key, value);
+            //每个ref各钉住一次，没有取到数据时放开
+            off_t following = leaf->next;
+            if (i > first)
+                cache.pin_more(off, i - first - 1);
             else
-                insert_record_no_split(&leaf, key, value);
-
-            //保存节点
-            unmap(&leaf, offset);
-            unmap(&new_leaf, leaf.next);
+                cache.unpin(off, (const char *)leaf);
+            off = done ? 0 : following;
         }
-        else //如果节点数小于阶数，直接插入即可
+
+        if (next != NULL)
+            *next = more;
+        return i;
+    }
+
+    //-------------------------------------
+    //顺序扫描：一次下降后沿叶子链表把left到right之间的数据逐个交给visit
+    //返回: 扫描数据的个数，范围不合法返回-1
+    //-------------------------------------
+    int bplus_tree::scan(const key_t &left, const key_t &right,
+                         const std::function<void(const record_t &)> &visit) const
+    {
+        key_t from = left;
+        if (txn)
+            return merge_scan(*txn, left, right, visit);
+        if ((buffered() || !memtable.empty()) && keycmp(left, right) <= 0)
         {
-            insert_record_no_split(&leaf, key, value);
-            unmap(&leaf, offset);
+            effect_map_t effects;
+            collect_changes(left, right, effects);
+            return merge_scan(effects, left, right, visit);
         }
+        return scan_range(&from, right, (size_t)-1, NULL, [&visit](const record_t &r, size_t) {
+            visit(r);
+        });
+    }
 
-        return 0;
+    //-------------------------------------
+    //事务中（缓冲模式下）的顺序扫描：树中的记录边读边与写集合（缓冲的消息）合并
+    //-------------------------------------
+    template <class Map>
+    int bplus_tree::merge_scan(const Map &changes, const key_t &left, const key_t &right,
+                               const std::function<void(const record_t &)> &visit) const
+    {
+        int count = 0;
+        auto counted = [&visit, &count](const record_t &r) {
+            visit(r);
+            ++count;
+        };
+        write_set_merger<Map, decltype(counted)> merger = {
+            changes.lower_bound(left), changes.upper_bound(right), counted};
+
+        key_t from = left;
+        if (scan_range(&from, right, (size_t)-1, NULL, [&merger](const record_t &r, size_t) {
+                merger.put(r);
+            }) < 0)
+            return -1;
+        merger.finish(NULL);
+        return count;
     }
 
-    //---------------------------------
-    //更新值的操作
-    //(前提是数据已存在)
-    //参数说明：
-    //  key：所要修改的数据段
-    //  value: 修改值
-    //返回值：
-    // 0表示修改成功，否则表示不存在该数据
-    //--------------------------------
-    int bplus_tree::update(const key_t &key, value_t value)
+    //-------------------------------------
+    //树中是否没有数据：所有叶子节点都是空的
+    //（宽松填充会留下空的叶子节点，通常第一个叶子节点就不是空的）
+    //缓冲区和内存表中涉及的关键字按合并后的结果判断，叶子节点中其他的记录都还存在
+    //-------------------------------------
+    bool bplus_tree::empty() const
     {
-        off_t offset = search_leaf(key);
-        leaf_node_t leaf;
-        map(&leaf, offset);
+        std::set<key_t, key_less> changed;
+        for (auto it = memtable.begin(); it != memtable.end(); ++it)
+            changed.insert(it->first);
 
-        record_t *record = find(leaf, key);
-        if (record != leaf.children + leaf.n)
+        off_t first = meta.root_offset;
+        for (size_t height = meta.height; buffered() && height > 0; --height)
         {
-            if (keycmp(key, record->key) == 0)
+            internal_node_t node;
+            for (off_t off = first; off != 0; off = node.next)
             {
-                record->value = value;
-                unmap(&leaf, offset); //保存操作
-                return 0;
+                map(&node, off);
+                if (off == first)
+                    first = node.children[0].child;
+                if (node.buffer == 0)
+                    continue;
+                pooled<buffer_node_t> buf(pool);
+                map(buf.get(), node.buffer);
+                for (size_t i = 0; i < buf->n; ++i)
+                    changed.insert(buf->msgs[i].key);
             }
-            else
-                return 1;
         }
-        return -1;
-    }
-
-    //---------------------------------
-    //根据索引删除节点的操作
-    //参数说明：
-    //  offset:偏移量（下标）
-    //  node：所要删除的节点
-    //  key： 所要删除的数据
-    //----------------------------------
-    void bplus_tree::remove_from_index(off_t offset, internal_node_t &node,
-                                       const key_t &key)
-    {
-        size_t min_n = meta.root_offset == offset ? 1 : meta.order / 2;
-        assert(node.n >= min_n && node.n <= meta.order);
 
-        //删除数据
-        key_t index_key = begin(node)->key;
-        index_t *to_delete = find(node, key);
-        if (to_delete != end(node))
+        for (auto it = changed.begin(); it != changed.end(); ++it)
         {
-            (to_delete + 1)->child = to_delete->child;
-            copy(to_delete + 1, end(node), to_delete); //覆盖操作
+            value_t value;
+            if (search(*it, &value) == 0)
+                return false;
         }
-        --node.n;
 
-        //删除后如果只剩下一个节点
-        if (node.n == 1 && meta.root_offset == offset &&
-            meta.internal_node_num != 1)
+        internal_node_t head;
+        for (off_t off = meta.leaf_offset; off != 0; off = head.next)
         {
-            unalloc(&node, meta.root_offset);
-            meta.height--;
-            meta.root_offset = node.children[0].child;
-            unmap(&meta, OFFSET_META);
-            return;
+            map(&head, off, SIZE_NO_CHILDREN);
+            if (head.n == 0)
+                continue;
+            if (changed.empty())
+                return false;
+
+            pooled<leaf_node_t> leaf_image(pool);
+            leaf_node_t &leaf = *leaf_image;
+            map(&leaf, off);
+            for (size_t i = 0; i < leaf.n; ++i)
+                if (changed.count(leaf.children[i].key) == 0)
+                    return false;
         }
+        return true;
+    }
 
-        //判断删除后是否需要合并或借用兄弟节点
-        if (node.n < min_n)
-        {
-            internal_node_t parent;
-            map(&parent, node.parent);
+    //-------------------------------------
+    //自底向上构建时每层节点的个数
+    //参数说明：
+    //  children：下一层的节点个数
+    //  fill：    每个节点期望的子节点个数
+    //返回: 这一层的节点个数（子节点平均分配后每个节点都不少于order/2）
+    //-------------------------------------
+    static size_t bulk_level_nodes(size_t children, size_t fill, size_t order)
+    {
+        if (children <= order)
+            return 1;
+        size_t nodes = (children + fill - 1) / fill;
+        if (children / nodes < order / 2)
+            nodes = children / (order / 2);
+        return nodes;
+    }
 
-            bool borrowed = false;
-            //借用左兄弟节点（前提是左兄弟节点存在）
-            if (offset != begin(parent)->child)
-                borrowed = borrow_key(false, node, offset);
+    //-------------------------------------
+    //批量构建
+    //  1、叶子节点按顺序填充到fill个记录后写出，最后两个叶子节点平均分配，
+    //     因此所有叶子节点都连续存放在文件中
+    //  2、叶子个数确定后，计算每一层内节点的个数并一次分配好偏移量，
+    //     子节点平均分配给内节点，每个内节点写出时兄弟节点已知
+    //  父结点不再使用（结构修改使用下降路径），每个节点只写一次
+    //-------------------------------------
+    int bplus_tree::bulk_load(const std::function<bool(record_t &)> &next)
+    {
+        //只能在空树上构建，并且不能在事务中
+        if (txn)
+            return -1;
+        merge_memtable();
+        if (!empty())
+            return -1;
 
-            //借用右兄弟节点（前提是右兄弟节点存在）
-            if (!borrowed && offset != (end(parent) - 1)->child)
-                borrowed = borrow_key(true, node, offset);
+        const size_t order = meta.order;
+        const size_t min_n = order / 2;
+        const size_t fill = std::max(min_n, std::min(order, order * BP_BULK_FILL / 100));
+        size_t flags = meta.flags;
 
-            //没有借用则需要合并
-            if (!borrowed)
+        //从头重新分配
+        cache.clear();
+        underfull.clear();
+        meta.slot = OFFSET_BLOCK;
+        meta.leaf_node_num = meta.internal_node_num = 0;
+        open_file();
+
+        struct child_ref_t
+        {
+            key_t key;    //子树的第一个关键字
+            off_t offset; //节点偏移量
+            size_t n;     //节点中的元素个数
+        };
+        std::vector<child_ref_t> level;
+
+        //step1：写叶子节点，保留最后一个写满的叶子节点，用于和最后一个叶子节点平均分配
+        std::unique_ptr<leaf_node_t> prev(new leaf_node_t), cur(new leaf_node_t);
+        off_t prev_off = 0, cur_off = 0;
+        record_t rec;
+        size_t count = 0;
+
+        while (next(rec))
+        {
+            bool ascending = count == 0 ||
+                             (cur_off != 0 ? keycmp(cur->children[cur->n - 1].key, rec.key)
+                                           : keycmp(prev->children[prev->n - 1].key, rec.key)) < 0;
+            if (!ascending)
             {
-                assert(node.next != 0 || node.prev != 0);
-                //如果是最后一个节点
-                if (offset == (end(parent) - 1)->child)
-                {
-                    assert(node.prev != 0);
-                    internal_node_t prev;
-                    map(&prev, node.prev);
+                close_file();
+                init_from_empty(flags);
+                return -1;
+            }
 
-                    //合并操作
-                    index_t *where = find(parent, begin(prev)->key);
-                    reset_index_children_parent(begin(node), end(node), node.prev);
-                    merge_keys(where, prev, node);
-                    unmap(&prev, node.prev);
-                }
-                //如果不是最后一个节点
-                else
-                {
-                    assert(node.next != 0);
-                    internal_node_t next;
-                    map(&next, node.next);
+            if (cur_off == 0)
+            {
+                cur_off = alloc(cur.get());
+                cur->parent = 0;
+                cur->prev = prev_off;
+                cur->next = 0;
+            }
+            cur->children[cur->n++] = rec;
+            ++count;
 
-                    //合并操作
-                    index_t *where = find(parent, begin(next)->key);
-                    reset_index_children_parent(begin(node), end(node), offset);
-                    merge_keys(where, node, next);
-                    unmap(&node, node.next);
+            if (cur->n == fill)
+            {
+                if (prev_off != 0)
+                {
+                    prev->next = cur_off;
+                    unmap(prev.get(), prev_off);
+                    level.push_back({prev->children[0].key, prev_off, prev->n});
                 }
+                swap(prev, cur);
+                prev_off = cur_off;
+                cur_off = 0;
+            }
+        }
 
-                //删除父结点
-                remove_from_index(node.parent, parent, index_key);
+        if (count == 0)
+        {
+            close_file();
+            init_from_empty(flags);
+            return 0;
+        }
+
+        if (cur_off != 0 && prev_off != 0 && cur->n < min_n)
+        {
+            if (prev->n + cur->n <= order)
+            {
+                //并入前一个叶子节点，回收最后分配的块
+                copy(begin(*cur), end(*cur), end(*prev));
+                prev->n += cur->n;
+                unalloc(cur.get(), cur_off);
+                meta.slot -= leaf_block_size();
+                cur_off = 0;
             }
-            //如果借用了兄弟节点，保存操作即可
             else
             {
-                unmap(&node, offset);
+                //平均分配
+                size_t total = prev->n + cur->n;
+                size_t move = prev->n - total / 2;
+                copy_backward(begin(*cur), end(*cur), end(*cur) + move);
+                copy(end(*prev) - move, end(*prev), begin(*cur));
+                prev->n -= move;
+                cur->n += move;
             }
         }
-        //如果当前节点个数大于最小限制，则保存操作即可
-        else
+        if (prev_off != 0)
         {
-            unmap(&node, offset);
+            prev->next = cur_off;
+            unmap(prev.get(), prev_off);
+            level.push_back({prev->children[0].key, prev_off, prev->n});
+        }
+        if (cur_off != 0)
+        {
+            unmap(cur.get(), cur_off);
+            level.push_back({cur->children[0].key, cur_off, cur->n});
+        }
+        meta.leaf_offset = level.front().offset;
+
+        //step2：计算每层内节点的个数，至少有一层内节点
+        std::vector<size_t> sizes(1, level.size());
+        do
+            sizes.push_back(bulk_level_nodes(sizes.back(), fill, order));
+        while (sizes.back() > 1);
+
+        //为所有内节点分配偏移量
+        internal_node_t node;
+        std::vector<std::vector<off_t>> offsets(sizes.size());
+        for (size_t k = 1; k < sizes.size(); ++k)
+            for (size_t j = 0; j < sizes[k]; ++j)
+                offsets[k].push_back(alloc(&node));
+
+        //第k层第j个节点的子节点是下一层的[j * c / nodes, (j + 1) * c / nodes)
+        for (size_t k = 1; k < sizes.size(); ++k)
+        {
+            size_t c = sizes[k - 1], nodes = sizes[k];
+            std::vector<child_ref_t> upper;
+            for (size_t j = 0; j < nodes; ++j)
+            {
+                size_t from = j * c / nodes, to = (j + 1) * c / nodes;
+
+                //父结点不再使用，缓冲模式下这个位置是缓冲区，新节点还没有
+                node.parent = 0;
+                node.prev = j == 0 ? 0 : offsets[k][j - 1];
+                node.next = j + 1 == nodes ? 0 : offsets[k][j + 1];
+                node.n = to - from;
+                for (size_t i = from; i < to; ++i)
+                {
+                    //每个关键字是下一个子节点的第一个关键字，最后一个是这个节点的上界
+                    node.children[i - from].child = level[i].offset;
+                    node.children[i - from].key = i + 1 < c ? level[i + 1].key : key_t();
+                }
+                unmap(&node, offsets[k][j]);
+                upper.push_back({level[from].key, offsets[k][j], node.n});
+            }
+            level.swap(upper);
         }
+
+        meta.height = sizes.size() - 1;
+        meta.root_offset = offsets.back().front();
+        unmap(&meta, OFFSET_META);
+        close_file();
+        return count;
     }
 
-    //---------------------------------
-    //借用兄弟节点的操作（内节点）
+    //------------------------------
+    //删除数据
     //参数说明：
-    //  from_right:是否从右边借用
-    //  borrower: 借用的节点
-    //  offset: 数据在节点中的偏移量
+    //  key: 所要删除的数据
+    //-------------------------------
+    int bplus_tree::remove(const key_t &key)
+    {
+        op_timer timer(io_stats.latency[BP_OP_REMOVE]);
+        if (txn)
+            return txn_remove(key);
+        if (memtable_keys > 0)
+            return memtable_put(BP_MSG_REMOVE, key, NULL);
+        return write_tree(BP_MSG_REMOVE, key, NULL);
+    }
+
+    //------------------------------
+    //直接从叶子节点中删除数据
     //返回值：
-    //  true为借用成功，false为失败
-    //--------------------------------
-    bool bplus_tree::borrow_key(bool from_right, internal_node_t &borrower,
-                                off_t offset)
+    //  0表示删除成功，-1表示不存在
+    //-------------------------------
+    int bplus_tree::remove_record(const key_t &key)
     {
-        typedef typename internal_node_t::child_t child_t;
+        pooled<leaf_node_t> leaf_image(pool);
+        leaf_node_t &leaf = *leaf_image;
 
-        //定位兄弟节点(借之前判断兄弟节点是否在减掉一个节点的时候没有破坏结构)
-        off_t lender_off = from_right ? borrower.next : borrower.prev;
-        internal_node_t lender;
-        map(&lender, lender_off);
+        //记录下降路径和路径上的内节点，最后一个是父结点
+        path_t path;
+        load_path(key, path);
+        internal_node_t &parent = path.images[path.depth - 1];
+
+        //找到key所在的模糊子节点所对应的存储地址
+        index_t *where = find(parent, key);
+        off_t offset = where->child;
+        map(&leaf, offset);
+
+        //判断子节点中是否存在key
+        if (!binary_search(begin(leaf), end(leaf), key))
+            return -1;
 
-        assert(lender.n >= meta.order / 2);
-        if (lender.n != meta.order / 2)
+        //宽松填充留下的叶子节点可能低于半满
+        size_t min_n = meta.leaf_node_num == 1 ? 0 : meta.order / 2;
+        assert(leaf.n <= meta.order);
+
+        //删除key（覆盖数据的方式）
+        record_t *to_delete = find(leaf, key);
+        copy(to_delete + 1, end(leaf), to_delete);
+        leaf.n--;
+
+        //如果当前节点比最少限制要多，则直接删除即可
+        if (leaf.n >= min_n)
         {
-            child_t where_to_lend, where_to_put;
-            internal_node_t parent;
+            unmap(&leaf, offset);
+            return 0;
+        }
 
-            if (from_right)
-            {
-                where_to_lend = begin(lender);
-                where_to_put = end(borrower);
+        //宽松填充：先记下来，攒够了再统一再平衡
+        //（缓冲模式下合并节点要先清空缓冲区，这里正在清空缓冲区，攒够后由put_message触发）
+        size_t threshold = rebalance_threshold();
+        if (threshold > 0)
+        {
+            unmap(&leaf, offset);
+            underfull[offset] = key; //最近删除的关键字一定落在这个叶子节点中
+            io_stats.deferred_removes++;
+            if (!buffered() && underfull.size() >= threshold)
+                rebalance();
+            return 0;
+        }
 
-                map(&parent, borrower.parent);
-                child_t where = lower_bound(begin(parent), end(parent) - 1,
-                                            (end(borrower) - 1)->key);
+        //删除后需要合并或者借用兄弟节点：修改都在路径上的节点中进行，涉及的写入一起提交
+        begin_write_batch();
+        rebalance_leaf(path, where, leaf, offset, key);
 
-                where->key = where_to_lend->key;
-                unmap(&parent, borrower.parent);
-            }
-            else
-            {
-                where_to_lend = end(lender) - 1;
-                where_to_put = begin(borrower);
+        //路径上修改过的内节点各写一次
+        store_path(path);
+        end_write_batch();
+        return 0;
+    }
 
-                map(&parent, lender.parent);
-                child_t where = find(parent, begin(lender)->key);
-                where_to_put->key = where->key;
-                where->key = (where_to_lend - 1)->key;
-                unmap(&parent, lender.parent);
-            }
+    //------------------------------
+    //再平衡宽松填充留下的叶子节点：按记下的关键字重新下降，
+    //已经不再低于半满的（期间插入了数据或已被合并）跳过
+    //返回值：
+    //  再平衡的叶子节点个数
+    //-------------------------------
+    int bplus_tree::rebalance()
+    {
+        //合并与借用不会移动缓冲区中的消息，先全部写入叶子节点
+        if (buffered())
+            flush_buffers();
 
-            //存储
-            copy_backward(where_to_put, end(borrower), end(borrower) + 1);
-            *where_to_put = *where_to_lend;
-            borrower.n++;
+        std::map<off_t, key_t> pending;
+        pending.swap(underfull);
 
-            //从兄弟节点删除被借用的key
-            reset_index_children_parent(where_to_lend, where_to_lend + 1, offset);
-            copy(where_to_lend + 1, end(lender), where_to_lend);
-            lender.n--;
-            unmap(&lender, lender_off);
-            return true;
+        int fixed = 0;
+        for (std::map<off_t, key_t>::iterator i = pending.begin(); i != pending.end(); ++i)
+        {
+            path_t path;
+            load_path(i->second, path);
+            internal_node_t &parent = path.images[path.depth - 1];
+            index_t *where = find(parent, i->second);
+            off_t offset = where->child;
+
+            pooled<leaf_node_t> leaf_image(pool);
+            leaf_node_t &leaf = *leaf_image;
+            map(&leaf, offset);
+            if (meta.leaf_node_num == 1 || leaf.n >= meta.order / 2)
+                continue;
+
+            begin_write_batch();
+            rebalance_leaf(path, where, leaf, offset, i->second);
+            store_path(path);
+            end_write_batch();
+            ++fixed;
         }
-        return false;
+        return fixed;
     }
 
-    //-----------------------------------
-    //借用兄弟节点的操作（叶子节点）
+    //------------------------------
+    //低于半满的叶子节点向兄弟节点借用，借不够时与兄弟节点合并
     //参数说明：
-    //  from_right:是否借用右兄弟节点
-    //  borrower：想要借用的节点
-    // 返回值：
-    // true表示借用成功，false表示失败
-    //------------------------------------
-    bool bplus_tree::borrow_key(bool from_right, leaf_node_t &borrower)
+    //  path：  叶子节点的下降路径（load_path读取），修改后由调用者写回
+    //  where： 叶子节点在父结点中对应的元素
+    //  leaf：  叶子节点（已删除记录，尚未写回）
+    //  offset：叶子节点的地址
+    //  key：   下降时使用的关键字
+    //-------------------------------
+    void bplus_tree::rebalance_leaf(path_t &path, index_t *where, leaf_node_t &leaf,
+                                    off_t offset, const key_t &key)
     {
-        off_t lender_off = from_right ? borrower.next : borrower.prev;
-        leaf_node_t lender;
-        map(&lender, lender_off);
+        internal_node_t &parent = path.images[path.depth - 1];
+        size_t min_n = meta.order / 2;
 
-        assert(lender.n >= meta.order / 2);
+        //借用左边的兄弟节点（宽松填充留下的叶子节点可能要借用多次）
+        while (leaf.n < min_n && leaf.prev != 0 && borrow_key(false, leaf, path, key))
+            ;
 
-        if (lender.n != meta.order / 2)
-        {
-            typename leaf_node_t::child_t where_to_lend, where_to_put;
+        //借用右边的兄弟节点
+        while (leaf.n < min_n && leaf.next != 0 && borrow_key(true, leaf, path, key))
+            ;
 
-            //移动兄弟节点
-            if (from_right)
-            {
-                where_to_lend = begin(lender);
-                where_to_put = end(borrower);
-                change_parent_child(borrower.parent, begin(borrower)->key,
-                                    lender.children[1].key);
-            }
-            else
-            {
-                where_to_lend = end(lender) - 1;
-                where_to_put = begin(borrower);
-                change_parent_child(lender.parent, begin(lender)->key,
-                                    where_to_lend->key);
-            }
+        if (leaf.n >= min_n)
+        {
+            unmap(&leaf, offset);
+            return;
+        }
 
-            //保存
-            copy_backward(where_to_put, end(borrower), end(borrower) + 1);
-            *where_to_put = *where_to_lend;
-            borrower.n++;
+        //合并节点：借不到说明兄弟节点不超过半满，合并后不会超过order
+        assert(leaf.next != 0 || leaf.prev != 0);
 
-            //删除
-            copy(where_to_lend + 1, end(lender), where_to_lend);
-            lender.n--;
-            unmap(&lender, lender_off);
-            return true;
+        //如果该叶子节点是最后一个元素，则与前一个节点进行合并
+        if (where == end(parent) - 1)
+        {
+            assert(leaf.prev != 0);
+            pooled<leaf_node_t> prev_image(pool);
+            leaf_node_t &prev = *prev_image;
+            map(&prev, leaf.prev); //读取prev的数据
+            assert(prev.n + leaf.n <= meta.order);
+
+            merge_leafs(&prev, &leaf);
+            node_remove(&prev, &leaf);
+            unmap(&prev, leaf.prev);
+            --where; //父结点中应删除的是prev对应的元素
         }
-        return false;
+        //如果不是，则与后一个节点进行合并
+        else
+        {
+            assert(leaf.next != 0);
+            pooled<leaf_node_t> next_image(pool);
+            leaf_node_t &next = *next_image;
+            map(&next, leaf.next);
+            assert(leaf.n + next.n <= meta.order);
+
+            merge_leafs(&leaf, &next);
+            node_remove(&leaf, &next);
+            unmap(&leaf, offset);
+        }
+
+        //删除父结点
+        remove_from_index(path, path.depth, where - begin(parent));
     }
 
-    //--------------------------------------
-    //更新父结点的关键字为新的关键字
-    //参数说明：
-    //  parent：父结点的位置
-    //  old：原关键字
-    //  new: 新关键字
-    //---------------------------------------
-    void bplus_tree::change_parent_child(off_t parent, const key_t &oldKey,
-                                         const key_t &newKey)
+    //----------------------------
+    //插入数据
+    //参数说明:
+    //  key:所要插入的键
+    //  value:所要插入的值
+    //---------------------------
+    int bplus_tree::insert(const key_t &key, value_t value)
     {
-        internal_node_t node;
-        map(&node, parent);
-
-        index_t *w = find(node, oldKey);
-        assert(w != node.children + node.n);
-
-        w->key = newKey;
-        unmap(&node, parent);
-        if (w == node.children + node.n - 1)
-            change_parent_child(node.parent, oldKey, newKey);
+        op_timer timer(io_stats.latency[BP_OP_INSERT]);
+        if (txn)
+            return txn_insert(key, value);
+        if (memtable_keys > 0)
+            return memtable_put(BP_MSG_INSERT, key, &value);
+        return write_tree(BP_MSG_INSERT, key, &value);
     }
 
-    //----------------------------------
-    //将右叶子节点部分合并到左子节点的后面
+    //----------------------------
+    //内存表之下的写入：缓冲模式下放入缓冲区，否则直接写入叶子节点
     //参数说明：
-    //  left：左叶子节点
-    //  right：右叶子节点
-    //---------------------------------
-    void bplus_tree::merge_leafs(leaf_node_t *left, leaf_node_t *right)
+    //  type：BP_MSG_INSERT/BP_MSG_UPDATE/BP_MSG_REMOVE
+    //返回值：同insert/update/remove
+    //---------------------------
+    int bplus_tree::write_tree(int type, const key_t &key, const value_t *value)
     {
-        copy(begin(*right), end(*right), end(*left));
-        left->n += right->n;
+        if (buffered())
+            return put_message(type, key, value);
+        if (type == BP_MSG_INSERT)
+            return insert_record(key, *value);
+        if (type == BP_MSG_UPDATE)
+            return update_record(key, *value);
+        if (type == BP_MSG_UPSERT)
+            return modify_record(key, [value](value_t &v, bool) {
+                v = *value;
+                return true;
+            });
+        return remove_record(key);
     }
 
-    //---------------------------------
-    //将next的内节点部分合并到node的内节点的后面
-    //参数说明：
-    //  where：
-    //  node：进行合并的内节点
-    //  next：将要被合并的内节点
-    //----------------------------------
-    void bplus_tree::merge_keys(index_t *where, internal_node_t &node,
-                                internal_node_t &next)
+    //----------------------------
+    //直接把数据插入叶子节点
+    //返回值：
+    //  0表示插入成功，1表示关键字已存在
+    //---------------------------
+    int bplus_tree::insert_record(const key_t &key, const value_t &value)
+    {
+        //首先判断在数据库中是否存在key对应的数据（记录下降路径，分裂时沿路径向上）
+        path_t path;
+        search_path(key, path);
+        off_t offset = search_leaf(path.nodes[path.depth - 1], key);
+        pooled<leaf_node_t> leaf_image(pool);
+        leaf_node_t &leaf = *leaf_image;
+        map(&leaf, offset);
+
+        if (binary_search(begin(leaf), end(leaf), key))
+            return 1;
+
+        insert_into_leaf(path, offset, leaf, key, value);
+        return 0;
+    }
+
+    //----------------------------
+    //把不存在的关键字放入叶子节点，叶子节点已满时分裂
+    //参数说明：
+    //  path：  下降路径（分裂时沿路径向上）
+    //  offset：叶子节点的位置，leaf为其内容
+    //---------------------------
+    void bplus_tree::insert_into_leaf(path_t &path, off_t offset, leaf_node_t &leaf,
+                                      const key_t &key, const value_t &value)
+    {
+        //判断当前节点数是否等于阶数
+        if (leaf.n == meta.order)
+        {
+            /* 分离节点 */
+
+            //分裂涉及的所有写入（两个叶子、后继节点、父结点、meta）一起提交
+            begin_write_batch();
+
+            //创建新的节点
+            pooled<leaf_node_t> new_leaf_image(pool);
+            leaf_node_t &new_leaf = *new_leaf_image;
+            node_create(offset, &leaf, &new_leaf);
+
+            //找到分离的中间节点
+            size_t point = leaf.n / 2;
+            //如果key的值比下标point对应的key要大，则需要将point往右移一位
+            bool place_right = keycmp(key, leaf.children[point].key) > 0;
+            if (place_right)
+                ++point;
+
+            //分离操作（将leaf右半部分的值移到新节点的子节点下）
+            copy(leaf.children + point, leaf.children + leaf.n,
+                 new_leaf.children);
+            new_leaf.n = leaf.n - point; //更新节点数
+            leaf.n = point;
+
+            /* 插入节点 */
+            if (place_right)
+                insert_record_no_split(&new_leaf, key, value);
+            else
+                insert_record_no_split(&leaf, key, value);
+
+            //保存节点
+            unmap(&leaf, offset);
+            unmap(&new_leaf, leaf.next);
+
+            //将新叶子节点的首关键字插入父结点
+            insert_key_to_index(path, path.depth, new_leaf.children[0].key,
+                                offset, leaf.next);
+
+            end_write_batch();
+        }
+        else //如果节点数小于阶数，直接插入即可
+        {
+            insert_record_no_split(&leaf, key, value);
+            unmap(&leaf, offset);
+        }
+    }
+
+    //----------------------------
+    //插入或更新：关键字存在时更新，不存在时插入
+    //返回值：
+    //  0表示插入，1表示更新（缓冲模式和内存表中一律返回0）
+    //---------------------------
+    int bplus_tree::upsert(const key_t &key, const value_t &value)
+    {
+        if (txn || (memtable_keys == 0 && !buffered()))
+            return modify(key, [&value](value_t &v, bool) {
+                v = value;
+                return true;
+            });
+
+        op_timer timer(io_stats.latency[BP_OP_MODIFY]);
+        if (memtable_keys > 0)
+            return memtable_put(BP_MSG_UPSERT, key, &value);
+        return write_tree(BP_MSG_UPSERT, key, &value);
+    }
+
+    //----------------------------
+    //读-改-写
+    //参数说明：
+    //  fn：修改value（found表示关键字是否存在，不存在时value清零），返回是否写回
+    //返回值：
+    //  0表示插入，1表示更新，-1表示没有写回
+    //---------------------------
+    int bplus_tree::modify(const key_t &key, const std::function<bool(value_t &, bool)> &fn)
+    {
+        op_timer timer(io_stats.latency[BP_OP_MODIFY]);
+        if (!txn && memtable_keys == 0 && !buffered())
+            return modify_record(key, fn);
+
+        //事务、内存表和缓冲模式下先读出合并后的值，再作为一次upsert写入
+        value_t value;
+        bool found = search(key, &value) == 0;
+        if (!found)
+            memset(&value, 0, sizeof(value));
+        if (!fn(value, found))
+            return -1;
+
+        if (txn)
+        {
+            auto it = txn->find(key);
+            if (it == txn->end())
+            {
+                it = txn->insert(std::make_pair(key, txn_entry_t())).first;
+                it->second.existed = found;
+            }
+            it->second.removed = false;
+            it->second.value = value;
+        }
+        else if (memtable_keys > 0)
+            memtable_put(BP_MSG_UPSERT, key, &value);
+        else
+            write_tree(BP_MSG_UPSERT, key, &value);
+        return found ? 1 : 0;
+    }
+
+    //----------------------------
+    //在叶子节点中直接读-改-写：只下降一次，存在时在读出的叶子节点上修改，写回一次
+    //返回值同modify
+    //---------------------------
+    int bplus_tree::modify_record(const key_t &key,
+                                  const std::function<bool(value_t &, bool)> &fn)
+    {
+        path_t path;
+        search_path(key, path);
+        off_t offset = search_leaf(path.nodes[path.depth - 1], key);
+        pooled<leaf_node_t> leaf_image(pool);
+        leaf_node_t &leaf = *leaf_image;
+        map(&leaf, offset);
+
+        record_t *record = find(leaf, key);
+        if (record != leaf.children + leaf.n && keycmp(record->key, key) == 0)
+        {
+            value_t old = record->value;
+            if (!fn(record->value, true))
+                return -1;
+            unmap_value(&leaf, offset, record, old);
+            return 1;
+        }
+
+        value_t value;
+        memset(&value, 0, sizeof(value));
+        if (!fn(value, false))
+            return -1;
+        insert_into_leaf(path, offset, leaf, key, value);
+        return 0;
+    }
+
+    //---------------------------------
+    //更新值的操作
+    //(前提是数据已存在)
+    //参数说明：
+    //  key：所要修改的数据段
+    //  value: 修改值
+    //返回值：
+    // 0表示修改成功，否则表示不存在该数据
+    //--------------------------------
+    int bplus_tree::update(const key_t &key, value_t value)
+    {
+        op_timer timer(io_stats.latency[BP_OP_UPDATE]);
+        if (txn)
+            return txn_update(key, value);
+        if (memtable_keys > 0)
+            return memtable_put(BP_MSG_UPDATE, key, &value);
+        return write_tree(BP_MSG_UPDATE, key, &value);
+    }
+
+    //---------------------------------
+    //直接修改叶子节点中的数据，返回值同update
+    //--------------------------------
+    int bplus_tree::update_record(const key_t &key, const value_t &value)
+    {
+        off_t offset = search_leaf(key);
+        pooled<leaf_node_t> leaf_image(pool);
+        leaf_node_t &leaf = *leaf_image;
+        map(&leaf, offset);
+
+        record_t *record = find(leaf, key);
+        if (record != leaf.children + leaf.n)
+        {
+            if (keycmp(key, record->key) == 0)
+            {
+                value_t old = record->value;
+                record->value = value;
+                unmap_value(&leaf, offset, record, old); //保存操作
+                return 0;
+            }
+            else
+                return 1;
+        }
+        return -1;
+    }
+
+    //---------------------------------
+    //按字段更新
+    //参数说明：
+    //  at：  字段在value_t中的偏移量（如offsetof(value_t, age)）
+    //  data：字段的新值（size个字节）
+    //返回值：
+    //  0表示修改成功，-1表示不存在该数据或字段越界
+    //--------------------------------
+    int bplus_tree::update_field(const key_t &key, size_t at, const void *data, size_t size)
+    {
+        if (at > sizeof(value_t) || size > sizeof(value_t) - at)
+            return -1;
+
+        //直接修改叶子节点时modify_record只写回改动的字节，事务、内存表和缓冲模式下按modify的方式写入
+        int ret = modify(key, [at, data, size](value_t &v, bool found) {
+            if (found)
+                memcpy((char *)&v + at, data, size);
+            return found;
+        });
+        return ret == 1 ? 0 : -1;
+    }
+
+    //---------------------------------
+    //开始事务
+    //返回值：
+    //  0表示成功，-1表示已经在事务中
+    //---------------------------------
+    int bplus_tree::begin_transaction()
+    {
+        if (txn)
+            return -1;
+
+        //事务中的读取只合并写集合，先把内存表合并到树中，缓冲模式下再清空缓冲区
+        merge_memtable();
+        if (buffered())
+            flush_buffers();
+        txn.reset(new write_set_t());
+        return 0;
+    }
+
+    //---------------------------------
+    //提交事务：按关键字顺序把写集合应用到树上，所有写入合并成一次落盘的批量写入
+    //返回值：
+    //  0表示成功，-1表示没有事务或者写入失败
+    //  （写入失败时重新从磁盘加载，树的内容是日志重放或丢弃后的结果）
+    //---------------------------------
+    int bplus_tree::commit()
+    {
+        if (!txn)
+            return -1;
+
+        //先取出写集合，下面的写入直接修改树（不经过内存表，提交后即已落盘）
+        std::unique_ptr<write_set_t> writes(txn.release());
+        if (writes->empty())
+            return 0;
+
+        begin_write_batch();
+        for (auto it = writes->begin(); it != writes->end(); ++it)
+        {
+            const txn_entry_t &entry = it->second;
+            if (entry.removed)
+                write_tree(BP_MSG_REMOVE, it->first, NULL);
+            else if (entry.existed)
+                write_tree(BP_MSG_UPDATE, it->first, &entry.value);
+            else
+                write_tree(BP_MSG_INSERT, it->first, &entry.value);
+        }
+        if (end_write_batch(true) == 0)
+            return 0;
+
+        //缓存和meta中是没有完整写入的结果，以磁盘上恢复后的内容为准
+        cache.clear();
+        replay_journal();
+        map(&meta, OFFSET_META);
+        return -1;
+    }
+
+    //---------------------------------
+    //回滚事务：丢弃写集合，树没有被修改过
+    //返回值：
+    //  0表示成功，-1表示没有事务
+    //---------------------------------
+    int bplus_tree::rollback()
+    {
+        if (!txn)
+            return -1;
+        txn.reset();
+        return 0;
+    }
+
+    //---------------------------------
+    //事务中的插入：关键字已存在（写集合或树中）返回1
+    //---------------------------------
+    int bplus_tree::txn_insert(const key_t &key, const value_t &value)
+    {
+        auto it = txn->find(key);
+        if (it != txn->end())
+        {
+            if (!it->second.removed)
+                return 1;
+            it->second.removed = false;
+            it->second.value = value;
+            return 0;
+        }
+
+        value_t old;
+        if (search(key, &old) == 0)
+            return 1;
+        txn_entry_t &entry = (*txn)[key];
+        entry.removed = false;
+        entry.existed = false;
+        entry.value = value;
+        return 0;
+    }
+
+    //---------------------------------
+    //事务中的更新：关键字不存在返回-1
+    //---------------------------------
+    int bplus_tree::txn_update(const key_t &key, const value_t &value)
+    {
+        auto it = txn->find(key);
+        if (it != txn->end())
+        {
+            if (it->second.removed)
+                return -1;
+            it->second.value = value;
+            return 0;
+        }
+
+        value_t old;
+        if (search(key, &old) != 0)
+            return -1;
+        txn_entry_t &entry = (*txn)[key];
+        entry.removed = false;
+        entry.existed = true;
+        entry.value = value;
+        return 0;
+    }
+
+    //---------------------------------
+    //事务中的删除：关键字不存在返回-1
+    //事务中插入的关键字直接从写集合中去掉
+    //---------------------------------
+    int bplus_tree::txn_remove(const key_t &key)
+    {
+        auto it = txn->find(key);
+        if (it != txn->end())
+        {
+            if (it->second.removed)
+                return -1;
+            if (it->second.existed)
+                it->second.removed = true;
+            else
+                txn->erase(it);
+            return 0;
+        }
+
+        value_t old;
+        if (search(key, &old) != 0)
+            return -1;
+        txn_entry_t &entry = (*txn)[key];
+        entry.removed = true;
+        entry.existed = true;
+        return 0;
+    }
+
+    //---------------------------------
+    //异步接口
+    //参数与返回值的含义与对应的同步接口相同
+    //---------------------------------
+    std::future<int> bplus_tree::search_async(const key_t &key, value_t *value)
+    {
+        return submit_async(async_op_t::SEARCH, key, NULL, value);
+    }
+
+    std::future<int> bplus_tree::insert_async(const key_t &key, const value_t &value)
+    {
+        return submit_async(async_op_t::INSERT, key, &value, NULL);
+    }
+
+    std::future<int> bplus_tree::update_async(const key_t &key, const value_t &value)
+    {
+        return submit_async(async_op_t::UPDATE, key, &value, NULL);
+    }
+
+    std::future<int> bplus_tree::remove_async(const key_t &key)
+    {
+        return submit_async(async_op_t::REMOVE, key, NULL, NULL);
+    }
+
+    std::future<int> bplus_tree::submit_async(async_op_t::op_type_t type, const key_t &key,
+                                              const value_t *value, value_t *out)
+    {
+        ops.push_back(async_op_t());
+        async_op_t &op = ops.back();
+        op.type = type;
+        op.key = key;
+        if (value != NULL)
+            op.value = *value;
+        op.out = out;
+        op.started = false;
+        return op.result.get_future();
+    }
+
+    //---------------------------------
+    //推进所有挂起的异步操作（不阻塞）
+    //写操作只有排在最前面时才执行，并且会挡住后面的操作
+    //返回值：
+    //  本次完成的操作个数
+    //---------------------------------
+    size_t bplus_tree::poll()
+    {
+        size_t done = 0;
+        for (auto it = ops.begin(); it != ops.end();)
+        {
+            bool write = it->type != async_op_t::SEARCH;
+            if (write && it != ops.begin())
+                break;
+
+            if (step_async(*it))
+            {
+                it = ops.erase(it);
+                ++done;
+            }
+            else if (write)
+                break;
+            else
+                ++it;
+        }
+        return done;
+    }
+
+    //---------------------------------
+    //推进直到所有异步操作完成
+    //没有任何进展时阻塞等待一个读请求完成
+    //---------------------------------
+    void bplus_tree::run()
+    {
+        while (!ops.empty())
+        {
+            if (poll() == 0 && !inflight.empty())
+                complete_prefetch(inflight.begin()->first);
+        }
+    }
+
+    //---------------------------------
+    //沿树往下推进一个异步操作，直到需要等待节点读取
+    //返回值：
+    //  true表示操作已完成
+    //---------------------------------
+    bool bplus_tree::step_async(async_op_t &op)
+    {
+        //在真正开始时才读取根节点，前面的写操作可能改变了树高
+        if (!op.started)
+        {
+            op.started = true;
+            op.offset = meta.root_offset;
+            op.levels = meta.height;
+        }
+
+        while (true)
+        {
+            bool is_leaf = op.levels == 0;
+
+            //节点不在缓存中：发起读取后挂起，读取完成后再继续
+            if (aio && cache.capacity() > 0 &&
+                cache.get(op.offset, is_leaf ? sizeof(leaf_node_t) : sizeof(internal_node_t)) == NULL)
+            {
+                auto req = inflight.find(op.offset);
+                if (req == inflight.end())
+                {
+                    prefetch(&op.offset, 1, is_leaf);
+                    return false;
+                }
+                if (!aio->ready(req->second.id))
+                    return false;
+                complete_prefetch(op.offset);
+            }
+
+            if (!is_leaf)
+            {
+                internal_node_t node;
+                map(&node, op.offset);
+                op.offset = find(node, op.key)->child;
+                --op.levels;
+                continue;
+            }
+
+            //到达叶子节点，路径上的节点都已在缓存中
+            switch (op.type)
+            {
+            case async_op_t::SEARCH:
+            {
+                //缓冲模式下还要合并路径上的消息和内存表，路径上的节点都已在缓存中
+                if (buffered() || !memtable.empty())
+                {
+                    op.result.set_value(search(op.key, op.out));
+                    break;
+                }
+
+                //事务中修改过的关键字以写集合为准
+                auto it = txn ? txn->find(op.key) : write_set_t::iterator();
+                if (txn && it != txn->end())
+                {
+                    if (!it->second.removed)
+                        *op.out = it->second.value;
+                    op.result.set_value(it->second.removed ? -1 : 0);
+                    break;
+                }
+
+                pooled<leaf_node_t> leaf_image(pool);
+                leaf_node_t &leaf = *leaf_image;
+                map(&leaf, op.offset);
+                record_t *record = find(leaf, op.key);
+                if (record != leaf.children + leaf.n)
+                {
+                    *op.out = record->value;
+                    op.result.set_value(keycmp(record->key, op.key));
+                }
+                else
+                    op.result.set_value(-1);
+                break;
+            }
+            case async_op_t::INSERT:
+                op.result.set_value(insert(op.key, op.value));
+                break;
+            case async_op_t::UPDATE:
+                op.result.set_value(update(op.key, op.value));
+                break;
+            case async_op_t::REMOVE:
+                op.result.set_value(remove(op.key));
+                break;
+            }
+            return true;
+        }
+    }
+
+    //---------------------------------
+    //分析树的形状
+    //从meta.root_offset开始逐层读取节点，每一层的节点按物理位置排序后分成若干段，
+    //由多个线程各自打开文件并行读取；叶子节点只需要读取头部
+    //参数说明：
+    //  threads：线程数（0表示每个CPU核心一个线程）
+    //---------------------------------
+    analyze_t bplus_tree::analyze(size_t threads) const
+    {
+        if (threads == 0)
+            threads = std::max(1U, std::thread::hardware_concurrency());
+
+        analyze_t res;
+        res.non_adjacent_leaves = 0;
+        res.leaf_stored_bytes = 0;
+        res.buffer_bytes = 0;
+
+        //内节点层
+        std::vector<off_t> level(1, meta.root_offset), children;
+        for (size_t h = 0; h < meta.height; ++h)
+        {
+            level_stat_t stat;
+            children.clear();
+            analyze_level(level, false, threads, stat, &children, NULL, &res.buffer_bytes);
+            res.levels.push_back(stat);
+            level.swap(children);
+        }
+
+        //叶子节点层
+        level_stat_t stat;
+        std::vector<std::pair<off_t, off_t>> links; //(叶子节点, next)
+        analyze_level(level, true, threads, stat, NULL, &links, &res.leaf_stored_bytes);
+        res.levels.push_back(stat);
+        res.avg_keys_per_leaf = stat.nodes == 0 ? 0 : (double)stat.keys / stat.nodes;
+
+        //links已按物理位置排序：next不是下一个元素的叶子节点即为物理上不相邻
+        for (size_t i = 0; i < links.size(); ++i)
+        {
+            if (links[i].second != 0 &&
+                (i + 1 == links.size() || links[i + 1].first != links[i].second))
+                res.non_adjacent_leaves++;
+        }
+
+        res.file_bytes = meta.slot;
+        //合并或根节点移除时被删除的内节点的缓冲区不再被引用，与节点本身一样算作dead_bytes
+        res.live_bytes = OFFSET_BLOCK + meta.internal_node_num * sizeof(internal_node_t) +
+                         res.buffer_bytes + meta.leaf_node_num * leaf_block_size();
+        res.dead_bytes = res.file_bytes > res.live_bytes ? res.file_bytes - res.live_bytes : 0;
+        return res;
+    }
+
+    //---------------------------------
+    //并行读取一层节点并统计
+    //参数说明：
+    //  nodes：   本层节点的偏移量
+    //  leaf：    是否为叶子节点层
+    //  threads： 线程数
+    //  stat：    本层统计结果
+    //  children：内节点层返回下一层节点的偏移量
+    //  links：   叶子节点层返回按偏移量排序的(叶子节点, next)
+    //  stored：  叶子节点层返回叶子节点实际写入的字节数，内节点层返回已分配的消息缓冲区的字节数
+    //---------------------------------
+    void bplus_tree::analyze_level(const std::vector<off_t> &nodes, bool leaf, size_t threads,
+                                   level_stat_t &stat, std::vector<off_t> *children,
+                                   std::vector<std::pair<off_t, off_t>> *links,
+                                   size_t *stored) const
+    {
+        //按物理位置排序，让每个线程顺序读取一段连续的区域
+        std::vector<off_t> sorted(nodes);
+        std::sort(sorted.begin(), sorted.end());
+        threads = std::max((size_t)1, std::min(threads, sorted.size()));
+
+        struct part_t
+        {
+            level_stat_t stat;
+            std::vector<off_t> children;
+            std::vector<std::pair<off_t, off_t>> links;
+            size_t stored;
+        };
+        std::vector<part_t> parts(threads);
+        std::vector<std::thread> workers;
+        bool compressed = (meta.flags & BP_FLAG_COMPRESS) != 0;
+        bool has_buffer = !leaf && buffered(); //不是缓冲模式时buffer的位置保存的是parent
+
+        for (size_t t = 0; t < threads; ++t)
+        {
+            size_t from = sorted.size() * t / threads, to = sorted.size() * (t + 1) / threads;
+            workers.push_back(std::thread([&, t, from, to]() {
+                part_t &part = parts[t];
+                memset(&part.stat, 0, sizeof(part.stat));
+                part.stored = 0;
+
+                FILE *file = fopen(path, "rb");
+                if (file == NULL)
+                    return;
+
+                internal_node_t node; //叶子节点只读取与内节点相同的头部
+                size_t head = SIZE_NO_CHILDREN + (leaf && compressed ? sizeof(size_t) : 0);
+                for (size_t i = from; i < to; ++i)
+                {
+                    fseek(file, sorted[i], SEEK_SET);
+                    if (fread(&node, leaf ? head : sizeof(node), 1, file) != 1)
+                        continue;
+
+                    part.stat.nodes++;
+                    part.stat.keys += node.n;
+                    part.stat.fill[std::min(node.n * BP_FILL_BUCKETS / meta.order,
+                                            (size_t)BP_FILL_BUCKETS - 1)]++;
+                    if (leaf)
+                    {
+                        part.links.push_back(std::make_pair(sorted[i], node.next));
+
+                        //压缩模式下头部之后是压缩长度（0表示未压缩），只写入有效的n条记录；
+                        //不压缩时unmap总是写入整个节点
+                        if (compressed)
+                        {
+                            size_t zlen;
+                            memcpy(&zlen, (char *)&node + SIZE_NO_CHILDREN, sizeof(size_t));
+                            part.stored += head + (zlen != 0 ? zlen : node.n * sizeof(record_t));
+                        }
+                        else
+                            part.stored += leaf_block_size();
+                    }
+                    else
+                    {
+                        for (size_t c = 0; c < node.n; ++c)
+                            part.children.push_back(node.children[c].child);
+                        if (has_buffer && node.buffer != 0)
+                            part.stored += sizeof(buffer_node_t);
+                    }
+                }
+                fclose(file);
+            }));
+        }
+        for (size_t t = 0; t < workers.size(); ++t)
+            workers[t].join();
+
+        //合并各线程的结果（各段本身有序，按顺序拼接后links仍然有序）
+        memset(&stat, 0, sizeof(stat));
+        for (size_t t = 0; t < parts.size(); ++t)
+        {
+            stat.nodes += parts[t].stat.nodes;
+            stat.keys += parts[t].stat.keys;
+            for (size_t b = 0; b < BP_FILL_BUCKETS; ++b)
+                stat.fill[b] += parts[t].stat.fill[b];
+            if (children != NULL)
+                children->insert(children->end(), parts[t].children.begin(), parts[t].children.end());
+            if (links != NULL)
+                links->insert(links->end(), parts[t].links.begin(), parts[t].links.end());
+            if (stored != NULL)
+                *stored += parts[t].stored;
+        }
+    }
+
+    //---------------------------------
+    //收集[left, right]范围内的叶子节点（按关键字顺序）
+    //从根节点逐层往下，每一层只有第一个和最后一个节点需要按left/right截取子节点
+    //---------------------------------
+    void bplus_tree::scan_leaves(const key_t &left, const key_t &right, std::vector<off_t> &leaves) const
+    {
+        std::vector<off_t> level(1, meta.root_offset), children;
+        for (size_t h = 0; h < meta.height; ++h)
+        {
+            children.clear();
+            for (size_t i = 0; i < level.size(); ++i)
+            {
+                internal_node_t node;
+                map(&node, level[i]);
+                index_t *from = i == 0 ? find(node, left) : begin(node);
+                index_t *to = i + 1 == level.size() ? find(node, right) + 1 : end(node);
+                for (; from != to; ++from)
+                    children.push_back(from->child);
+            }
+            level.swap(children);
+        }
+        leaves.swap(level);
+    }
+
+    //---------------------------------
+    //不经过缓存读取一个叶子节点（供工作线程使用，不修改任何成员）
+    //参数说明：
+    //  file：  线程自己的文件句柄
+    //  offset：叶子节点偏移量
+    //  leaf：  解析结果
+    //返回值：读取的字节数，块不完整或无法解析时返回0
+    //---------------------------------
+    size_t bplus_tree::read_leaf(FILE *file, off_t offset, leaf_node_t *leaf) const
+    {
+        if (fseek(file, offset, SEEK_SET) != 0)
+            return 0;
+        if (!(meta.flags & BP_FLAG_COMPRESS))
+            return fread(leaf, sizeof(leaf_node_t), 1, file) == 1 ? sizeof(leaf_node_t) : 0;
+
+        //压缩模式：头部 + 压缩长度 + 数据，与load_leaf相同
+        char buf[sizeof(leaf_node_t) + sizeof(size_t)];
+        const size_t head = SIZE_NO_CHILDREN + sizeof(size_t);
+        size_t rd = fread(buf, 1, std::min(sizeof(buf), (size_t)BP_COMPRESS_READ), file);
+        if (rd < head)
+            return 0;
+
+        memcpy((void *)leaf, buf, SIZE_NO_CHILDREN);
+        size_t zlen;
+        memcpy(&zlen, buf + SIZE_NO_CHILDREN, sizeof(size_t));
+        size_t raw_len = leaf->n * sizeof(record_t);
+        size_t need = head + (zlen == 0 ? raw_len : zlen);
+        if (leaf->n > BP_ORDER || need > leaf_block_size())
+            return 0;
+        if (rd < need)
+            rd += fread(buf + rd, 1, need - rd, file);
+        if (rd < need)
+            return 0;
+
+        if (zlen == 0)
+            memcpy(leaf->children, buf + head, raw_len);
+        else if (lz_decompress(buf + head, zlen, leaf->children, raw_len) != raw_len)
+            return 0;
+        return rd;
+    }
+
+    //---------------------------------
+    //并行扫描：逐条交给visit
+    //---------------------------------
+    int bplus_tree::parallel_scan(const key_t &left, const key_t &right,
+                                  const std::function<void(const record_t &, size_t)> &visit,
+                                  size_t threads) const
+    {
+        auto each = [&visit](const record_t *b, const record_t *e, size_t t) {
+            for (; b != e; ++b)
+                visit(*b, t);
+        };
+        return parallel_scan_leaves(left, right, each, threads);
+    }
+
+    //---------------------------------
+    //并行扫描：一次交给visit一个叶子节点中在范围内的全部记录
+    //叶子节点先按顺序平均分成threads段，每个线程从自己那段的前面开始取；
+    //自己的段取完后，找剩余最多的线程，把它剩下的后一半拿过来接着做
+    //参数说明：
+    //  left/right：范围
+    //  visit：     在工作线程中调用，第二个参数是线程编号
+    //  threads：   线程数（0表示每个CPU核心一个线程）
+    //返回值：扫描数据的个数，范围不合法或有叶子节点读取失败返回-1
+    //---------------------------------
+    int bplus_tree::parallel_scan_leaves(const key_t &left, const key_t &right,
+                                         const std::function<void(const record_t *, const record_t *, size_t)> &visit,
+                                         size_t threads) const
+    {
+        if (keycmp(left, right) > 0)
+            return -1;
+
+        //事务、批量写入中、缓冲模式下或内存表不为空时文件里的叶子节点不是最新的数据，
+        //在当前线程上顺序扫描，每凑满一个节点交给visit
+        if (txn || batch_level > 0 || buffered() || !memtable.empty())
+        {
+            std::vector<record_t> chunk;
+            chunk.reserve(BP_ORDER);
+            int count = scan(left, right, [&visit, &chunk](const record_t &r) {
+                chunk.push_back(r);
+                if (chunk.size() == BP_ORDER)
+                {
+                    visit(chunk.data(), chunk.data() + chunk.size(), 0);
+                    chunk.clear();
+                }
+            });
+            if (!chunk.empty())
+                visit(chunk.data(), chunk.data() + chunk.size(), 0);
+            return count;
+        }
+
+        if (threads == 0)
+            threads = std::max(1U, std::thread::hardware_concurrency());
+
+        std::vector<off_t> leaves;
+        scan_leaves(left, right, leaves);
+        threads = std::max((size_t)1, std::min(threads, leaves.size()));
+
+        //每个线程还没有读取的叶子节点为[next, end)
+        struct share_t
+        {
+            std::mutex mtx;
+            size_t next, end;
+            size_t count, reads, read_bytes;
+        };
+        std::vector<share_t> shares(threads);
+        for (size_t t = 0; t < threads; ++t)
+        {
+            shares[t].next = leaves.size() * t / threads;
+            shares[t].end = leaves.size() * (t + 1) / threads;
+            shares[t].count = shares[t].reads = shares[t].read_bytes = 0;
+        }
+
+        //取出线程t要读取的下一个叶子节点，全部读完时返回false
+        auto take = [&shares, threads](size_t t, size_t &index) -> bool {
+            share_t &own = shares[t];
+            {
+                std::lock_guard<std::mutex> lock(own.mtx);
+                if (own.next < own.end)
+                {
+                    index = own.next++;
+                    return true;
+                }
+            }
+
+            for (;;)
+            {
+                size_t victim = threads, most = 0;
+                for (size_t v = 0; v < threads; ++v)
+                {
+                    if (v == t)
+                        continue;
+                    std::lock_guard<std::mutex> lock(shares[v].mtx);
+                    if (shares[v].end - shares[v].next > most)
+                    {
+                        most = shares[v].end - shares[v].next;
+                        victim = v;
+                    }
+                }
+                if (victim == threads)
+                    return false;
+
+                size_t from, to;
+                {
+                    std::lock_guard<std::mutex> lock(shares[victim].mtx);
+                    share_t &other = shares[victim];
+                    if (other.next == other.end)
+                        continue; //已经被别的线程取完，重新找
+                    from = other.next + (other.end - other.next) / 2;
+                    to = other.end;
+                    other.end = from;
+                }
+
+                std::lock_guard<std::mutex> lock(own.mtx);
+                index = from;
+                own.next = from + 1;
+                own.end = to;
+                return true;
+            }
+        };
+
+        //打不开文件或读不出叶子节点时结果不完整，所有线程停下来，返回-1
+        std::atomic<bool> failed(false);
+        std::vector<std::thread> workers;
+        for (size_t t = 0; t < threads; ++t)
+        {
+            workers.push_back(std::thread([&, t]() {
+                FILE *file = fopen(path, "rb");
+                if (file == NULL)
+                {
+                    failed = true;
+                    return;
+                }
+
+                share_t &own = shares[t];
+                leaf_node_t leaf;
+                size_t i;
+                while (!failed && take(t, i))
+                {
+                    size_t rd = read_leaf(file, leaves[i], &leaf);
+                    if (rd == 0)
+                    {
+                        failed = true;
+                        break;
+                    }
+                    own.reads++;
+                    own.read_bytes += rd;
+
+                    //只有第一个和最后一个叶子节点需要按范围截取
+                    record_t *b = i == 0 ? find(leaf, left) : begin(leaf);
+                    record_t *e = i + 1 == leaves.size() ? std::upper_bound(begin(leaf), end(leaf), right)
+                                                         : end(leaf);
+                    if (b < e)
+                    {
+                        visit(b, e, t);
+                        own.count += e - b;
+                    }
+                }
+                fclose(file);
+            }));
+        }
+        for (size_t t = 0; t < workers.size(); ++t)
+            workers[t].join();
+
+        size_t count = 0;
+        for (size_t t = 0; t < threads; ++t)
+        {
+            count += shares[t].count;
+            io_stats.reads += shares[t].reads;
+            io_stats.read_bytes += shares[t].read_bytes;
+        }
+        return failed ? -1 : count;
+    }
+
+    //---------------------------------
+    //聚合：每个线程先统计自己扫描到的记录，最后合并
+    //参数说明：
+    //  filter：只统计filter返回true的记录（NULL表示全部）
+    //---------------------------------
+    aggregate_t bplus_tree::aggregate(const key_t &left, const key_t &right,
+                                      const std::function<bool(const record_t &)> &filter,
+                                      size_t threads) const
+    {
+        auto fold = [&filter](const record_t *b, const record_t *e, aggregate_t &agg) {
+            for (; b != e; ++b)
+                if (!filter || filter(*b))
+                    agg.add(*b);
+        };
+        return aggregate_leaves(left, right, fold, threads);
+    }
+
+    //---------------------------------
+    //按叶子节点聚合：每个线程把交给它的记录段用fold累加到自己的结果中，扫描结束后合并
+    //参数说明：
+    //  fold：   在工作线程中调用，把[begin, end)中的记录累加到该线程的agg
+    //  threads：线程数（0表示每个CPU核心一个线程）
+    //返回值：
+    //  合并后的结果，有叶子节点读取失败时failed为true
+    //---------------------------------
+    aggregate_t bplus_tree::aggregate_leaves(const key_t &left, const key_t &right,
+                                             const std::function<void(const record_t *, const record_t *, aggregate_t &)> &fold,
+                                             size_t threads) const
+    {
+        if (threads == 0)
+            threads = std::max(1U, std::thread::hardware_concurrency());
+
+        //每个线程的结果隔开一段，避免不同线程写同一缓存行
+        struct part_t
+        {
+            aggregate_t agg;
+            char pad[64];
+        };
+        std::vector<part_t> parts(threads);
+        for (size_t t = 0; t < threads; ++t)
+            parts[t].agg.clear();
+
+        auto visit = [&parts, &fold](const record_t *b, const record_t *e, size_t t) {
+            fold(b, e, parts[t].agg);
+        };
+        int scanned = parallel_scan_leaves(left, right, visit, threads);
+
+        aggregate_t res;
+        res.clear();
+        for (size_t t = 0; t < threads; ++t)
+            res.merge(parts[t].agg);
+        res.failed = scanned < 0 && keycmp(left, right) <= 0; //范围不合法时结果为空，不算失败
+        return res;
+    }
+
+    //---------------------------------
+    //根据索引删除节点的操作
+    //参数说明：
+    //  path： 下降路径（load_path读取），修改只记录在path中，由调用者写回
+    //  depth：所要删除的节点是path.images[depth - 1]，它的父结点是path.images[depth - 2]
+    //  pos： 删除第pos个关键字和第pos + 1个子节点（它已被合并到第pos个子节点中）
+    //----------------------------------
+    void bplus_tree::remove_from_index(path_t &path, size_t depth, size_t pos)
+    {
+        off_t offset = path.nodes[depth - 1];
+        internal_node_t &node = path.images[depth - 1];
+        size_t min_n = meta.root_offset == offset ? 1 : meta.order / 2;
+        assert(node.n >= min_n && node.n <= meta.order);
+
+        //删除数据
+        assert(pos + 1 < node.n);
+        index_t *to_delete = begin(node) + pos;
+        (to_delete + 1)->child = to_delete->child;
+        copy(to_delete + 1, end(node), to_delete); //覆盖操作
+        --node.n;
+        path.dirty[depth - 1] = true;
+
+        //删除后如果只剩下一个节点
+        if (node.n == 1 && meta.root_offset == offset &&
+            meta.internal_node_num != 1)
+        {
+            //缓冲模式下根节点的缓冲区（再平衡之前已清空）与根节点一起被删除，analyze中算作dead_bytes
+            path.dirty[depth - 1] = false;
+            unalloc(&node, meta.root_offset);
+            meta.height--;
+            io_stats.height_decreases++;
+            meta.root_offset = node.children[0].child;
+            unmap(&meta, OFFSET_META);
+            return;
+        }
+
+        //判断删除后是否需要合并或借用兄弟节点
+        if (node.n < min_n)
+        {
+            assert(depth >= 2);
+            internal_node_t &parent = path.images[depth - 2];
+
+            bool borrowed = false;
+            //借用左兄弟节点（前提是左兄弟节点存在）
+            if (offset != begin(parent)->child)
+                borrowed = borrow_key(false, node, offset, parent);
+
+            //借用右兄弟节点（前提是右兄弟节点存在）
+            if (!borrowed && offset != (end(parent) - 1)->child)
+                borrowed = borrow_key(true, node, offset, parent);
+
+            //没有借用则需要合并
+            if (!borrowed)
+            {
+                assert(node.next != 0 || node.prev != 0);
+                index_t *where = find_child(parent, offset);
+
+                //如果是最后一个节点
+                if (where == end(parent) - 1)
+                {
+                    assert(node.prev != 0);
+                    internal_node_t prev;
+                    map(&prev, node.prev);
+
+                    //合并操作（父结点中应删除的是prev对应的元素）
+                    --where;
+                    merge_keys(where, prev, node);
+                    unmap(&prev, node.prev);
+                    path.dirty[depth - 1] = false; //node已被合并到prev中
+                }
+                //如果不是最后一个节点
+                else
+                {
+                    assert(node.next != 0);
+                    internal_node_t next;
+                    map(&next, node.next);
+
+                    //合并操作
+                    merge_keys(where, node, next);
+                }
+
+                //删除父结点
+                remove_from_index(path, depth - 1, where - begin(parent));
+            }
+            //如果借用了兄弟节点，父结点中的分隔关键字也变了
+            else
+            {
+                path.dirty[depth - 2] = true;
+            }
+        }
+    }
+
+    //---------------------------------
+    //借用兄弟节点的操作（内节点）
+    //参数说明：
+    //  from_right:是否从右边借用
+    //  borrower: 借用的节点
+    //  offset: 数据在节点中的偏移量
+    //  parent: 父结点（兄弟节点与borrower在同一个父结点下），由调用者写回
+    //返回值：
+    //  true为借用成功，false为失败
+    //--------------------------------
+    bool bplus_tree::borrow_key(bool from_right, internal_node_t &borrower,
+                                off_t offset, internal_node_t &parent)
+    {
+        //定位兄弟节点(借之前判断兄弟节点是否在减掉一个节点的时候没有破坏结构)
+        off_t lender_off = from_right ? borrower.next : borrower.prev;
+        internal_node_t lender;
+        map(&lender, lender_off);
+
+        if (lender.n > meta.order / 2)
+        {
+            //父结点中分隔borrower与lender的关键字（内节点最后一个关键字不使用，借用时经过父结点轮换）
+            index_t *where = find_child(parent, offset);
+            assert(where != end(parent));
+            if (!from_right)
+                --where;
+
+            if (from_right)
+            {
+                //lender的第一个子节点接到borrower末尾：分隔关键字下移，lender的第一个关键字上移
+                (end(borrower) - 1)->key = where->key;
+                *end(borrower) = *begin(lender);
+                where->key = begin(lender)->key;
+                copy(begin(lender) + 1, end(lender), begin(lender));
+            }
+            else
+            {
+                //lender的最后一个子节点放到borrower开头：分隔关键字下移，lender的倒数第二个关键字上移
+                copy_backward(begin(borrower), end(borrower), end(borrower) + 1);
+                begin(borrower)->key = where->key;
+                begin(borrower)->child = (end(lender) - 1)->child;
+                where->key = (end(lender) - 2)->key;
+            }
+            borrower.n++;
+            lender.n--;
+
+            unmap(&lender, lender_off);
+            io_stats.internal_borrows++;
+            return true;
+        }
+        return false;
+    }
+
+    //-----------------------------------
+    //借用兄弟节点的操作（叶子节点）
+    //参数说明：
+    //  from_right:是否借用右兄弟节点
+    //  borrower：想要借用的节点
+    //  path：    borrower的下降路径（load_path读取）
+    //  key：     下降时使用的关键字
+    // 返回值：
+    // true表示借用成功，false表示失败
+    //------------------------------------
+    bool bplus_tree::borrow_key(bool from_right, leaf_node_t &borrower, path_t &path,
+                                const key_t &key)
+    {
+        off_t lender_off = from_right ? borrower.next : borrower.prev;
+        pooled<leaf_node_t> lender_image(pool);
+        leaf_node_t &lender = *lender_image;
+        map(&lender, lender_off);
+
+        //宽松填充时兄弟节点也可能低于半满
+        if (lender.n > meta.order / 2)
+        {
+            typename leaf_node_t::child_t where_to_lend, where_to_put;
+
+            //移动兄弟节点
+            if (from_right)
+            {
+                where_to_lend = begin(lender);
+                where_to_put = end(borrower);
+                change_separator(path, key, true, lender.children[1].key);
+            }
+            else
+            {
+                where_to_lend = end(lender) - 1;
+                where_to_put = begin(borrower);
+                change_separator(path, key, false, where_to_lend->key);
+            }
+
+            //保存
+            copy_backward(where_to_put, end(borrower), end(borrower) + 1);
+            *where_to_put = *where_to_lend;
+            borrower.n++;
+
+            //删除
+            copy(where_to_lend + 1, end(lender), where_to_lend);
+            lender.n--;
+            unmap(&lender, lender_off);
+            io_stats.leaf_borrows++;
+            return true;
+        }
+        return false;
+    }
+
+    //--------------------------------------
+    //更新叶子节点与左（右）兄弟节点之间的分隔关键字
+    //分隔关键字在路径上最深的、叶子节点不在最左（最右）分支的内节点中
+    //参数说明：
+    //  path：     叶子节点的下降路径（load_path读取），修改后由调用者写回
+    //  key：      下降时使用的关键字
+    //  right：    是否为与右兄弟节点之间的关键字
+    //  separator: 新关键字
+    //---------------------------------------
+    void bplus_tree::change_separator(path_t &path, const key_t &key, bool right,
+                                      const key_t &separator)
+    {
+        for (size_t d = path.depth; d-- > 0;)
+        {
+            internal_node_t &node = path.images[d];
+            index_t *w = find(node, key);
+            if (right ? w != end(node) - 1 : w != begin(node))
+            {
+                (right ? w : w - 1)->key = separator;
+                path.dirty[d] = true;
+                return;
+            }
+        }
+        assert(false);
+    }
+
+    //----------------------------------
+    //将右叶子节点部分合并到左子节点的后面
+    //参数说明：
+    //  left：左叶子节点
+    //  right：右叶子节点
+    //---------------------------------
+    void bplus_tree::merge_leafs(leaf_node_t *left, leaf_node_t *right)
+    {
+        copy(begin(*right), end(*right), end(*left));
+        left->n += right->n;
+        io_stats.leaf_merges++;
+    }
+
+    //---------------------------------
+    //将next的内节点部分合并到node的内节点的后面
+    //参数说明：
+    //  where：父结点中分隔node与next的元素，它的关键字成为node原最后一个子节点的关键字
+    //  node：进行合并的内节点
+    //  next：将要被合并的内节点
+    //----------------------------------
+    void bplus_tree::merge_keys(index_t *where, internal_node_t &node,
+                                internal_node_t &next)
+    {
+        (end(node) - 1)->key = where->key;
+        copy(begin(next), end(next), end(node));
+        node.n += next.n;
+        io_stats.internal_merges++;
+
+        //缓冲模式下合并之前已清空所有缓冲区：node没有缓冲区时接着使用next的空缓冲区，
+        //否则next的缓冲区与next一起被删除（analyze中算作dead_bytes）
+        if (buffered() && node.buffer == 0)
+            node.buffer = next.buffer;
+        node_remove(&node, &next);
+    }
+
+    //---------------------------------
+    //在不分离的情况下插入记录
+    //参数说明：
+    //  leaf：将要被插入数据的叶子节点
+    //  key：插入的关键字
+    //  value：插入的数据
+    //---------------------------------
+    void bplus_tree::insert_record_no_split(leaf_node_t *leaf,
+                                            const key_t &key, const value_t &value)
+    {
+        record_t *where = upper_bound(begin(*leaf), end(*leaf), key);
+        copy_backward(where, end(*leaf), end(*leaf) + 1);
+
+        where->key = key;
+        where->value = value;
+        ++leaf->n;
+    }
+
+    //--------------------------------
+    //往内节点插入关键字
+    //分裂只写入发生变化的节点：子节点不保存父结点，分裂时沿下降路径向上，不需要修改被移动的子节点
+    //参数说明：
+    //  path：  下降路径
+    //  depth： 插入path.nodes[depth - 1]，为0时需要新创建根节点
+    //  key：   插入的关键字
+    //  old：   左子节点
+    //  after： 右子节点
+    //--------------------------------
+    void bplus_tree::insert_key_to_index(const path_t &path, size_t depth, const key_t &key,
+                                         off_t old, off_t after)
+    {
+        if (depth == 0)
+        {
+            internal_node_t root;
+            root.next = 0;
+            root.prev = 0;
+            root.parent = 0;
+            meta.root_offset = alloc(&root);
+            meta.height++;
+            io_stats.height_increases++;
+
+            //插入old和after
+            root.n = 2;
+            root.children[0].key = key;
+            root.children[0].child = old;
+            root.children[1].child = after;
+
+            unmap(&meta, OFFSET_META);
+            unmap(&root, meta.root_offset);
+            return;
+        }
+
+        //定位将要进行插入操作的节点
+        off_t offset = path.nodes[depth - 1];
+        internal_node_t node;
+        map(&node, offset);
+        assert(node.n <= meta.order);
+
+        //如果满了则需要分离
+        if (node.n == meta.order)
+        {
+            internal_node_t new_node;
+            node_create(offset, &node, &new_node);
+
+            //找到分离点
+            size_t point = (node.n - 1) / 2;
+            bool place_right = keycmp(key, node.children[point].key) > 0;
+            if (place_right)
+                ++point;
+
+            //如果point+1后对应的关键字比key小，需要回退一步
+            if (place_right && keycmp(key, node.children[point].key) < 0)
+                point--;
+
+            key_t middle_key = node.children[point].key;
+
+            //分离操作
+            copy(begin(node) + point + 1, end(node), begin(new_node));
+            new_node.n = node.n - point - 1;
+            node.n = point + 1;
+
+            //缓冲区中大于等于中间关键字的消息属于新节点
+            if (buffered())
+                split_buffer(node, new_node, middle_key);
+
+            //插入新关键字
+            if (place_right)
+                insert_key_to_index_no_split(new_node, key, after);
+            else
+                insert_key_to_index_no_split(node, key, after);
+
+            unmap(&node, offset);
+            unmap(&new_node, node.next);
+
+            //将中间关键字放到父结点中
+            insert_key_to_index(path, depth - 1, middle_key, offset, node.next);
+        }
+        else
+        {
+            insert_key_to_index_no_split(node, key, after);
+            unmap(&node, offset);
+        }
+    }
+
+    //----------------------------------
+    //往内节点插入（不分离）
+    //参数说明：
+    //  node: 想要插入的内节点
+    //  key： 插入的关键字
+    //  value：插入的数据
+    //----------------------------------
+    void bplus_tree::insert_key_to_index_no_split(internal_node_t &node,
+                                                  const key_t &key, off_t value)
+    {
+        index_t *where = upper_bound(begin(node), end(node) - 1, key);
+
+        //将后面的节点往后挪一个位置
+        copy_backward(where, end(node), end(node) + 1);
+
+        //插入该关键字
+        where->key = key;
+        where->child = (where + 1)->child;
+        (where + 1)->child = value;
+
+        node.n++;
+    }
+
+    //-----------------------------
+    //获取对应关键字的下标(内节点)
+    //参数说明：
+    //  key： 要搜索的关键字
+    //返回值：
+    //  关键字在内存的偏移量
+    //-----------------------------
+    off_t bplus_tree::search_index(const key_t &key) const
+    {
+        off_t org = meta.root_offset;
+        int height = meta.height;
+        while (height > 1)
+        {
+            internal_node_t node;
+            map(&node, org);
+
+            index_t *i = upper_bound(begin(node), end(node) - 1, key);
+            org = i->child;
+            --height;
+        }
+
+        return org;
+    }
+
+    //-----------------------------
+    //记录关键字的下降路径（根节点到叶子节点的父结点）
+    //参数说明：
+    //  key： 要搜索的关键字
+    //  path：返回路径上各内节点的偏移量
+    //-----------------------------
+    void bplus_tree::search_path(const key_t &key, path_t &path) const
+    {
+        off_t org = meta.root_offset;
+        path.depth = 0;
+        path.images = NULL;
+        for (size_t height = meta.height; height > 0; --height)
+        {
+            assert(path.depth < BP_MAX_HEIGHT);
+            path.nodes[path.depth++] = org;
+            if (height == 1)
+                break;
+
+            internal_node_t node;
+            map(&node, org);
+            org = find(node, key)->child;
+        }
+    }
+
+    //-----------------------------
+    //记录下降路径并保存路径上的内节点（删除使用）
+    //参数说明：
+    //  key： 要搜索的关键字
+    //  path：返回路径，images指向path_images
+    //-----------------------------
+    void bplus_tree::load_path(const key_t &key, path_t &path)
+    {
+        assert(meta.height <= BP_MAX_HEIGHT);
+        path_images.resize(meta.height);
+        path.images = path_images.data();
+        path.depth = meta.height;
+
+        off_t org = meta.root_offset;
+        for (size_t d = 0; d < path.depth; ++d)
+        {
+            path.nodes[d] = org;
+            path.dirty[d] = false;
+            map(&path.images[d], org);
+            org = find(path.images[d], key)->child;
+        }
+    }
+
+    //-----------------------------
+    //写回路径上修改过的内节点
+    //-----------------------------
+    void bplus_tree::store_path(path_t &path)
+    {
+        for (size_t d = 0; d < path.depth; ++d)
+        {
+            if (path.dirty[d])
+                unmap(&path.images[d], path.nodes[d]);
+            path.dirty[d] = false;
+        }
+    }
+
+    //-----------------------------
+    //获取关键字在叶子节点的下标
+    //参数说明：
+    //  index：
+    //  key：要搜索的关键字
+    //-----------------------------
+    off_t bplus_tree::search_leaf(off_t index, const key_t &key) const
+    {
+        internal_node_t node;
+        map(&node, index);
+
+        index_t *i = upper_bound(begin(node), end(node) - 1, key);
+        return i->child;
+    }
+
+    //---------------------------
+    //创建新节点
+    //参数说明：
+    //  offset: 创建节点的位置
+    //  node：  创建的节点
+    //  next：  创建成功后将新创建的节点的后继节点返回到next中
+    //---------------------------
+
+    template <class T>
+    void bplus_tree::node_create(off_t offset, T *node, T *next)
+    {
+        //把node的后继节点赋给next
+        next->parent = node->parent;
+        next->next = node->next;
+        next->prev = offset;
+
+        //将next创建在node之后
+        node->next = alloc(next);
+        count_split(node);
+
+        //如果next后继节点不为空，也就说明node本身的后继指向不为空
+        //则修正原本后继节点的前驱指向
+        if (next->next != 0)
+        {
+            pooled<T> old_next(pool);
+            map(old_next.get(), next->next, SIZE_NO_CHILDREN);
+            old_next->prev = node->next;
+            unmap(old_next.get(), next->next, SIZE_NO_CHILDREN);
+        }
+        unmap(&meta, OFFSET_META); //保存操作
+    }
+
+    //--------------------------------
+    //删除节点
+    //参数说明：
+    //  prev：所删除节点的前驱节点
+    //  node：将要删除的节点
+    //--------------------------------
+    template <class T>
+    void bplus_tree::node_remove(T *prev, T *node)
+    {
+        //改变当前节点的数量（视具体node和prev的类型而定）
+        unalloc(node, prev->next);
+
+        prev->next = node->next;
+        if (node->next != 0)
+        {
+            pooled<T> next(pool);
+            map(next.get(), node->next, SIZE_NO_CHILDREN);
+            next->prev = node->prev;
+            unmap(next.get(), node->next, SIZE_NO_CHILDREN);
+        }
+        unmap(&meta, OFFSET_META);
+    }
+
+    //-------------------------------
+    //初始化空树
+    //参数说明：
+    //  flags：存储选项（BP_FLAG_*）
+    //-------------------------------
+    void bplus_tree::init_from_empty(size_t flags)
     {
-        copy(begin(next), end(next), end(node));
-        node.n += next.n;
-        node_remove(&node, &next);
+        //初始化meta
+        memset(&meta, 0, sizeof(meta_t));
+        cache.clear();
+        meta.flags = flags;
+        meta.order = BP_ORDER;
+        meta.value_size = sizeof(value_t);
+        meta.key_size = sizeof(key_t);
+        meta.height = 1;
+        meta.slot = OFFSET_BLOCK;
+
+        //初始化根节点
+        internal_node_t root;
+        root.next = 0;
+        root.prev = 0;
+        root.parent = 0;
+        meta.root_offset = alloc(&root);
+
+        //初始化空叶子节点
+        pooled<leaf_node_t> leaf_image(pool);
+        leaf_node_t &leaf = *leaf_image;
+        leaf.next = 0;
+        leaf.prev = 0;
+        leaf.parent = 0;
+        meta.leaf_offset = root.children[0].child = alloc(&leaf);
+
+        //保存操作
+        unmap(&meta, OFFSET_META);
+        unmap(&root, meta.root_offset);
+        unmap(&leaf, root.children[0].child);
+    }
+
+    //-------------------------------
+    //缓冲模式：把一条消息追加到根节点的缓冲区
+    //根节点的缓冲区满时先往下推，直到能放下为止，涉及的写入一起提交
+    //返回值：
+    //  0（写操作不读取叶子节点，不知道关键字是否存在）
+    //-------------------------------
+    int bplus_tree::put_message(int type, const key_t &key, const value_t *value)
+    {
+        begin_write_batch();
+        while (buffered_count(meta.root_offset) == BP_BUFFER_MSGS)
+            flush_step(meta.root_offset, meta.height);
+
+        internal_node_t root;
+        map(&root, meta.root_offset);
+
+        //只写头部和新消息，不需要读出已有的消息
+        pooled<buffer_node_t> buf(pool);
+        buf->n = buffered_count(meta.root_offset);
+        if (root.buffer == 0)
+        {
+            root.buffer = alloc(sizeof(buffer_node_t));
+            unmap(&root, meta.root_offset);
+            unmap(&meta, OFFSET_META);
+        }
+
+        message_t &m = buf->msgs[buf->n++];
+        m.key = key;
+        m.type = type;
+        if (value != NULL)
+            m.value = *value;
+        else
+            memset(&m.value, 0, sizeof(m.value));
+        unmap(buf.get(), root.buffer, buf->n - 1);
+        io_stats.buffered_msgs++;
+        end_write_batch();
+
+        //缓冲区推到叶子节点时删除留下的叶子节点攒够了，清空缓冲区后统一再平衡
+        size_t threshold = rebalance_threshold();
+        if (threshold > 0 && underfull.size() >= threshold)
+            rebalance();
+        return 0;
+    }
+
+    //-------------------------------
+    //缓冲模式：把内节点缓冲区中消息最多的子节点的那一批往下推一层
+    //子节点是叶子节点时按到达顺序逐条写入；子节点的缓冲区放不下时先推子节点，本次不移动消息
+    //参数说明：
+    //  offset：内节点的位置
+    //  height：offset所在的层往下还有几层内节点（为1时子节点是叶子节点）
+    //-------------------------------
+    void bplus_tree::flush_step(off_t offset, size_t height)
+    {
+        internal_node_t node;
+        map(&node, offset);
+        if (node.buffer == 0)
+            return;
+
+        pooled<buffer_node_t> buf(pool);
+        map(buf.get(), node.buffer);
+        if (buf->n == 0)
+            return;
+
+        //每个子节点对应的消息个数
+        std::vector<size_t> count(node.n, 0);
+        for (size_t i = 0; i < buf->n; ++i)
+            ++count[find(node, buf->msgs[i].key) - begin(node)];
+        size_t c = std::max_element(count.begin(), count.end()) - count.begin();
+        off_t child_off = node.children[c].child;
+
+        internal_node_t child;
+        pooled<buffer_node_t> child_buf(pool);
+        child_buf->n = 0;
+        if (height > 1)
+        {
+            map(&child, child_off);
+            if (child.buffer != 0)
+                map(child_buf.get(), child.buffer);
+            if (child_buf->n + count[c] > BP_BUFFER_MSGS)
+            {
+                flush_step(child_off, height - 1);
+                return;
+            }
+        }
+
+        //取出这一批（保持到达顺序），剩下的消息写回
+        std::vector<message_t> batch;
+        batch.reserve(count[c]);
+        size_t kept = 0;
+        for (size_t i = 0; i < buf->n; ++i)
+        {
+            if ((size_t)(find(node, buf->msgs[i].key) - begin(node)) == c)
+                batch.push_back(buf->msgs[i]);
+            else
+                buf->msgs[kept++] = buf->msgs[i];
+        }
+        buf->n = kept;
+        unmap(buf.get(), node.buffer);
+        io_stats.flushed_msgs += batch.size();
+
+        //追加到子节点的缓冲区，它们比子节点中已有的消息新
+        if (height > 1)
+        {
+            size_t from = child_buf->n;
+            if (child.buffer == 0)
+            {
+                child.buffer = alloc(sizeof(buffer_node_t));
+                unmap(&child, child_off);
+                unmap(&meta, OFFSET_META);
+            }
+            std::copy(batch.begin(), batch.end(), child_buf->msgs + from);
+            child_buf->n += batch.size();
+            unmap(child_buf.get(), child.buffer, from);
+            return;
+        }
+
+        //写入叶子节点：同一叶子节点的多次写入在批量写入中合并，
+        //叶子节点分裂引起的内节点分裂会一起分开缓冲区
+        for (size_t i = 0; i < batch.size(); ++i)
+        {
+            const message_t &m = batch[i];
+            if (m.type == BP_MSG_INSERT)
+                insert_record(m.key, m.value);
+            else if (m.type == BP_MSG_UPDATE)
+                update_record(m.key, m.value);
+            else if (m.type == BP_MSG_UPSERT)
+                modify_record(m.key, [&m](value_t &v, bool) {
+                    v = m.value;
+                    return true;
+                });
+            else
+                remove_record(m.key);
+        }
+    }
+
+    //-------------------------------
+    //缓冲模式：把所有缓冲的消息写入叶子节点
+    //从根节点开始逐层从左到右清空，分裂出的新节点在右边，会在后面遍历到
+    //-------------------------------
+    void bplus_tree::flush_buffers()
+    {
+        off_t first = meta.root_offset;
+        for (size_t height = meta.height; buffered() && height > 0; --height)
+        {
+            internal_node_t node;
+            off_t below = 0;
+            for (off_t off = first; off != 0; off = node.next)
+            {
+                while (buffered_count(off) > 0)
+                {
+                    begin_write_batch();
+                    flush_step(off, height);
+                    end_write_batch();
+                }
+                map(&node, off);
+                if (below == 0)
+                    below = node.children[0].child;
+            }
+            first = below;
+        }
+    }
+
+    //-------------------------------
+    //缓冲模式：内节点缓冲区中的消息个数
+    //-------------------------------
+    size_t bplus_tree::buffered_count(off_t offset) const
+    {
+        internal_node_t node;
+        map(&node, offset);
+        size_t n = 0;
+        if (node.buffer != 0)
+            map(&n, node.buffer, sizeof(n));
+        return n;
+    }
+
+    //-------------------------------
+    //缓冲模式：内节点分裂时，缓冲区中大于等于middle的消息移到新节点的缓冲区
+    //参数说明：
+    //  node：  分裂的内节点
+    //  next：  分裂出的新节点（node_create复制了node的缓冲区位置，这里重新设置）
+    //  middle：放到父结点中的关键字
+    //-------------------------------
+    void bplus_tree::split_buffer(internal_node_t &node, internal_node_t &next,
+                                  const key_t &middle)
+    {
+        next.buffer = 0;
+        if (node.buffer == 0)
+            return;
+
+        pooled<buffer_node_t> buf(pool), right(pool);
+        map(buf.get(), node.buffer);
+        size_t kept = 0;
+        right->n = 0;
+        for (size_t i = 0; i < buf->n; ++i)
+        {
+            if (keycmp(buf->msgs[i].key, middle) < 0)
+                buf->msgs[kept++] = buf->msgs[i];
+            else
+                right->msgs[right->n++] = buf->msgs[i];
+        }
+        if (right->n == 0)
+            return;
+
+        buf->n = kept;
+        unmap(buf.get(), node.buffer);
+        next.buffer = alloc(sizeof(buffer_node_t));
+        unmap(right.get(), next.buffer);
+        unmap(&meta, OFFSET_META);
+    }
+
+    //-------------------------------
+    //缓冲模式：把路径上缓冲区中key的消息合并到叶子节点中的查找结果上
+    //越往下的缓冲区中的消息越早，从下往上依次应用
+    //参数说明：
+    //  result：叶子节点中的查找结果（0表示存在），返回合并后的结果
+    //  value： 叶子节点中的值，存在时返回合并后的值
+    //-------------------------------
+    void bplus_tree::apply_messages(const key_t &key, int &result, value_t *value) const
+    {
+        path_t path;
+        search_path(key, path);
+
+        std::vector<message_t> found;
+        size_t level_end[BP_MAX_HEIGHT];
+        pooled<buffer_node_t> buf(pool);
+        for (size_t d = 0; d < path.depth; ++d)
+        {
+            internal_node_t node;
+            map(&node, path.nodes[d]);
+            if (node.buffer != 0)
+            {
+                map(buf.get(), node.buffer);
+                for (size_t i = 0; i < buf->n; ++i)
+                    if (keycmp(buf->msgs[i].key, key) == 0)
+                        found.push_back(buf->msgs[i]);
+            }
+            level_end[d] = found.size();
+        }
+        if (found.empty())
+            return;
+
+        msg_effect_t effect;
+        effect.clear();
+        for (size_t d = path.depth; d-- > 0;)
+            for (size_t i = d == 0 ? 0 : level_end[d - 1]; i < level_end[d]; ++i)
+                effect.apply(found[i]);
+
+        record_t base;
+        base.value = *value;
+        value_t out;
+        if (effect.resolve(result == 0 ? &base : NULL, out))
+        {
+            *value = out;
+            result = 0;
+        }
+        else
+            result = -1;
+    }
+
+    //-------------------------------
+    //缓冲模式：收集offset之下缓冲区中[left, right]内的消息，按关键字合并成总效果
+    //先收集下层（更早的）消息，再应用本节点的
+    //参数说明：
+    //  height：offset所在的层往下还有几层内节点
+    //-------------------------------
+    void bplus_tree::collect_messages(off_t offset, size_t height, const key_t &left,
+                                      const key_t &right, effect_map_t &effects) const
+    {
+        internal_node_t node;
+        map(&node, offset);
+        if (height > 1)
+        {
+            index_t *last = find(node, right);
+            for (index_t *i = find(node, left); i <= last; ++i)
+                collect_messages(i->child, height - 1, left, right, effects);
+        }
+        if (node.buffer == 0)
+            return;
+
+        pooled<buffer_node_t> buf(pool);
+        map(buf.get(), node.buffer);
+        for (size_t i = 0; i < buf->n; ++i)
+        {
+            const message_t &m = buf->msgs[i];
+            if (keycmp(m.key, left) < 0 || keycmp(right, m.key) < 0)
+                continue;
+            effect_of(effects, m.key).apply(m);
+        }
+    }
+
+    //-------------------------------
+    //effects中key的总效果，没有时加入一个空的
+    //-------------------------------
+    bplus_tree::msg_effect_t &bplus_tree::effect_of(effect_map_t &effects, const key_t &key)
+    {
+        effect_map_t::iterator it = effects.find(key);
+        if (it == effects.end())
+        {
+            it = effects.insert(std::make_pair(key, msg_effect_t())).first;
+            it->second.clear();
+        }
+        return it->second;
+    }
+
+    //-------------------------------
+    //设置内存表的容量，keys为0时合并并关闭内存表
+    //-------------------------------
+    void bplus_tree::set_memtable(size_t keys)
+    {
+        memtable_keys = keys;
+        if (keys == 0 || memtable.size() >= keys)
+            merge_memtable();
+    }
+
+    //-------------------------------
+    //内存表：把一个写操作合并到关键字的总效果上，内存表满时合并到树中
+    //返回值：
+    //  0（不读取树，不知道关键字是否存在）
+    //-------------------------------
+    int bplus_tree::memtable_put(int type, const key_t &key, const value_t *value)
+    {
+        message_t m;
+        m.key = key;
+        m.type = type;
+        if (value != NULL)
+            m.value = *value;
+        effect_of(memtable, key).apply(m);
+        io_stats.memtable_writes++;
+
+        if (memtable.size() >= memtable_keys)
+            merge_memtable();
+        return 0;
+    }
+
+    //-------------------------------
+    //把内存表按关键字顺序合并到树中，所有写入作为一次批量写入：
+    //普通模式下按叶子节点分组，每组只下降一次、读写一次叶子节点；
+    //缓冲模式下把总效果换成与关键字是否存在无关的消息放入缓冲区，不需要先查找
+    //返回值：
+    //  合并的关键字个数
+    //-------------------------------
+    int bplus_tree::merge_memtable()
+    {
+        if (memtable.empty())
+            return 0;
+
+        //先取出内存表，下面的写入直接访问树
+        effect_map_t writes;
+        writes.swap(memtable);
+
+        begin_write_batch();
+        if (buffered())
+        {
+            for (auto it = writes.begin(); it != writes.end(); ++it)
+            {
+                //存在时先删除或更新，不存在时再插入（插入不覆盖存在的关键字）
+                const msg_effect_t &e = it->second;
+                if (e.present_state == 1 && e.absent_found &&
+                    memcmp(&e.present_value, &e.absent_value, sizeof(value_t)) == 0)
+                {
+                    write_tree(BP_MSG_UPSERT, it->first, &e.present_value);
+                    continue;
+                }
+                if (e.present_state == 0)
+                    write_tree(BP_MSG_REMOVE, it->first, NULL);
+                else if (e.present_state == 1)
+                    write_tree(BP_MSG_UPDATE, it->first, &e.present_value);
+                if (e.absent_found)
+                    write_tree(BP_MSG_INSERT, it->first, &e.absent_value);
+            }
+        }
+        else
+        {
+            for (auto it = writes.cbegin(); it != writes.cend();)
+                it = merge_into_leaf(it, writes.cend());
+        }
+        end_write_batch();
+        io_stats.memtable_merges++;
+        return (int)writes.size();
+    }
+
+    //-------------------------------
+    //把从from开始、落在同一个叶子节点中的总效果应用到这个叶子节点上：
+    //下降一次找到叶子节点和它的上界，在读出的叶子节点上修改，最后写回一次。
+    //需要分裂或再平衡的那个关键字改用单个关键字的写入
+    //返回值：
+    //  下一个没有处理的总效果
+    //-------------------------------
+    bplus_tree::effect_map_t::const_iterator
+    bplus_tree::merge_into_leaf(effect_map_t::const_iterator from, effect_map_t::const_iterator to)
+    {
+        //叶子节点的上界是路径上最靠下的、不是内节点最后一个元素的关键字
+        off_t offset = meta.root_offset;
+        key_t upper;
+        bool bounded = false;
+        for (size_t height = meta.height; height > 0; --height)
+        {
+            internal_node_t node;
+            map(&node, offset);
+            index_t *where = find(node, from->first);
+            if (where != end(node) - 1)
+            {
+                upper = where->key;
+                bounded = true;
+            }
+            offset = where->child;
+        }
+
+        pooled<leaf_node_t> leaf_image(pool);
+        leaf_node_t &leaf = *leaf_image;
+        map(&leaf, offset);
+
+        size_t min_n = meta.leaf_node_num == 1 ? 0 : meta.order / 2;
+        bool resized = false;                             //插入或删除过记录，整个叶子节点写回
+        std::vector<std::pair<size_t, value_t>> updated; //只更新时每条记录只写回改动的扇区
+        int restructure = 0;                              //需要分裂（1）或再平衡（-1）时停下
+        auto it = from;
+        for (; it != to && (!bounded || keycmp(it->first, upper) < 0); ++it)
+        {
+            const msg_effect_t &e = it->second;
+            record_t *record = find(leaf, it->first);
+            bool found = record != end(leaf) && keycmp(record->key, it->first) == 0;
+
+            if (found && e.present_state == 1)
+            {
+                updated.push_back(std::make_pair((size_t)(record - begin(leaf)), record->value));
+                record->value = e.present_value;
+            }
+            else if (found && e.present_state == 0 && leaf.n > min_n)
+            {
+                copy(record + 1, end(leaf), record);
+                leaf.n--;
+                resized = true;
+            }
+            else if (!found && e.absent_found && leaf.n < meta.order)
+            {
+                insert_record_no_split(&leaf, it->first, e.absent_value);
+                resized = true;
+            }
+            else if (found && e.present_state == 0)
+            {
+                restructure = -1;
+                break;
+            }
+            else if (!found && e.absent_found)
+            {
+                restructure = 1;
+                break;
+            }
+        }
+
+        if (resized)
+            unmap(&leaf, offset);
+        else
+        {
+            for (size_t i = 0; i < updated.size(); ++i)
+                unmap_value(&leaf, offset, leaf.children + updated[i].first, updated[i].second);
+        }
+
+        //叶子节点已满或删除后低于半满：这个关键字走分裂或再平衡的路径
+        if (restructure < 0)
+            remove_record((it++)->first);
+        else if (restructure > 0)
+        {
+            insert_record(it->first, it->second.absent_value);
+            ++it;
+        }
+        return it;
+    }
+
+    //-------------------------------
+    //读取内节点（经过缓存）
+    //-------------------------------
+    int bplus_tree::map(internal_node_t *node, off_t offset) const
+    {
+        complete_prefetch(offset);
+        const char *page = cache.get(offset, sizeof(internal_node_t));
+        count_map(page, sizeof(internal_node_t));
+        if (page != NULL)
+        {
+            memcpy((void *)node, page, sizeof(internal_node_t));
+            return 0;
+        }
+
+        int ret = read_block(node, offset, sizeof(internal_node_t));
+        if (ret == 0)
+            cache.put(offset, node, sizeof(internal_node_t));
+        return ret;
+    }
+
+    int bplus_tree::unmap(internal_node_t *node, off_t offset) const
+    {
+        drain_prefetch();
+        count_unmap(sizeof(internal_node_t));
+        cache.put(offset, node, sizeof(internal_node_t));
+        return write_block(node, offset, sizeof(internal_node_t));
+    }
+
+    //-------------------------------
+    //钉住叶子节点在缓存中的镜像，不在缓存中时先读入（压缩的叶子节点缓存的是解压后的镜像）
+    //-------------------------------
+    const leaf_node_t *bplus_tree::pin_leaf(off_t offset) const
+    {
+        complete_prefetch(offset);
+        const char *page = cache.pin(offset, sizeof(leaf_node_t));
+        if (page != NULL)
+            count_map(page, 0);
+        else
+        {
+            pooled<leaf_node_t> leaf(pool);
+            if (map(leaf.get(), offset) != 0)
+                return NULL;
+            page = cache.pin(offset, sizeof(leaf_node_t));
+        }
+        return (const leaf_node_t *)page;
+    }
+
+    //-------------------------------
+    //读取消息缓冲区（经过缓存）：先读头部得到消息个数，再读取前n条消息
+    //-------------------------------
+    int bplus_tree::map(buffer_node_t *buf, off_t offset) const
+    {
+        const size_t head = offsetof(buffer_node_t, msgs);
+        const char *page = cache.get(offset, head);
+        if (page != NULL)
+        {
+            size_t size = head + ((const buffer_node_t *)page)->n * sizeof(message_t);
+            page = cache.get(offset, size);
+            count_map(page, size);
+            if (page != NULL)
+            {
+                memcpy((void *)buf, page, size);
+                return 0;
+            }
+        }
+        else
+            count_map(NULL, head);
+
+        if (read_block(buf, offset, head) != 0)
+            return -1;
+        assert(buf->n <= BP_BUFFER_MSGS);
+        size_t size = head + buf->n * sizeof(message_t);
+        if (read_block(buf, offset, size) != 0)
+            return -1;
+        cache.put(offset, buf, size);
+        return 0;
     }
 
-    //---------------------------------
-    //在不分离的情况下插入记录
-    //参数说明：
-    //  leaf：将要被插入数据的叶子节点
-    //  key：插入的关键字
-    //  value：插入的数据
-    //---------------------------------
-    void bplus_tree::insert_record_no_split(leaf_node_t *leaf,
-                                            const key_t &key, const value_t &value)
+    //-------------------------------
+    //写入消息缓冲区：from为0时写入头部和全部消息，否则只写头部和第from条之后追加的消息
+    //-------------------------------
+    int bplus_tree::unmap(buffer_node_t *buf, off_t offset, size_t from) const
     {
-        record_t *where = upper_bound(begin(*leaf), end(*leaf), key);
-        copy_backward(where, end(*leaf), end(*leaf) + 1);
+        const size_t head = offsetof(buffer_node_t, msgs);
+        size_t size = head + buf->n * sizeof(message_t);
+        if (from == 0)
+        {
+            count_unmap(size);
+            cache.put(offset, buf, size);
+            return write_block(buf, offset, size);
+        }
 
-        where->key = key;
-        where->value = value;
-        ++leaf->n;
+        size_t at = head + from * sizeof(message_t);
+        count_unmap(head + size - at);
+        cache.write(offset, 0, buf, head);
+        cache.write(offset, at, (const char *)buf + at, size - at);
+        int ret = write_block(buf, offset, head);
+        return write_block((const char *)buf + at, offset + at, size - at) | ret;
     }
 
-    //--------------------------------
-    //往内节点插入关键字
-    //参数说明：
-    //  offset：内节点在内存中的偏移量
-    //  key：   插入的关键字
-    //  old：   左子节点
-    //  after： 右子节点
-    //--------------------------------
-    void bplus_tree::insert_key_to_index(off_t offset, const key_t &key,
-                                         off_t old, off_t after)
+    //-------------------------------
+    //读取叶子节点
+    //压缩模式下叶子节点的磁盘格式：
+    //  | 节点头部(SIZE_NO_CHILDREN) | 压缩长度(size_t) | 压缩后的n条记录 |
+    //  压缩长度为0表示记录以原始格式存储（压缩后反而更大）
+    //-------------------------------
+    int bplus_tree::map(leaf_node_t *leaf, off_t offset) const
     {
-        //如果offset为0，需要新创建根节点
-        if (offset == 0)
+        complete_prefetch(offset);
+        const char *page = cache.get(offset, sizeof(leaf_node_t));
+        count_map(page, sizeof(leaf_node_t));
+        if (page != NULL)
         {
-            internal_node_t root;
-            root.next = 0;
-            root.prev = 0;
-            root.parent = 0;
-            meta.root_offset = alloc(&root);
-            meta.height++;
+            memcpy((void *)leaf, page, sizeof(leaf_node_t));
+            return 0;
+        }
 
-            //插入old和after
-            root.n = 2;
-            root.children[0].key = key;
-            root.children[0].child = old;
-            root.children[1].child = after;
+        if (!(meta.flags & BP_FLAG_COMPRESS))
+        {
+            int ret = read_block(leaf, offset, sizeof(leaf_node_t));
+            if (ret == 0)
+                cache.put(offset, leaf, sizeof(leaf_node_t));
+            return ret;
+        }
 
-            unmap(&meta, OFFSET_META);
-            unmap(&root, meta.root_offset);
+        //大多数压缩后的叶子节点一次读取就够了，不够再在load_leaf中补读
+        pooled<leaf_block_t> block(pool);
+        char *buf = block->data;
+        size_t rd = read_bytes(buf, offset, std::min(sizeof(block->data), (size_t)BP_COMPRESS_READ));
+        return load_leaf(buf, rd, offset, leaf);
+    }
 
-            //更新子节点的父结点
-            reset_index_children_parent(begin(root), end(root),
-                                        meta.root_offset);
-            return;
+    //-------------------------------
+    //解析叶子节点块并放入缓存
+    //参数说明：
+    //  buf：   块数据（容量至少为leaf_block_size）
+    //  rd：    buf中已经读取的字节数
+    //  offset：叶子节点偏移量
+    //  leaf：  解析结果
+    //-------------------------------
+    int bplus_tree::load_leaf(char *buf, size_t rd, off_t offset, leaf_node_t *leaf) const
+    {
+        if (!(meta.flags & BP_FLAG_COMPRESS))
+        {
+            if (rd < sizeof(leaf_node_t))
+                rd += read_bytes(buf + rd, offset + rd, sizeof(leaf_node_t) - rd);
+            if (rd < sizeof(leaf_node_t))
+                return -1;
+            memcpy((void *)leaf, buf, sizeof(leaf_node_t));
+            cache.put(offset, leaf, sizeof(leaf_node_t));
+            return 0;
         }
 
-        //定位将要进行插入操作的节点
-        internal_node_t node;
-        map(&node, offset);
-        assert(node.n <= meta.order);
+        const size_t head = SIZE_NO_CHILDREN + sizeof(size_t);
+        if (rd < head)
+            return -1;
 
-        //如果满了则需要分离
-        if (node.n == meta.order)
-        {
-            internal_node_t new_node;
-            node_create(offset, &node, &new_node);
+        memcpy((void *)leaf, buf, SIZE_NO_CHILDREN);
+        size_t zlen;
+        memcpy(&zlen, buf + SIZE_NO_CHILDREN, sizeof(size_t));
+        size_t raw_len = leaf->n * sizeof(record_t);
+        size_t need = head + (zlen == 0 ? raw_len : zlen);
+        if (leaf->n > BP_ORDER || need > leaf_block_size())
+            return -1;
+        if (rd < need)
+            rd += read_bytes(buf + rd, offset + rd, need - rd);
+        if (rd < need)
+            return -1;
 
-            //找到分离点
-            size_t point = (node.n - 1) / 2;
-            bool place_right = keycmp(key, node.children[point].key) > 0;
-            if (place_right)
-                ++point;
+        if (zlen == 0)
+            memcpy(leaf->children, buf + head, raw_len);
+        else if (lz_decompress(buf + head, zlen, leaf->children, raw_len) != raw_len)
+            return -1;
 
-            //如果point+1后对应的关键字比key小，需要回退一步
-            if (place_right && keycmp(key, node.children[point].key) < 0)
-                point--;
+        cache.put(offset, leaf, sizeof(leaf_node_t));
+        return 0;
+    }
 
-            key_t middle_key = node.children[point].key;
+    int bplus_tree::unmap(leaf_node_t *leaf, off_t offset) const
+    {
+        drain_prefetch();
+        count_unmap(sizeof(leaf_node_t));
+        cache.put(offset, leaf, sizeof(leaf_node_t));
+        if (!(meta.flags & BP_FLAG_COMPRESS))
+            return write_block(leaf, offset, sizeof(leaf_node_t));
+
+        //字符串结束符之后的字节没有意义，清零后压缩效果更好
+        pooled<leaf_node_t> packed(pool);
+        record_t *records = packed->children;
+        copy(begin(*leaf), end(*leaf), records);
+        for (size_t i = 0; i < leaf->n; ++i)
+        {
+            value_t &v = records[i].value;
+            size_t len = strnlen(v.name, sizeof(v.name));
+            memset(v.name + len, 0, sizeof(v.name) - len);
+            len = strnlen(v.email, sizeof(v.email));
+            memset(v.email + len, 0, sizeof(v.email) - len);
+        }
 
-            //分离操作
-            copy(begin(node) + point + 1, end(node), begin(new_node));
-            new_node.n = node.n - point - 1;
-            node.n = point + 1;
+        //只压缩有效的n条记录，块的剩余部分不写入（在支持稀疏文件的文件系统上不占空间）
+        const size_t head = SIZE_NO_CHILDREN + sizeof(size_t);
+        pooled<leaf_block_t> block(pool);
+        char *buf = block->data;
+        size_t raw_len = leaf->n * sizeof(record_t);
+        size_t zlen = lz_compress(records, raw_len, buf + head, raw_len);
 
-            //插入新关键字
-            if (place_right)
-                insert_key_to_index_no_split(new_node, key, after);
-            else
-                insert_key_to_index_no_split(node, key, after);
+        memcpy(buf, leaf, SIZE_NO_CHILDREN);
+        memcpy(buf + SIZE_NO_CHILDREN, &zlen, sizeof(size_t));
+        if (zlen == 0)
+            memcpy(buf + head, records, raw_len);
 
-            unmap(&node, offset);
-            unmap(&new_node, node.next);
+        return write_block(buf, offset, head + (zlen == 0 ? raw_len : zlen));
+    }
 
-            //更新子节点对应的父结点
-            reset_index_children_parent(begin(new_node), end(new_node), node.next);
+    //-------------------------------
+    //只写回叶子节点中[at, at + size)所在的扇区（按文件中的位置对齐，不超出节点）
+    //压缩模式下记录在块中的位置随压缩结果变化，写回整个节点
+    //-------------------------------
+    int bplus_tree::unmap(leaf_node_t *leaf, off_t offset, size_t at, size_t size) const
+    {
+        if (meta.flags & BP_FLAG_COMPRESS)
+            return unmap(leaf, offset);
+
+        off_t lo = (offset + (off_t)at) / BP_SECTOR_SIZE * BP_SECTOR_SIZE;
+        off_t hi = (offset + (off_t)(at + size) + BP_SECTOR_SIZE - 1) / BP_SECTOR_SIZE * BP_SECTOR_SIZE;
+        lo = std::max(lo, offset);
+        hi = std::min(hi, offset + (off_t)sizeof(leaf_node_t));
+
+        const char *block = (const char *)leaf + (lo - offset);
+        drain_prefetch();
+        count_unmap(hi - lo);
+        cache.write(offset, lo - offset, block, hi - lo);
+        return write_block(block, lo, hi - lo);
+    }
 
-            //将中间关键字放到父结点中
-            insert_key_to_index(node.parent, middle_key, offset, node.next);
-        }
-        else
-        {
-            insert_key_to_index_no_split(node, key, after);
-            unmap(&node, offset);
-        }
+    //-------------------------------
+    //写回叶子节点中一条记录的值：只写新值与old不同的字节，完全相同时不写
+    //-------------------------------
+    int bplus_tree::unmap_value(leaf_node_t *leaf, off_t offset, const record_t *record,
+                                const value_t &old) const
+    {
+        const char *a = (const char *)&old, *b = (const char *)&record->value;
+        size_t lo = 0, hi = sizeof(value_t);
+        while (lo < hi && a[lo] == b[lo])
+            ++lo;
+        while (hi > lo && a[hi - 1] == b[hi - 1])
+            --hi;
+        if (lo == hi)
+            return 0;
+
+        size_t at = (const char *)&record->value - (const char *)leaf;
+        return unmap(leaf, offset, at + lo, hi - lo);
     }
 
-    //----------------------------------
-    //往内节点插入（不分离）
+    //-------------------------------
+    //发起尚未缓存的节点的异步读取
+    //请求在map读到该节点时完成并放入缓存，不需要等待全部完成
+    //（没有开启异步I/O时什么也不做，之后的map会逐个同步读取）
     //参数说明：
-    //  node: 想要插入的内节点
-    //  key： 插入的关键字
-    //  value：插入的数据
-    //----------------------------------
-    void bplus_tree::insert_key_to_index_no_split(internal_node_t &node,
-                                                  const key_t &key, off_t value)
+    //  offsets：节点偏移量（允许重复）
+    //  n：      节点个数
+    //  leaf：   是否为叶子节点
+    //-------------------------------
+    void bplus_tree::prefetch(const off_t *offsets, size_t n, bool leaf) const
     {
-        index_t *where = upper_bound(begin(node), end(node) - 1, key);
-
-        //将后面的节点往后挪一个位置
-        copy_backward(where, end(node), end(node) + 1);
+        if (!aio)
+            return;
 
-        //插入该关键字
-        where->key = key;
-        where->child = (where + 1)->child;
-        (where + 1)->child = value;
+        size_t size = leaf ? leaf_block_size() : sizeof(internal_node_t);
+        size_t read_size = leaf && (meta.flags & BP_FLAG_COMPRESS)
+                               ? std::min(size, (size_t)BP_COMPRESS_READ)
+                               : size;
 
-        node.n++;
+        //同时预读的节点数不能超过缓存容量，否则读进来的节点会被马上淘汰
+        for (size_t i = 0; i < n && inflight.size() < cache.capacity(); ++i)
+        {
+            off_t offset = offsets[i];
+            if (offset == 0 || inflight.count(offset) ||
+                cache.get(offset, leaf ? sizeof(leaf_node_t) : size) != NULL)
+                continue;
+
+            inflight_t &req = inflight[offset];
+            req.leaf = leaf;
+            req.buf.resize(size);
+            req.id = aio->submit_read(req.buf.data(), offset, read_size);
+        }
     }
 
-    //---------------------------
-    //重置内节点或叶子节点对应的父结点和子节点下标
-    //参数说明：
-    //  begin: 节点起始位置
-    //  end：  节点末尾位置
-    //  parent: 新的父结点偏移量
-    //----------------------------
-    void bplus_tree::reset_index_children_parent(index_t *begin, index_t *end,
-                                                 off_t parent)
+    //-------------------------------
+    //等待offset处的预读完成并放入缓存
+    //返回值：
+    //  该节点是否有预读请求
+    //-------------------------------
+    bool bplus_tree::complete_prefetch(off_t offset) const
     {
-        internal_node_t node;
-        while (begin != end)
+        auto it = inflight.find(offset);
+        if (it == inflight.end())
+            return false;
+
+        inflight_t &req = it->second;
+        size_t rd = aio->wait(req.id);
+        io_stats.reads++;
+        io_stats.read_bytes += rd;
+        if (req.leaf)
         {
-            map(&node, begin->child);
-            node.parent = parent;
-            unmap(&node, begin->child, SIZE_NO_CHILDREN);
-            ++begin;
+            pooled<leaf_node_t> node_image(pool);
+            leaf_node_t &node = *node_image;
+            load_leaf(req.buf.data(), rd, offset, &node);
         }
+        else if (rd == req.buf.size())
+            cache.put(offset, req.buf.data(), rd);
+
+        inflight.erase(it);
+        return true;
     }
 
-    //-----------------------------
-    //获取对应关键字的下标(内节点)
+    //完成所有预读请求
+    void bplus_tree::drain_prefetch() const
+    {
+        while (!inflight.empty())
+            complete_prefetch(inflight.begin()->first);
+    }
+
+    //-------------------------------
+    //沿叶子节点链表顺序预读
+    //叶子节点的偏移量从最底层内节点中取得，不需要先读叶子节点本身
     //参数说明：
-    //  key： 要搜索的关键字
+    //  index：包含from的最底层内节点（返回时更新为最后一个预读叶子所在的内节点）
+    //  from： 第一个预读的叶子节点
+    //  last： 预读到该叶子节点为止
+    //  n：    预读的叶子节点个数
     //返回值：
-    //  关键字在内存的偏移量
-    //-----------------------------
-    off_t bplus_tree::search_index(const key_t &key) const
+    //  预读的叶子节点个数
+    //-------------------------------
+    size_t bplus_tree::readahead(off_t &index, off_t from, off_t last, size_t n) const
     {
-        off_t org = meta.root_offset;
-        int height = meta.height;
-        while (height > 1)
+        std::vector<off_t> leaves;
+        internal_node_t node;
+        bool started = false;
+
+        //from只可能在当前内节点或者它的后继节点中
+        for (int tries = 0; index != 0 && leaves.size() < n; ++tries)
         {
-            internal_node_t node;
-            map(&node, org);
+            map(&node, index);
+            for (index_t *i = begin(node); i != end(node) && leaves.size() < n; ++i)
+            {
+                if (!started && i->child != from)
+                    continue;
+                started = true;
+                leaves.push_back(i->child);
+                if (i->child == last)
+                    n = leaves.size();
+            }
 
-            index_t *i = upper_bound(begin(node), end(node) - 1, key);
-            org = i->child;
-            --height;
+            if ((!started && tries > 0) || leaves.size() >= n)
+                break;
+            index = node.next;
         }
 
-        return org;
+        if (aio)
+            prefetch(leaves.data(), leaves.size(), true);
+#if defined(__linux__)
+        //没有异步I/O时让内核提前把这些块读进页缓存
+        else if (fp != NULL)
+        {
+            size_t size = leaf_block_size();
+            for (size_t i = 0; i < leaves.size(); ++i)
+                if (cache.get(leaves[i], sizeof(leaf_node_t)) == NULL)
+                    posix_fadvise(fileno(fp), leaves[i], size, POSIX_FADV_WILLNEED);
+        }
+#endif
+        return leaves.size();
     }
 
-    //-----------------------------
-    //获取关键字在叶子节点的下标
-    //参数说明：
-    //  index：
-    //  key：要搜索的关键字
-    //-----------------------------
-    off_t bplus_tree::search_leaf(off_t index, const key_t &key) const
+    //-------------------------------
+    //把数据刷到磁盘上
+    //-------------------------------
+    static int sync_file(FILE *file)
     {
-        internal_node_t node;
-        map(&node, index);
-
-        index_t *i = upper_bound(begin(node), end(node) - 1, key);
-        return i->child;
+        if (fflush(file) != 0)
+            return -1;
+#if defined(_WIN32)
+        return _commit(_fileno(file));
+#else
+        return fsync(fileno(file));
+#endif
     }
 
-    //---------------------------
-    //创建新节点
-    //参数说明：
-    //  offset: 创建节点的位置
-    //  node：  创建的节点
-    //  next：  创建成功后将新创建的节点的后继节点返回到next中
-    //---------------------------
+    //-------------------------------
+    //日志的校验和（FNV-1a）
+    //-------------------------------
+    static unsigned long long journal_hash(unsigned long long hash, const void *data, size_t size)
+    {
+        const unsigned char *p = (const unsigned char *)data;
+        for (size_t i = 0; i < size; ++i)
+            hash = (hash ^ p[i]) * 1099511628211ULL;
+        return hash;
+    }
 
-    template <class T>
-    void bplus_tree::node_create(off_t offset, T *node, T *next)
+    void bplus_tree::journal_path(char *buf, size_t size) const
     {
-        //把node的后继节点赋给next
-        next->parent = node->parent;
-        next->next = node->next;
-        next->prev = offset;
+        snprintf(buf, size, "%s.journal", path);
+    }
 
-        //将next创建在node之后
-        node->next = alloc(next);
+    //-------------------------------
+    //把批量写入的所有块写入日志文件并落盘
+    //日志格式：BP_JOURNAL_MAGIC、块数，每块的偏移量、长度和数据，
+    //         最后是校验和与BP_JOURNAL_COMMIT，两者都正确才说明日志是完整的
+    //返回值：0表示成功
+    //-------------------------------
+    int bplus_tree::write_journal() const
+    {
+        char journal[sizeof(path) + 16];
+        journal_path(journal, sizeof(journal));
+        FILE *jf = fopen(journal, "wb");
+        if (jf == NULL)
+            return -1;
 
-        //如果next后继节点不为空，也就说明node本身的后继指向不为空
-        //则修正原本后继节点的前驱指向
-        if (next->next != 0)
+        unsigned long long hash = 14695981039346656037ULL;
+        size_t head[2] = {BP_JOURNAL_MAGIC, pending.size()};
+        bool ok = fwrite(head, sizeof(head), 1, jf) == 1;
+        for (auto it = pending.begin(); ok && it != pending.end(); ++it)
         {
-            T old_next;
-            map(&old_next, next->next, SIZE_NO_CHILDREN);
-            old_next.prev = node->next;
-            unmap(&old_next, next->next, SIZE_NO_CHILDREN);
+            off_t offset = it->first;
+            size_t size = it->second.size();
+            hash = journal_hash(hash, &offset, sizeof(offset));
+            hash = journal_hash(hash, &size, sizeof(size));
+            hash = journal_hash(hash, it->second.data(), size);
+            ok = fwrite(&offset, sizeof(offset), 1, jf) == 1 &&
+                 fwrite(&size, sizeof(size), 1, jf) == 1 &&
+                 fwrite(it->second.data(), size, 1, jf) == 1;
+            io_stats.write_bytes += size;
         }
-        unmap(&meta, OFFSET_META); //保存操作
+        size_t mark = BP_JOURNAL_COMMIT;
+        ok = ok && fwrite(&hash, sizeof(hash), 1, jf) == 1 &&
+             fwrite(&mark, sizeof(mark), 1, jf) == 1;
+        ok = sync_file(jf) == 0 && ok;
+        fclose(jf);
+        io_stats.writes++;
+
+        if (!ok)
+            ::remove(journal);
+        return ok ? 0 : -1;
     }
 
-    //--------------------------------
-    //删除节点
-    //参数说明：
-    //  prev：所删除节点的前驱节点
-    //  node：将要删除的节点
-    //--------------------------------
-    template <class T>
-    void bplus_tree::node_remove(T *prev, T *node)
+    //-------------------------------
+    //打开文件时检查日志：
+    //  完整的日志说明上次提交时数据文件可能没有写完，把日志中的块重新写一遍；
+    //  不完整的日志说明数据文件还没有被修改，直接丢弃
+    //-------------------------------
+    void bplus_tree::replay_journal() const
     {
-        //改变当前节点的数量（视具体node和prev的类型而定）
-        unalloc(node, prev->next);
+        char journal[sizeof(path) + 16];
+        journal_path(journal, sizeof(journal));
+        FILE *jf = fopen(journal, "rb");
+        if (jf == NULL)
+            return;
 
-        prev->next = node->next;
-        if (node->next != 0)
+        //一个块最大是一个节点或一个消息缓冲区
+        const size_t max_block = std::max(std::max(sizeof(leaf_node_t) + sizeof(size_t),
+                                                   sizeof(internal_node_t)),
+                                          sizeof(buffer_node_t));
+        std::vector<std::pair<off_t, std::vector<char>>> blocks;
+        unsigned long long hash = 14695981039346656037ULL, stored = 0;
+        size_t head[2] = {0, 0}, mark = 0;
+        bool ok = fread(head, sizeof(head), 1, jf) == 1 && head[0] == BP_JOURNAL_MAGIC;
+        for (size_t i = 0; ok && i < head[1]; ++i)
         {
-            T next;
-            map(&next, node->next, SIZE_NO_CHILDREN);
-            next.prev = node->prev;
-            unmap(&next, node->next, SIZE_NO_CHILDREN);
+            off_t offset;
+            size_t size;
+            ok = fread(&offset, sizeof(offset), 1, jf) == 1 &&
+                 fread(&size, sizeof(size), 1, jf) == 1 && size <= max_block;
+            if (!ok)
+                break;
+            blocks.push_back(std::make_pair(offset, std::vector<char>(size)));
+            ok = fread(blocks.back().second.data(), size, 1, jf) == 1;
+            hash = journal_hash(hash, &offset, sizeof(offset));
+            hash = journal_hash(hash, &size, sizeof(size));
+            hash = journal_hash(hash, blocks.back().second.data(), size);
         }
-        unmap(&meta, OFFSET_META);
+        ok = ok && fread(&stored, sizeof(stored), 1, jf) == 1 &&
+             fread(&mark, sizeof(mark), 1, jf) == 1 &&
+             stored == hash && mark == BP_JOURNAL_COMMIT;
+        fclose(jf);
+
+        FILE *data = ok ? fopen(path, "rb+") : NULL;
+        if (data != NULL)
+        {
+            for (size_t i = 0; ok && i < blocks.size(); ++i)
+                ok = fseek(data, blocks[i].first, SEEK_SET) == 0 &&
+                     fwrite(blocks[i].second.data(), blocks[i].second.size(), 1, data) == 1;
+            ok = sync_file(data) == 0 && ok;
+            fclose(data);
+
+            //重放失败时保留日志，下次打开时再试
+            if (!ok)
+                return;
+        }
+        ::remove(journal);
     }
 
     //-------------------------------
-    //初始化空树
+    //提交批量写入
+    //开启异步I/O时所有块同时写入，否则按偏移量顺序写入
+    //durable为true时（提交事务）先写日志，数据文件写完并落盘后再删除日志
+    //返回值：0表示成功
     //-------------------------------
-    void bplus_tree::init_from_empty()
+    int bplus_tree::end_write_batch(bool durable) const
     {
-        //初始化meta
-        memset(&meta, 0, sizeof(meta_t));
-        meta.order = BP_ORDER;
-        meta.value_size = sizeof(value_t);
-        meta.key_size = sizeof(key_t);
-        meta.height = 1;
-        meta.slot = OFFSET_BLOCK;
+        if (--batch_level > 0)
+            return 0;
 
-        //初始化根节点
-        internal_node_t root;
-        root.next = 0;
-        root.prev = 0;
-        root.parent = 0;
-        meta.root_offset = alloc(&root);
+        //日志落盘之前数据文件不会被修改
+        durable = durable && !pending.empty();
+        int ret = durable ? write_journal() : 0;
 
-        //初始化空叶子节点
-        leaf_node_t leaf;
-        leaf.next = 0;
-        leaf.prev = 0;
-        leaf.parent = meta.root_offset;
-        meta.leaf_offset = alloc(&leaf);
-        root.children[0].child = alloc(&leaf);
+        if (ret == 0 && aio)
+        {
+            std::vector<size_t> ids;
+            for (auto it = pending.begin(); it != pending.end(); ++it)
+            {
+                ids.push_back(aio->submit_write(it->second.data(), it->first,
+                                                it->second.size()));
+                io_stats.writes++;
+                io_stats.write_bytes += it->second.size();
+            }
+            auto it = pending.begin();
+            for (size_t i = 0; i < ids.size(); ++i, ++it)
+                if (aio->wait(ids[i]) != it->second.size())
+                    ret = -1;
+        }
+        else if (ret == 0)
+        {
+            open_file();
+            for (auto it = pending.begin(); it != pending.end(); ++it)
+                if (write_block(it->second.data(), it->first, it->second.size()) != 0)
+                    ret = -1;
+            close_file();
+        }
 
-        //保存操作
-        unmap(&meta, OFFSET_META);
-        unmap(&root, meta.root_offset);
-        unmap(&leaf, root.children[0].child);
+        if (durable && ret == 0)
+        {
+            open_file();
+            ret = sync_file(fp);
+            close_file();
+
+            //数据文件已经落盘，日志不再需要
+            if (ret == 0)
+            {
+                char journal[sizeof(path) + 16];
+                journal_path(journal, sizeof(journal));
+                ::remove(journal);
+            }
+        }
+        pending.clear();
+        return ret;
     }
 }
@@ -0,0 +1,528 @@
+/***********************************
+ * Topic：性能测试
+ * Author: Sliverchen
+ * Create file date: 2026 / 10 / 18
+ * Explanation:
+ *      1、顺序/随机插入、命中/未命中查找（含零复制查找）、不同宽度的范围查找、整表聚合、更新、计数器自增、删除（触发合并）、
+ *         成片删除后重新插入（立即再平衡与宽松填充）
+ *      2、YCSB风格的A/B/C/E混合负载（zipf分布的热点关键字）
+ *      3、输出吞吐量、p50/p99/p999延迟以及每个操作的读写字节数
+ *      4、指定分片数时再测试分片引擎的批量插入、批量查找和范围查找
+ *      5、-b时测试缓冲模式（写入先进入内节点的消息缓冲区），-m时写入先进入内存表
+ * 用法：
+ *      benchmark [-n 记录数] [-o 操作数] [-f 数据文件] [-c 压缩] [-a 异步I/O线程数] [-p 缓存页数]
+ *                [-s 分片数] [-r 按范围分片] [-b 缓冲模式] [-m 内存表]
+ * *********************************/
+
+#include "../SourceFile/Bplus_Tree.cpp"
+#include "../headFile/Shard_Engine.h"
+#include "../headFile/TextTable.h"
+#include "../headFile/Vector_Exec.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iostream>
+#include <random>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+using namespace bpt;
+using namespace std;
+
+typedef chrono::steady_clock bench_clock;
+
+//测试参数
+size_t recordNum = 20000;
+size_t opNum = 20000;
+const char *benchFileName = "../Data/bench.bin";
+bool compressLeaf = false;
+bool bufferedTree = false;
+bool useMemtable = false;
+size_t ioThreads = 0;
+size_t cachePages = BP_CACHE_PAGES;
+size_t shardNum = 0;
+bool shardRange = false;
+
+//结果表
+TextTable resultTable('-', '|', '+');
+
+//随机数
+mt19937_64 rng(20211018);
+
+/* 关键字：已插入的记录使用偶数，奇数一定查不到 */
+bpt::key_t makeKey(size_t i)
+{
+    char key[16] = {0};
+    sprintf(key, "%zu", i * 2);
+    return bpt::key_t(key);
+}
+
+bpt::key_t makeMissKey(size_t i)
+{
+    char key[16] = {0};
+    sprintf(key, "%zu", i * 2 + 1);
+    return bpt::key_t(key);
+}
+
+value_t makeValue(size_t i)
+{
+    value_t value;
+    memset(&value, 0, sizeof(value));
+    sprintf(value.name, "user%zu", i);
+    value.age = (int)(i % 100);
+    sprintf(value.email, "user%zu@example.com", i);
+    return value;
+}
+
+/* zipf分布（YCSB的实现方式，theta = 0.99） */
+class zipf_generator
+{
+public:
+    zipf_generator(size_t n, double theta = 0.99) : n(n), theta(theta)
+    {
+        for (size_t i = 1; i <= n; ++i)
+            zetan += 1.0 / pow((double)i, theta);
+        double zeta2 = 1.0 + 1.0 / pow(2.0, theta);
+        alpha = 1.0 / (1.0 - theta);
+        eta = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zetan);
+    }
+
+    size_t next()
+    {
+        double u = uniform_real_distribution<double>(0.0, 1.0)(rng);
+        double uz = u * zetan;
+        if (uz < 1.0)
+            return 0;
+        if (uz < 1.0 + pow(0.5, theta))
+            return 1;
+        size_t v = (size_t)(n * pow(eta * u - eta + 1.0, alpha));
+        return v < n ? v : n - 1;
+    }
+
+private:
+    size_t n;
+    double theta, alpha, eta, zetan = 0;
+};
+
+/* 一组测试的结果 */
+struct bench_result
+{
+    vector<double> latency; //每个操作的耗时（微秒）
+    double seconds = 0;
+    stats_t before, after;
+
+    //tree可以是bplus_tree或shard_engine
+    template <class Tree>
+    void start(Tree &tree)
+    {
+        before = tree.stats();
+    }
+
+    template <class Tree>
+    void finish(Tree &tree)
+    {
+        after = tree.stats();
+    }
+};
+
+/* 计算百分位延迟 */
+double percentile(vector<double> &v, double p)
+{
+    if (v.empty())
+        return 0;
+    size_t k = (size_t)(p * (v.size() - 1));
+    nth_element(v.begin(), v.begin() + k, v.end());
+    return v[k];
+}
+
+string formatNum(double x, int precision = 1)
+{
+    char buf[64];
+    sprintf(buf, "%.*f", precision, x);
+    return buf;
+}
+
+/* 把一组测试结果加入结果表 */
+void report(const char *name, bench_result &r)
+{
+    size_t ops = r.latency.size();
+    double n = ops == 0 ? 1 : (double)ops;
+
+    resultTable.add(name);
+    resultTable.add(to_string(ops));
+    resultTable.add(formatNum(ops / (r.seconds > 0 ? r.seconds : 1e-9), 0));
+    resultTable.add(formatNum(percentile(r.latency, 0.5)));
+    resultTable.add(formatNum(percentile(r.latency, 0.99)));
+    resultTable.add(formatNum(percentile(r.latency, 0.999)));
+    resultTable.add(formatNum((r.after.read_bytes - r.before.read_bytes) / n, 0));
+    resultTable.add(formatNum((r.after.write_bytes - r.before.write_bytes) / n, 0));
+    resultTable.endOfRow();
+
+    cerr << "> " << name << " done" << endl;
+}
+
+/* 执行ops次操作，记录每次耗时 */
+template <class Tree, class Op>
+bench_result runOps(Tree &tree, size_t ops, Op op)
+{
+    bench_result r;
+    r.latency.reserve(ops);
+    r.start(tree);
+    bench_clock::time_point begin = bench_clock::now();
+    for (size_t i = 0; i < ops; ++i)
+    {
+        bench_clock::time_point s = bench_clock::now();
+        op(i);
+        bench_clock::time_point f = bench_clock::now();
+        r.latency.push_back(chrono::duration<double, micro>(f - s).count());
+    }
+    r.seconds = chrono::duration<double>(bench_clock::now() - begin).count();
+    r.finish(tree);
+    return r;
+}
+
+/* 创建空树 */
+bplus_tree *openTree(bool empty)
+{
+    bplus_tree *tree = new bplus_tree(benchFileName, empty, compressLeaf, bufferedTree);
+    tree->set_cache_size(cachePages);
+    if (useMemtable)
+        tree->set_memtable();
+    if (ioThreads > 0)
+        tree->enable_async_io(ioThreads);
+    return tree;
+}
+
+/* 解析命令行参数 */
+void parseArgs(int argc, char **argv)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "-c") == 0)
+            compressLeaf = true;
+        else if (i + 1 < argc && strcmp(argv[i], "-n") == 0)
+            recordNum = strtoul(argv[++i], NULL, 10);
+        else if (i + 1 < argc && strcmp(argv[i], "-o") == 0)
+            opNum = strtoul(argv[++i], NULL, 10);
+        else if (i + 1 < argc && strcmp(argv[i], "-f") == 0)
+            benchFileName = argv[++i];
+        else if (i + 1 < argc && strcmp(argv[i], "-a") == 0)
+            ioThreads = strtoul(argv[++i], NULL, 10);
+        else if (i + 1 < argc && strcmp(argv[i], "-p") == 0)
+            cachePages = strtoul(argv[++i], NULL, 10);
+        else if (i + 1 < argc && strcmp(argv[i], "-s") == 0)
+            shardNum = strtoul(argv[++i], NULL, 10);
+        else if (strcmp(argv[i], "-r") == 0)
+            shardRange = true;
+        else if (strcmp(argv[i], "-b") == 0)
+            bufferedTree = true;
+        else if (strcmp(argv[i], "-m") == 0)
+            useMemtable = true;
+        else
+        {
+            cerr << "usage: benchmark [-n records] [-o ops] [-f file] [-c] [-a io_threads] [-p cache_pages]"
+                 << " [-s shards] [-r] [-b] [-m]" << endl;
+            exit(1);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    parseArgs(argc, argv);
+
+    resultTable.add("workload");
+    resultTable.add("ops");
+    resultTable.add("ops/s");
+    resultTable.add("p50(us)");
+    resultTable.add("p99(us)");
+    resultTable.add("p999(us)");
+    resultTable.add("read B/op");
+    resultTable.add("write B/op");
+    resultTable.endOfRow();
+
+    vector<size_t> order(recordNum);
+    for (size_t i = 0; i < recordNum; ++i)
+        order[i] = i;
+    shuffle(order.begin(), order.end(), rng);
+
+    //顺序插入
+    {
+        bplus_tree *tree = openTree(true);
+        bench_result r = runOps(*tree, recordNum, [&](size_t i) {
+            tree->insert(makeKey(i), makeValue(i));
+        });
+        report("insert seq", r);
+        delete tree;
+    }
+
+    //随机插入（之后的测试都在这棵树上进行）
+    bplus_tree *tree = openTree(true);
+    {
+        bench_result r = runOps(*tree, recordNum, [&](size_t i) {
+            tree->insert(makeKey(order[i]), makeValue(order[i]));
+        });
+        report("insert random", r);
+    }
+
+    value_t value;
+    uniform_int_distribution<size_t> uniform(0, recordNum - 1);
+
+    {
+        bench_result r = runOps(*tree, opNum, [&](size_t) {
+            tree->search(makeKey(uniform(rng)), &value);
+        });
+        report("search hit", r);
+    }
+    {
+        //只读age：记录留在钉住的缓存页中，不复制value_t
+        long long ages = 0;
+        record_ref ref;
+        bench_result r = runOps(*tree, opNum, [&](size_t) {
+            if (tree->search(makeKey(uniform(rng)), ref) == 0)
+                ages += ref.value().age;
+            ref.release();
+        });
+        report("search hit (ref)", r);
+    }
+    {
+        bench_result r = runOps(*tree, opNum, [&](size_t) {
+            tree->search(makeMissKey(uniform(rng)), &value);
+        });
+        report("search miss", r);
+    }
+
+    //批量查找（每次64个关键字，延迟按批次统计）
+    {
+        const size_t batch = 64;
+        vector<bpt::key_t> keys(batch);
+        vector<value_t> values(batch);
+        vector<int> results(batch);
+        bench_result r = runOps(*tree, opNum / batch, [&](size_t) {
+            for (size_t k = 0; k < batch; ++k)
+                keys[k] = makeKey(uniform(rng));
+            tree->search_batch(keys.data(), values.data(), results.data(), batch);
+        });
+        report("search batch x64", r);
+    }
+
+    //不同宽度的范围查找
+    {
+        const size_t widths[] = {10, 100, 1000};
+        vector<value_t> values(1000);
+        for (size_t w = 0; w < sizeof(widths) / sizeof(widths[0]); ++w)
+        {
+            size_t width = widths[w];
+            bench_result r = runOps(*tree, max((size_t)1, opNum / width), [&](size_t) {
+                size_t start = uniform(rng);
+                bpt::key_t left = makeKey(start);
+                tree->search_range(&left, makeKey(start + width - 1), values.data(), width);
+            });
+            string name = "range " + to_string(width);
+            report(name.c_str(), r);
+        }
+
+        //零复制范围查找
+        vector<record_ref> refs(100);
+        bench_result r = runOps(*tree, max((size_t)1, opNum / 100), [&](size_t) {
+            size_t start = uniform(rng);
+            bpt::key_t left = makeKey(start);
+            tree->search_range(&left, makeKey(start + 99), refs.data(), refs.size());
+        });
+        report("range 100 (refs)", r);
+    }
+
+    //整张表的聚合：当前线程顺序扫描 与 多个线程并行扫描
+    {
+        const size_t passes = 5;
+        bpt::key_t first = makeKey(0), last = makeKey(recordNum - 1);
+        bench_result r = runOps(*tree, passes, [&](size_t) {
+            aggregate_t agg;
+            agg.clear();
+            tree->scan(first, last, [&agg](const record_t &rec) { agg.add(rec); });
+        });
+        report("scan all (1 thread)", r);
+
+        r = runOps(*tree, passes, [&](size_t) {
+            tree->aggregate(first, last);
+        });
+        report("aggregate all", r);
+
+        //按叶子节点成批过滤与聚合
+        vector_query query;
+        query.where_age(0, 49);
+        r = runOps(*tree, passes, [&](size_t) {
+            query.run(*tree, first, last);
+        });
+        report("vector filter+agg", r);
+    }
+
+    {
+        bench_result r = runOps(*tree, opNum, [&](size_t) {
+            size_t k = uniform(rng);
+            tree->update(makeKey(k), makeValue(k + 1));
+        });
+        report("update", r);
+    }
+
+    //计数器自增：先查找再更新（两次下降）、modify（一次下降、写一次）与update_age（只写改动的扇区）
+    {
+        bench_result r = runOps(*tree, opNum, [&](size_t) {
+            bpt::key_t key = makeKey(uniform(rng));
+            if (tree->search(key, &value) == 0)
+            {
+                value.age++;
+                tree->update(key, value);
+            }
+        });
+        report("counter search+update", r);
+
+        r = runOps(*tree, opNum, [&](size_t) {
+            tree->modify(makeKey(uniform(rng)), [](value_t &v, bool) {
+                v.age++;
+                return true;
+            });
+        });
+        report("counter modify", r);
+
+        r = runOps(*tree, opNum, [&](size_t i) {
+            tree->update_age(makeKey(uniform(rng)), (int)i);
+        });
+        report("counter update_age", r);
+    }
+
+    //YCSB风格的混合负载
+    {
+        zipf_generator zipf(recordNum);
+        uniform_real_distribution<double> coin(0.0, 1.0);
+        vector<value_t> values(100);
+        size_t next_insert = recordNum;
+
+        struct
+        {
+            const char *name;
+            double read; //读（或扫描）的比例，其余为写
+            bool scan;
+        } mixes[] = {{"ycsb A (50r/50u)", 0.5, false},
+                     {"ycsb B (95r/5u)", 0.95, false},
+                     {"ycsb C (100r)", 1.0, false},
+                     {"ycsb E (95s/5i)", 0.95, true}};
+
+        for (size_t m = 0; m < sizeof(mixes) / sizeof(mixes[0]); ++m)
+        {
+            bench_result r = runOps(*tree, opNum, [&](size_t) {
+                size_t k = zipf.next();
+                bool read = coin(rng) < mixes[m].read;
+                if (!mixes[m].scan)
+                {
+                    if (read)
+                        tree->search(makeKey(k), &value);
+                    else
+                        tree->update(makeKey(k), makeValue(k + 2));
+                }
+                else if (read)
+                {
+                    size_t len = 1 + rng() % 100;
+                    bpt::key_t left = makeKey(k);
+                    tree->search_range(&left, makeKey(k + len - 1), values.data(), len);
+                }
+                else
+                {
+                    tree->insert(makeKey(next_insert), makeValue(next_insert));
+                    ++next_insert;
+                }
+            });
+            report(mixes[m].name, r);
+        }
+    }
+
+    //删除一半记录（会触发借用与合并）
+    {
+        bench_result r = runOps(*tree, recordNum / 2, [&](size_t i) {
+            tree->remove(makeKey(order[i]));
+        });
+        report("remove half", r);
+    }
+
+    //成片删除后在原处重新插入：立即再平衡 与 宽松填充（推迟再平衡）
+    {
+        const size_t width = BP_ORDER * 4;
+        uniform_int_distribution<size_t> window(0, recordNum > width ? recordNum - width : 0);
+        for (int relaxed = 0; relaxed < 2; ++relaxed)
+        {
+            tree->set_relaxed_fill(relaxed ? BP_RELAXED_PENDING : 0);
+            size_t start = 0;
+            bench_result r = runOps(*tree, opNum, [&](size_t i) {
+                size_t j = i % (2 * width);
+                if (j == 0)
+                    start = window(rng);
+                if (j < width)
+                    tree->remove(makeKey(start + j));
+                else
+                    tree->insert(makeKey(start + j - width), makeValue(start + j - width));
+            });
+            report(relaxed ? "remove/reinsert waves (relaxed)" : "remove/reinsert waves", r);
+        }
+        tree->set_relaxed_fill(0);
+    }
+
+    delete tree;
+
+    //分片引擎：每批64个关键字按分片分组，各分片的线程同时执行
+    if (shardNum > 0)
+    {
+        shard_engine engine(benchFileName, shardNum, shardRange ? SHARD_RANGE : SHARD_HASH, true,
+                            shardRange ? shard_engine::int_bounds(recordNum * 2, shardNum)
+                                       : vector<bpt::key_t>(),
+                            compressLeaf);
+        for (size_t s = 0; s < shardNum; ++s)
+            engine.submit(s, [](bplus_tree &t) { t.set_cache_size(cachePages); }).get();
+
+        const size_t batch = 64;
+        vector<record_t> records(batch);
+        bench_result r = runOps(engine, (recordNum + batch - 1) / batch, [&](size_t b) {
+            size_t n = min(batch, recordNum - b * batch);
+            for (size_t k = 0; k < n; ++k)
+            {
+                records[k].key = makeKey(order[b * batch + k]);
+                records[k].value = makeValue(order[b * batch + k]);
+            }
+            engine.insert_batch(records.data(), NULL, n);
+        });
+        report("shards insert x64", r);
+
+        vector<bpt::key_t> keys(batch);
+        vector<value_t> values(batch);
+        vector<int> results(batch);
+        r = runOps(engine, opNum / batch, [&](size_t) {
+            for (size_t k = 0; k < batch; ++k)
+                keys[k] = makeKey(uniform(rng));
+            engine.search_batch(keys.data(), values.data(), results.data(), batch);
+        });
+        report("shards search x64", r);
+
+        const size_t width = 1000;
+        records.resize(width);
+        r = runOps(engine, max((size_t)1, opNum / width), [&](size_t) {
+            size_t start = uniform(rng);
+            bpt::key_t left = makeKey(start);
+            engine.search_range(&left, makeKey(start + width - 1), records.data(), width);
+        });
+        report("shards range 1000", r);
+    }
+
+    cout << "records: " << recordNum << ", ops: " << opNum
+         << ", compress: " << (compressLeaf ? "on" : "off")
+         << ", buffered: " << (bufferedTree ? "on" : "off")
+         << ", memtable: " << (useMemtable ? "on" : "off")
+         << ", io threads: " << ioThreads
+         << ", cache pages: " << cachePages;
+    if (shardNum > 0)
+        cout << ", shards: " << shardNum << (shardRange ? " (range)" : " (hash)");
+    cout << endl;
+    cout << resultTable << endl;
+    return 0;
+}
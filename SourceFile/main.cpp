@@ -5,11 +5,16 @@
  * *********************************/
 
 #include "../SourceFile/Bplus_Tree.cpp"
+#include "../headFile/Bulk_IO.h"
+#include "../headFile/Query_Parser.h"
+#include "../headFile/Row_Writer.h"
 #include "../headFile/TextTable.h"
+#include "../headFile/Vector_Exec.h"
 
 #include <fstream>
 #include <io.h>
 #include <iostream>
+#include <limits>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -34,6 +39,12 @@ clock_t startTime, finishTime;
 //B+树指针
 bplus_tree *db_ptr;
 
+//命令解析器（缓存解析过的语句）
+query_parser parser;
+
+//查询结果输出（.mode/.output设置格式与输出文件）
+row_writer writer;
+
 void initSystem();
 
 /* 类型转换 */
@@ -53,11 +64,21 @@ void printHelpMess()
          << "  .help                                              print help message;   \n"
          << "  .exit                                              exit the system;      \n"
          << "  .reset                                             reset the database;   \n"
+         << "  .stats                                             print statistics;     \n"
+         << "  .analyze                                           analyze tree shape;   \n"
+         << "  .mode {table|csv|tsv|binary}                       set result format;    \n"
+         << "  .output {file|stdout}                              set result output;    \n"
+         << "  .import {file.csv}                                 load csv rows;        \n"
+         << "  .export {file.csv} [{minIndex} {maxIndex}]         write rows as csv;    \n"
+         << "  begin; | commit; | rollback;                       transaction;          \n"
          << "  insert db {index}{name}{age}{email};               insert record;        \n"
          << "  delete from db where id = {index};                 delete record;        \n"
          << "  update db {name}{age}{email} where id = {index};   update record;        \n"
          << "  select * from db where id = {index};               search by index;      \n"
          << "  select * from db where id in ({minIndex,maxIndex}) search in range;      \n"
+         << "  select {count(*)|sum|avg|min|max(age)} from db                           \n"
+         << "    [where {cond} [and {cond}...]]                   aggregate;            \n"
+         << "    cond: id in ({min,max}) | age {=|<|<=|>|>=} {n} | email like {pattern} \n"
          << "***************************************************************************\n"
          << endl
          << nextLineHeader;
@@ -87,40 +108,122 @@ int searchRecord(bplus_tree *treePtr, int *index, value_t *return_val)
     return (*treePtr).search(key, return_val);
 }
 
-/* 全局查找命令 */
+/* 全局查找命令：范围扫描叶子链表，边扫描边输出 */
 int searchAll(bplus_tree *treePtr, int *start, int *end)
 {
-    TextTable t('-', '|', '+');
-    t.add("id");
-    t.add("name");
-    t.add("age");
-    t.add("email");
-    t.endOfRow();
+    writer.begin();
 
+    //关键字按长度排序，负数与非负数交错，负数部分逐个查找
     bpt::key_t key;
-    value_t *return_val = new value_t;
-    for (int i = *start; i <= *end; ++i)
+    value_t return_val;
+    for (int i = *start; i <= *end && i < 0; ++i)
     {
         intTokeyT(&key, &i);
-        int return_code = (*treePtr).search(key, return_val);
-        switch (return_code)
+        if ((*treePtr).search(key, &return_val) == 0)
+            writer.write(key.k, return_val);
+    }
+
+    if (*end >= 0)
+    {
+        int from = *start > 0 ? *start : 0;
+        bpt::key_t left, right;
+        intTokeyT(&left, &from);
+        intTokeyT(&right, end);
+
+        //每次取一页，内存占用与结果大小无关
+        record_t page[64];
+        bool next = true;
+        while (next)
         {
-        case -1:
+            int n = (*treePtr).search_range(&left, right, page, 64, &next);
+            for (int i = 0; i < n; ++i)
+                if (page[i].key.k[0] != '-') //跳过排在范围内的负数
+                    writer.write(page[i]);
+            if (n <= 0)
+                break;
+        }
+    }
+
+    return (int)writer.finish();
+}
+
+//--------------------------------
+//聚合命令：多个线程并行扫描叶子节点，按批过滤与聚合，最后合并各线程的结果
+//  不带范围时统计整张表；带范围时负数部分逐个查找（同searchAll）
+//--------------------------------
+aggregate_t aggregateRecords(bplus_tree *treePtr, prepared_stmt &stmt)
+{
+    vector_query query;
+    if (stmt.has(SLOT_AGE))
+    {
+        long long x = stmt.value.age;
+        switch (stmt.age_cmp)
+        {
+        case CMP_EQ:
+            query.where_age(x, x);
+            break;
+        case CMP_LT:
+            query.where_age(LLONG_MIN, x - 1);
             break;
-        case 0:
-            t.add(to_string(i));
-            t.add(return_val->name);
-            t.add(to_string(return_val->age));
-            t.add(return_val->email);
-            t.endOfRow();
+        case CMP_LE:
+            query.where_age(LLONG_MIN, x);
             break;
-        case 1:
+        case CMP_GT:
+            query.where_age(x + 1, LLONG_MAX);
+            break;
+        case CMP_GE:
+            query.where_age(x, LLONG_MAX);
             break;
         }
     }
+    if (stmt.has(SLOT_EMAIL))
+        query.where_email_like(stmt.value.email);
 
-    cout << t << endl;
-    return 0;
+    if (!stmt.has(SLOT_ID))
+    {
+        char max_key[sizeof(bpt::key_t)];
+        memset(max_key, 0xff, sizeof(max_key) - 1);
+        max_key[sizeof(max_key) - 1] = '\0';
+        return query.run(*treePtr, bpt::key_t(""), bpt::key_t(max_key));
+    }
+
+    aggregate_t res;
+    res.clear();
+    record_t rec;
+    for (int i = stmt.id; i <= stmt.id_end && i < 0; ++i)
+    {
+        intTokeyT(&rec.key, &i);
+        if ((*treePtr).search(rec.key, &rec.value) == 0)
+            query.process(&rec, &rec + 1, res);
+    }
+
+    if (stmt.id_end >= 0)
+    {
+        int from = stmt.id > 0 ? stmt.id : 0;
+        bpt::key_t left, right;
+        intTokeyT(&left, &from);
+        intTokeyT(&right, &stmt.id_end);
+        query.skip_negative_keys(); //跳过排在范围内的负数
+        res.merge(query.run(*treePtr, left, right));
+    }
+    return res;
+}
+
+/* 聚合结果写入输出，没有数据时min/max/avg为NULL */
+void printAggregate(prepared_stmt &stmt, const aggregate_t &res)
+{
+    char text[64];
+    if (stmt.agg == AGG_COUNT)
+        sprintf(text, "%zu\n", res.count);
+    else if (stmt.agg == AGG_SUM)
+        sprintf(text, "%lld\n", res.age_sum);
+    else if (res.count == 0)
+        sprintf(text, "NULL\n");
+    else if (stmt.agg == AGG_AVG)
+        sprintf(text, "%.2f\n", res.age_avg());
+    else
+        sprintf(text, "%d\n", stmt.agg == AGG_MIN ? res.age_min : res.age_max);
+    writer.text(text);
 }
 
 /* update 命令 */
@@ -134,20 +237,134 @@ int updateRecord(bplus_tree *treePtr, int *index, value_t *value)
 /* 打印表 */
 void printTable(int *index, value_t *values)
 {
+    char id[16];
+    sprintf(id, "%d", *index);
+    writer.begin();
+    writer.write(id, *values);
+    writer.finish();
+}
+
+/* 打印统计信息 */
+void printStats(bplus_tree *treePtr)
+{
+    stats_t st = (*treePtr).stats();
+
     TextTable t('-', '|', '+');
-    t.add("id");
-    t.add("name");
-    t.add("age");
-    t.add("email");
+    t.add("counter");
+    t.add("value");
     t.endOfRow();
 
-    t.add(to_string(*index));
-    t.add(values->name);
-    t.add(to_string(values->age));
-    t.add(values->email);
-    t.endOfRow();
+    const struct
+    {
+        const char *name;
+        size_t value;
+    } counters[] = {
+        {"disk reads", st.reads},
+        {"disk read bytes", st.read_bytes},
+        {"disk writes", st.writes},
+        {"disk write bytes", st.write_bytes},
+        {"map calls", st.map_calls},
+        {"map bytes", st.map_bytes},
+        {"unmap calls", st.unmap_calls},
+        {"unmap bytes", st.unmap_bytes},
+        {"cache hits", st.cache_hits},
+        {"cache misses", st.cache_misses},
+        {"leaf splits", st.leaf_splits},
+        {"internal splits", st.internal_splits},
+        {"leaf merges", st.leaf_merges},
+        {"internal merges", st.internal_merges},
+        {"leaf borrows", st.leaf_borrows},
+        {"internal borrows", st.internal_borrows},
+        {"height increases", st.height_increases},
+        {"height decreases", st.height_decreases},
+        {"deferred removes", st.deferred_removes},
+        {"buffered messages", st.buffered_msgs},
+        {"flushed messages", st.flushed_msgs},
+        {"memtable writes", st.memtable_writes},
+        {"memtable merges", st.memtable_merges},
+        {"node pool bytes", treePtr->pool_bytes()},
+    };
+    for (size_t i = 0; i < sizeof(counters) / sizeof(counters[0]); ++i)
+    {
+        t.add(counters[i].name);
+        t.add(to_string(counters[i].value));
+        t.endOfRow();
+    }
+    cout << t << endl;
+
+    //各操作的延迟分布
+    const char *opNames[BP_OP_NUM] = {"search", "search batch", "search range",
+                                      "insert", "update", "remove", "modify"};
+    TextTable lt('-', '|', '+');
+    lt.add("operation");
+    lt.add("count");
+    lt.add("avg(us)");
+    lt.add("p50(us)<");
+    lt.add("p99(us)<");
+    lt.add("p999(us)<");
+    lt.endOfRow();
+    for (int i = 0; i < BP_OP_NUM; ++i)
+    {
+        const latency_hist_t &h = st.latency[i];
+        lt.add(opNames[i]);
+        lt.add(to_string(h.count));
+        lt.add(to_string(h.count == 0 ? 0 : (size_t)(h.total_us / h.count)));
+        lt.add(to_string((size_t)h.percentile(0.5)));
+        lt.add(to_string((size_t)h.percentile(0.99)));
+        lt.add(to_string((size_t)h.percentile(0.999)));
+        lt.endOfRow();
+    }
+    cout << lt << endl;
+}
 
+/* 打印树的形状分析结果 */
+void printAnalyze(bplus_tree *treePtr)
+{
+    analyze_t res = (*treePtr).analyze();
+    size_t order = (*treePtr).get_meta().order;
+
+    TextTable t('-', '|', '+');
+    t.add("level");
+    t.add("nodes");
+    t.add("avg fill");
+    t.add("fill histogram (0-10% ... 90-100%)");
+    t.endOfRow();
+    for (size_t i = 0; i < res.levels.size(); ++i)
+    {
+        const level_stat_t &l = res.levels[i];
+        string hist;
+        for (size_t b = 0; b < BP_FILL_BUCKETS; ++b)
+            hist += (b == 0 ? "" : " ") + to_string(l.fill[b]);
+
+        t.add(i + 1 == res.levels.size() ? "leaf" : to_string(i));
+        t.add(to_string(l.nodes));
+        t.add(to_string(l.nodes == 0 ? 0 : l.keys * 100 / (l.nodes * order)) + "%");
+        t.add(hist);
+        t.endOfRow();
+    }
     cout << t << endl;
+
+    TextTable s('-', '|', '+');
+    const struct
+    {
+        const char *name;
+        string value;
+    } items[] = {
+        {"avg keys per leaf", to_string(res.avg_keys_per_leaf)},
+        {"non-adjacent leaves", to_string(res.non_adjacent_leaves) + " / " + to_string(res.levels.back().nodes)},
+        {"file bytes", to_string(res.file_bytes)},
+        {"live bytes", to_string(res.live_bytes)},
+        {"dead bytes", to_string(res.dead_bytes)},
+        {"leaf bytes stored", to_string(res.leaf_stored_bytes)},
+        {"buffer bytes", to_string(res.buffer_bytes)},
+    };
+    for (size_t i = 0; i < sizeof(items) / sizeof(items[0]); ++i)
+    {
+        s.add(items[i].name);
+        s.add(items[i].value);
+        s.endOfRow();
+    }
+    cout << s << endl;
 }
 
 /* 判断文件是否存在 */
@@ -162,24 +379,164 @@ double durationTime(clock_t *f, clock_t *s)
     return (double)(*f - *s) / CLOCKS_PER_SEC;
 }
 
+/* .mode命令：设置查询结果的输出格式 */
+int setMode(const char *mode)
+{
+    const struct
+    {
+        const char *name;
+        row_format_t format;
+    } modes[] = {{"table", ROW_TABLE}, {"csv", ROW_CSV}, {"tsv", ROW_TSV}, {"binary", ROW_BINARY}};
+    for (size_t i = 0; i < sizeof(modes) / sizeof(modes[0]); ++i)
+    {
+        if (strcmp(mode, modes[i].name) == 0)
+        {
+            writer.set_format(modes[i].format);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/* .output命令：查询结果写入文件，stdout表示恢复到控制台 */
+int setOutput(const char *path)
+{
+    FILE *file = stdout;
+    if (strcmp(path, "stdout") != 0 && (file = fopen(path, "wb")) == NULL)
+        return -1;
+
+    FILE *old = writer.output();
+    writer.set_output(file);
+    if (old != stdout && old != NULL)
+        fclose(old);
+    return 0;
+}
+
+/* .import命令 */
+int importFile(bplus_tree *treePtr, const char *path)
+{
+    import_result_t res;
+    startTime = clock();
+    int return_code = import_csv(*treePtr, path, res);
+    finishTime = clock();
+    if (return_code != 0)
+    {
+        cout << "> failed ! can't import " << path << "\n";
+        return return_code;
+    }
+
+    cout << "> imported " << res.loaded << " rows (" << res.duplicates << " duplicates, "
+         << res.invalid << " invalid), "
+         << (!res.bulk ? "inserted" : res.runs == 0 ? "bulk loaded" : "sorted and bulk loaded")
+         << ", time: " << durationTime(&finishTime, &startTime) << "\n";
+    return 0;
+}
+
+/* .export命令 */
+int exportFile(bplus_tree *treePtr, prepared_stmt &stmt)
+{
+    startTime = clock();
+    long rows = export_csv(*treePtr, stmt.value.name, stmt.has(SLOT_ID), stmt.id, stmt.id_end);
+    finishTime = clock();
+    if (rows < 0)
+    {
+        cout << "> failed ! can't write " << stmt.value.name << "\n";
+        return -1;
+    }
+
+    cout << "> exported " << rows << " rows, time: " << durationTime(&finishTime, &startTime) << "\n";
+    return 0;
+}
+
+/* begin/commit/rollback命令 */
+int transactionCommand(bplus_tree *treePtr, stmt_type_t type)
+{
+    switch (type)
+    {
+    case STMT_BEGIN:
+        return treePtr->begin_transaction();
+    case STMT_COMMIT:
+        return treePtr->commit();
+    default:
+        return treePtr->rollback();
+    }
+}
+
 /* select命令 */
 void selectCommand()
 {
-    char *usercommand = new char[256];
+    //命令缓冲区与语句都在栈上，循环中不再分配堆内存
+    char usercommand[256];
+    prepared_stmt stmt;
+    value_t return_val;
     while (true)
     {
-        cin.getline(usercommand, 256);
-        if (strcmp(usercommand, ".exit") == 0)
+        if (!cin.getline(usercommand, sizeof(usercommand)))
         {
-            cout << exitMesssage;
-            break;
+            if (cin.eof())
+            {
+                if (db_ptr->in_transaction())
+                    cout << "> uncommitted transaction rolled back\n";
+                cout << exitMesssage;
+                break;
+            }
+            //命令过长：丢弃这一行剩余的部分
+            cin.clear();
+            cin.ignore(numeric_limits<streamsize>::max(), '\n');
+            cout << errorMessage << nextLineHeader;
+            continue;
         }
-        else if (strcmp(usercommand, ".help") == 0)
+
+        if (parser.prepare(usercommand, &stmt) != 0 || !stmt.ready())
         {
-            printHelpMess();
+            cout << errorMessage << nextLineHeader;
+            continue;
         }
-        else if (strcmp(usercommand, ".reset") == 0)
+
+        switch (stmt.type)
         {
+        case STMT_EXIT:
+            if (db_ptr->in_transaction())
+                cout << "> uncommitted transaction rolled back\n";
+            cout << exitMesssage;
+            return;
+        case STMT_HELP:
+            printHelpMess();
+            break;
+        case STMT_STATS:
+            printStats(db_ptr);
+            cout << nextLineHeader;
+            break;
+        case STMT_ANALYZE:
+            startTime = clock();
+            printAnalyze(db_ptr);
+            finishTime = clock();
+            cout << "> executed analyze, time: " << durationTime(&finishTime, &startTime) << "\n"
+                 << nextLineHeader;
+            break;
+        case STMT_MODE:
+        case STMT_OUTPUT:
+            if ((stmt.type == STMT_MODE ? setMode(stmt.value.name) : setOutput(stmt.value.name)) != 0)
+                cout << errorMessage << nextLineHeader;
+            else
+                cout << nextLineHeader;
+            break;
+        case STMT_IMPORT:
+            importFile(db_ptr, stmt.value.name);
+            cout << nextLineHeader;
+            break;
+        case STMT_EXPORT:
+            exportFile(db_ptr, stmt);
+            cout << nextLineHeader;
+            break;
+        case STMT_RESET:
+            //.reset直接删除文件，不能放在事务中
+            if (db_ptr->in_transaction())
+            {
+                cout << "> failed ! commit or rollback the transaction first\n"
+                     << nextLineHeader;
+                break;
+            }
             if (remove(dbFileName) != 0)
                 cout << "can't delete file\n"
                      << nextLineHeader;
@@ -187,170 +544,358 @@ void selectCommand()
                 cout << "DB file has been deleted!" << endl
                      << endl;
             initSystem();
-        }
-        else if (strncmp(usercommand, "insert", 6) == 0) //匹配前6个字符
+            return;
+        case STMT_INSERT:
         {
-            int *keyIndex = new int;
-            value_t *insertData = new value_t;
+            startTime = clock();
+            int return_code = insertRecord(db_ptr, &stmt.id, &stmt.value);
+            finishTime = clock();
 
-            //sscanf字符串格式化输入
-            int okNum = sscanf(usercommand, "insert db %d %s %d %s;",
-                               keyIndex, insertData->name, &(insertData->age), insertData->email);
-            if (okNum < 3)
+            if (return_code == 0)
             {
-                cout << errorMessage << nextLineHeader;
+                cout << "> executed insert index: " << stmt.id << ", time: " << durationTime(&finishTime, &startTime) << endl
+                     << nextLineHeader;
+            }
+            else if (return_code == 1)
+            {
+                cout << "> failed: already exist index: " << stmt.id << "\n"
+                     << nextLineHeader;
             }
             else
             {
-                startTime = clock();
-
-                int return_code = insertRecord(db_ptr, keyIndex, insertData);
-
-                finishTime = clock();
-
-                if (return_code == 0)
-                {
-                    cout << "> executed insert index: " << *keyIndex << ", time: " << durationTime(&finishTime, &startTime) << endl
-                         << nextLineHeader;
-                }
-                else if (return_code == 1)
-                {
-                    cout << "> failed: already exist index: " << *keyIndex << "\n"
-                         << nextLineHeader;
-                }
-                else
-                {
-                    cout << "> failed!\n"
-                         << nextLineHeader;
-                }
+                cout << "> failed!\n"
+                     << nextLineHeader;
             }
+            break;
         }
-        else if (strncmp(usercommand, "delete", 6) == 0)
+        case STMT_DELETE:
         {
-            int *keyIndex = new int;
-            int okNum = sscanf(usercommand, "delete from db where id = %d", keyIndex);
-            if (okNum < 1)
+            startTime = clock();
+            int return_code = deleteRecord(db_ptr, &stmt.id);
+            finishTime = clock();
+
+            if (return_code == 0)
             {
-                cout << errorMessage << nextLineHeader;
+                cout << "> executed delete index: " << stmt.id
+                     << ", time : " << durationTime(&finishTime, &startTime)
+                     << endl
+                     << nextLineHeader;
+            }
+            else if (return_code == -1)
+            {
+                cout << "> failed ! no index: " << stmt.id << "\n"
+                     << nextLineHeader;
             }
             else
             {
-                startTime = clock();
-
-                int return_code = deleteRecord(db_ptr, keyIndex);
-
-                finishTime = clock();
-
-                if (return_code == 0)
-                {
-                    cout << "> executed delete index: " << *keyIndex
-                         << ", time : " << durationTime(&finishTime, &startTime)
-                         << endl
-                         << nextLineHeader;
-                }
-                else if (return_code == -1)
-                {
-                    cout << "> failed ! no index: " << *keyIndex << "\n"
-                         << nextLineHeader;
-                }
-                else
-                {
-                    cout << "failed !\n"
-                         << nextLineHeader;
-                }
+                cout << "failed !\n"
+                     << nextLineHeader;
             }
+            break;
         }
+        case STMT_SELECT_RANGE:
+            startTime = clock();
+            searchAll(db_ptr, &stmt.id, &stmt.id_end);
+            finishTime = clock();
+            writer.flush();
+
+            cout << "> executed search, time: " << durationTime(&finishTime, &startTime)
+                 << "\n"
+                 << nextLineHeader;
+            break;
+        case STMT_AGGREGATE:
+        {
+            startTime = clock();
+            aggregate_t res = aggregateRecords(db_ptr, stmt);
+            finishTime = clock();
+            if (res.failed)
+            {
+                cout << "> failed ! can't read " << dbFileName << "\n"
+                     << nextLineHeader;
+                break;
+            }
+            printAggregate(stmt, res);
+            writer.flush();
 
-        else if (strncmp(usercommand, "select", 6) == 0)
+            cout << "> executed aggregate over " << res.count << " rows, time: "
+                 << durationTime(&finishTime, &startTime) << "\n"
+                 << nextLineHeader;
+            break;
+        }
+        case STMT_SELECT:
         {
-            if (!strstr(usercommand, "="))
+            startTime = clock();
+            int return_code = searchRecord(db_ptr, &stmt.id, &return_val);
+            finishTime = clock();
+
+            if (return_code != 0)
             {
-                int i_start, i_end;
-                int okNum = sscanf(usercommand, "select * from db where id in (%d,%d)", &i_start, &i_end);
-
-                if (okNum < 2)
-                {
-                    cout << errorMessage << nextLineHeader;
-                }
-                else
-                {
-                    startTime = clock();
-                    searchAll(db_ptr, &i_start, &i_end);
-                    finishTime = clock();
-
-                    cout << "> executed search, time: " << durationTime(&finishTime, &startTime)
-                         << "\n"
-                         << nextLineHeader;
-                }
+                cout << "> index: " << stmt.id << " doesn't exist, time: " << durationTime(&finishTime, &startTime)
+                     << "\n"
+                     << nextLineHeader;
             }
             else
             {
-                int keyIndex;
-                int okNum = sscanf(usercommand, "select * from db where id = %d", &keyIndex);
-                if (okNum < 1)
-                {
-                    cout << errorMessage << nextLineHeader;
-                }
-                else
-                {
-                    value_t *return_val = new value_t;
-                    startTime = clock();
-                    int return_code = searchRecord(db_ptr, &keyIndex, return_val);
-                    finishTime = clock();
-
-                    if (return_code != 0)
-                    {
-                        cout << "> index: " << keyIndex << "doesn't exist, time: " << durationTime(&finishTime, &startTime)
-                             << "\n"
-                             << nextLineHeader;
-                    }
-                    else
-                    {
-                        printTable(&keyIndex, return_val);
-                        cout << "> executed search, time: " << durationTime(&finishTime, &startTime)
-                             << "\n"
-                             << nextLineHeader;
-                    }
-                }
+                printTable(&stmt.id, &return_val);
+                writer.flush();
+                cout << "> executed search, time: " << durationTime(&finishTime, &startTime)
+                     << "\n"
+                     << nextLineHeader;
             }
+            break;
         }
-        else if (strncmp(usercommand, "update", 6) == 0)
+        case STMT_UPDATE:
         {
-            int *keyIndex = new int;
-            value_t *new_val = new value_t;
+            startTime = clock();
+            int return_code = updateRecord(db_ptr, &stmt.id, &stmt.value);
+            finishTime = clock();
+            if (return_code == 0)
+            {
+                cout << "> executed update index: " << stmt.id
+                     << ", time: " << durationTime(&finishTime, &startTime)
+                     << "\n"
+                     << nextLineHeader;
+            }
+            else
+            {
+                cout << "> failed ! no index: " << stmt.id
+                     << ", time: " << durationTime(&finishTime, &startTime)
+                     << "\n"
+                     << nextLineHeader;
+            }
+            break;
+        }
+        case STMT_BEGIN:
+        case STMT_COMMIT:
+        case STMT_ROLLBACK:
+        {
+            bool open = db_ptr->in_transaction();
+            startTime = clock();
+            int return_code = transactionCommand(db_ptr, stmt.type);
+            finishTime = clock();
 
-            int okNum = sscanf(usercommand, "update db %d %s %d where id = %d",
-                               new_val->name, &new_val->age, new_val->email, keyIndex);
-            if (okNum < 4)
+            if (return_code == 0)
             {
-                cout << errorMessage << nextLineHeader;
+                cout << "> executed "
+                     << (stmt.type == STMT_BEGIN ? "begin" : stmt.type == STMT_COMMIT ? "commit" : "rollback")
+                     << ", time: " << durationTime(&finishTime, &startTime) << "\n"
+                     << nextLineHeader;
+            }
+            else if (stmt.type == STMT_BEGIN)
+            {
+                cout << "> failed ! already in a transaction\n"
+                     << nextLineHeader;
+            }
+            else if (!open)
+            {
+                cout << "> failed ! no transaction\n"
+                     << nextLineHeader;
             }
             else
             {
-                startTime = clock();
-                int return_code = updateRecord(db_ptr, keyIndex, new_val);
-                finishTime = clock();
-                if (return_code == 0)
-                {
-                    cout << "> executed update index: " << *keyIndex
-                         << ", time: " << durationTime(&finishTime, &startTime)
-                         << "\n"
-                         << nextLineHeader;
-                }
-                else
-                {
-                    cout << "> failed ! no index: " << *keyIndex
-                         << ", time: " << durationTime(&finishTime, &startTime)
-                         << "\n"
-                         << nextLineHeader;
-                }
+                cout << "> failed ! can't write " << dbFileName << "\n"
+                     << nextLineHeader;
             }
+            break;
+        }
+        default:
+            cout << errorMessage << nextLineHeader;
+            break;
+        }
+    }
+}
+
+//--------------------------------
+//批处理模式下执行一条语句
+//参数说明：
+//  tree：B+树（.reset会重新创建）
+//  path：数据库文件
+//返回值：
+//  0：成功   1：失败   2：.exit
+//--------------------------------
+int runStatement(bplus_tree *&tree, const char *path, prepared_stmt &stmt)
+{
+    value_t value;
+    switch (stmt.type)
+    {
+    case STMT_EXIT:
+        return 2;
+    case STMT_HELP:
+        return 0;
+    case STMT_STATS:
+        writer.flush();
+        printStats(tree);
+        cout << endl;
+        return 0;
+    case STMT_ANALYZE:
+        writer.flush();
+        printAnalyze(tree);
+        cout << endl;
+        return 0;
+    case STMT_MODE:
+        return setMode(stmt.value.name) == 0 ? 0 : 1;
+    case STMT_OUTPUT:
+        return setOutput(stmt.value.name) == 0 ? 0 : 1;
+    case STMT_IMPORT:
+        writer.flush();
+        return importFile(tree, stmt.value.name) == 0 ? 0 : 1;
+    case STMT_EXPORT:
+        writer.flush();
+        return exportFile(tree, stmt) == 0 ? 0 : 1;
+    case STMT_RESET:
+        //.reset直接删除文件，不能放在事务中
+        if (tree->in_transaction())
+            return 1;
+        delete tree;
+        tree = new bplus_tree(path, true);
+        return 0;
+    case STMT_INSERT:
+        return insertRecord(tree, &stmt.id, &stmt.value) == 0 ? 0 : 1;
+    case STMT_DELETE:
+        return deleteRecord(tree, &stmt.id) == 0 ? 0 : 1;
+    case STMT_UPDATE:
+        return updateRecord(tree, &stmt.id, &stmt.value) == 0 ? 0 : 1;
+    case STMT_SELECT:
+        if (searchRecord(tree, &stmt.id, &value) != 0)
+            return 1;
+        printTable(&stmt.id, &value);
+        return 0;
+    case STMT_SELECT_RANGE:
+        searchAll(tree, &stmt.id, &stmt.id_end);
+        return 0;
+    case STMT_AGGREGATE:
+    {
+        aggregate_t res = aggregateRecords(tree, stmt);
+        if (res.failed)
+            return 1;
+        printAggregate(stmt, res);
+        return 0;
+    }
+    case STMT_BEGIN:
+    case STMT_COMMIT:
+    case STMT_ROLLBACK:
+        return transactionCommand(tree, stmt.type) == 0 ? 0 : 1;
+    default:
+        return 1;
+    }
+}
+
+//--------------------------------
+//批处理模式：逐行执行脚本中的命令
+//  1、不打印提示符和每条命令的耗时，输出先写入缓冲区
+//  2、空行和以"--"开头的注释行被忽略
+//  3、atomic为true时整个脚本在一个事务中执行，全部成功后提交，
+//     任何一条命令失败都会回滚；这时脚本中不能再使用begin/commit/rollback
+//  4、脚本结束时还没有提交的事务被回滚
+//  5、结束时输出一行汇总
+//返回值：
+//  0：全部成功   1：有命令失败
+//--------------------------------
+int runScript(FILE *in, bool atomic)
+{
+    bplus_tree *tree = new bplus_tree(dbFileName, !is_file_exists(dbFileName));
+    if (atomic)
+        tree->begin_transaction();
+
+    //默认输出不带表头的TSV，可以用.mode修改
+    writer.set_format(ROW_TSV);
+    writer.set_header(false);
+
+    char line[256];
+    prepared_stmt stmt;
+    size_t lineNum = 0, executed = 0, failed = 0, invalid = 0;
+    bool aborted = false;
+
+    //.import/.export会修改全局的startTime，这里单独计时
+    clock_t scriptStart = clock();
+    while (fgets(line, sizeof(line), in) != NULL)
+    {
+        ++lineNum;
+        size_t len = strlen(line);
+        bool tooLong = false;
+        if (len == sizeof(line) - 1 && line[len - 1] != '\n')
+        {
+            //缓冲区正好读满：下一个字符是换行或文件结束说明这一行刚好放下，否则丢弃这一行剩余的部分
+            int c = fgetc(in);
+            tooLong = c != EOF && c != '\n';
+            while (c != EOF && c != '\n')
+                c = fgetc(in);
+        }
+
+        const char *p = line;
+        while (*p == ' ' || *p == '\t')
+            ++p;
+        if (!tooLong && (*p == '\n' || *p == '\r' || *p == '\0' || strncmp(p, "--", 2) == 0))
+            continue;
+
+        int code = 1;
+        if (tooLong || parser.prepare(line, &stmt) != 0 || !stmt.ready())
+        {
+            ++invalid;
+            cerr << "> line " << lineNum << ": invalid command\n";
+        }
+        else if (atomic && (stmt.type == STMT_BEGIN || stmt.type == STMT_COMMIT ||
+                            stmt.type == STMT_ROLLBACK))
+        {
+            ++executed;
+            ++failed;
+            cerr << "> line " << lineNum << ": transactions can't be nested in --atomic mode\n";
         }
         else
         {
-            cout << errorMessage << nextLineHeader;
+            code = runStatement(tree, dbFileName, stmt);
+            if (code == 2)
+                break;
+            ++executed;
+            if (code != 0)
+            {
+                ++failed;
+                cerr << "> line " << lineNum << ": failed\n";
+            }
+        }
+
+        if (code != 0 && atomic)
+        {
+            aborted = true;
+            break;
         }
     }
+
+    //提交也计入执行时间
+    const char *result = "";
+    bool commitFailed = false;
+    if (atomic && aborted)
+    {
+        tree->rollback();
+        result = ", rolled back";
+    }
+    else if (atomic)
+    {
+        commitFailed = tree->commit() != 0;
+        result = ", committed";
+    }
+    else if (tree->in_transaction())
+    {
+        tree->rollback();
+        cerr << "> uncommitted transaction rolled back\n";
+    }
+    clock_t scriptFinish = clock();
+    delete tree;
+    writer.flush();
+
+    if (commitFailed)
+    {
+        cerr << "> can't commit to " << dbFileName << endl;
+        return 1;
+    }
+
+    double seconds = durationTime(&scriptFinish, &scriptStart);
+    cout << "> executed " << executed << " commands (" << failed << " failed, "
+         << invalid << " invalid)" << result << ", time: " << seconds;
+    if (seconds > 0)
+        cout << ", " << (size_t)(executed / seconds) << " commands/s";
+    cout << endl;
+    return failed + invalid == 0 ? 0 : 1;
 }
 
 void initSystem()
@@ -367,8 +912,54 @@ void initSystem()
     selectCommand();
 }
 
-int main()
+/* 打印命令行用法 */
+void printUsage()
+{
+    cerr << "usage: main [-d dbfile] [-s script|- [--atomic]]\n"
+         << "  -d dbfile    database file, default " << dbFileName << "\n"
+         << "  -s script    run the commands in script (\"-\" reads stdin) and print a summary\n"
+         << "  --atomic     apply the whole script or nothing" << endl;
+}
+
+int main(int argc, char **argv)
 {
+    const char *script = NULL;
+    bool atomic = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "--atomic") == 0)
+            atomic = true;
+        else if (i + 1 < argc && strcmp(argv[i], "-s") == 0)
+            script = argv[++i];
+        else if (i + 1 < argc && strcmp(argv[i], "-d") == 0)
+            dbFileName = argv[++i];
+        else
+        {
+            printUsage();
+            return 1;
+        }
+    }
+
+    //批处理模式
+    if (script != NULL)
+    {
+        FILE *in = strcmp(script, "-") == 0 ? stdin : fopen(script, "r");
+        if (in == NULL)
+        {
+            cerr << "> can't open script " << script << endl;
+            return 1;
+        }
+        int code = runScript(in, atomic);
+        if (in != stdin)
+            fclose(in);
+        return code;
+    }
+    if (atomic)
+    {
+        printUsage();
+        return 1;
+    }
+
     initSystem();
     system("pause");
 }
\ No newline at end of file
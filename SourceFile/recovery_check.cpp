@@ -0,0 +1,139 @@
+/***********************************
+ * Topic：崩溃恢复检查
+ * Author: Sliverchen
+ * Create file date: 2026 / 10 / 19
+ * Explanation:
+ *      1、模拟提交写入数据文件的中途崩溃：日志已经落盘，数据文件只写入了前一半的块，进程随即退出
+ *      2、重新打开时重放日志，检查提交的关键字全部可见、提交前的关键字没有受影响
+ *      3、普通模式与缓冲模式各检查一次（缓冲模式的日志中有比节点大的消息缓冲区块）
+ * 用法：
+ *      recovery_check [-f 数据文件]
+ * 返回值：
+ *      0表示全部通过
+ * *********************************/
+
+#include "../SourceFile/Bplus_Tree.cpp"
+
+namespace bpt
+{
+    /* 崩溃需要停在end_write_batch的中途，通过树的友元调用它的私有成员 */
+    struct recovery_probe
+    {
+        //--------------------------------
+        //与commit相同：所有写入先攒在批量写入中，写完日志后再写数据文件，
+        //只写入前一半的块就停下（崩溃的进程不会析构树，由调用者决定是否释放）
+        //参数说明：
+        //  tree：   要崩溃的树
+        //  records：提交的记录
+        //  blocks： 返回日志中的块数
+        //  largest：返回日志中最大的块的大小
+        //返回值：
+        //  0表示日志写入成功
+        //--------------------------------
+        static int crash_commit(bplus_tree &tree, const std::vector<record_t> &records,
+                                size_t &blocks, size_t &largest)
+        {
+            tree.begin_write_batch();
+            for (size_t i = 0; i < records.size(); ++i)
+                tree.write_tree(BP_MSG_INSERT, records[i].key, &records[i].value);
+
+            blocks = tree.pending.size();
+            largest = 0;
+            for (auto it = tree.pending.begin(); it != tree.pending.end(); ++it)
+                largest = std::max(largest, it->second.size());
+
+            if (tree.write_journal() != 0)
+                return -1;
+            tree.batch_level = 0;
+            size_t half = blocks / 2, i = 0;
+            for (auto it = tree.pending.begin(); i < half; ++it, ++i)
+                tree.write_block(it->second.data(), it->first, it->second.size());
+            tree.pending.clear();
+            return 0;
+        }
+    };
+}
+
+using namespace bpt;
+
+/* 提交前已有的记录数和崩溃的那次提交写入的记录数 */
+const int baseNum = 2000;
+const int commitNum = 600;
+
+bpt::key_t makeKey(int k)
+{
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%d", k);
+    return bpt::key_t(buf);
+}
+
+value_t makeValue(int k)
+{
+    value_t value;
+    memset(&value, 0, sizeof(value));
+    snprintf(value.name, sizeof(value.name), "name%d", k);
+    value.age = k;
+    snprintf(value.email, sizeof(value.email), "user%d@example.com", k);
+    return value;
+}
+
+//--------------------------------
+//在一次提交中途崩溃后重新打开，检查恢复结果
+//参数说明：
+//  file：    数据文件
+//  buffered：是否使用缓冲模式
+//返回值：
+//  0表示通过
+//--------------------------------
+int checkCrash(const char *file, bool buffered)
+{
+    {
+        bplus_tree tree(file, true, false, buffered);
+        for (int k = 0; k < baseNum; ++k)
+            tree.insert(makeKey(k), makeValue(k));
+    }
+
+    //崩溃的进程不会析构树，这里也不释放
+    std::vector<record_t> records;
+    for (int k = baseNum; k < baseNum + commitNum; ++k)
+        records.push_back({makeKey(k), makeValue(k)});
+
+    size_t blocks, largest;
+    if (recovery_probe::crash_commit(*new bplus_tree(file), records, blocks, largest) != 0)
+    {
+        printf("%s: failed to write the journal\n", buffered ? "buffered" : "plain");
+        return 1;
+    }
+
+    bplus_tree tree(file);
+    int missing = 0;
+    for (int k = 0; k < baseNum + commitNum; ++k)
+    {
+        value_t value;
+        if (tree.search(makeKey(k), &value) != 0 || value.age != k)
+            ++missing;
+    }
+
+    printf("%s: %zu blocks in the journal (largest %zu bytes), %d of %d keys missing after recovery\n",
+           buffered ? "buffered" : "plain", blocks, largest, missing, baseNum + commitNum);
+    return missing == 0 ? 0 : 1;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *file = "recovery_check.db";
+    for (int i = 1; i < argc; ++i)
+    {
+        if (strcmp(argv[i], "-f") == 0 && i + 1 < argc)
+            file = argv[++i];
+        else
+        {
+            fprintf(stderr, "usage: recovery_check [-f file]\n");
+            return 2;
+        }
+    }
+
+    int failed = checkCrash(file, false) + checkCrash(file, true);
+    printf(failed == 0 ? "recovery check passed\n" : "recovery check FAILED\n");
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,175 @@
+/******************************
+ * Topic: 异步I/O引擎
+ * Author: Sliverchen
+ * Create file date : 2026 / 10 / 18
+ * Explanation:
+ *      1、线程池实现的异步块读写，每个工作线程持有自己的文件句柄
+ *      2、submit_*只负责提交请求，wait等待请求完成
+ *      3、可以同时发起多个叶子节点的读取，或者一次提交分裂产生的多个写入
+ * ****************************/
+
+#ifndef ASYNC_IO_H
+#define ASYNC_IO_H
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+namespace bpt
+{
+    class async_io
+    {
+    public:
+        //--------------------------------
+        //参数说明：
+        //  path：   数据文件路径
+        //  threads：工作线程数（同时进行的I/O请求数）
+        //--------------------------------
+        async_io(const char *path, size_t threads = 4)
+            : next_id(1), stopping(false)
+        {
+            memset(file, 0, sizeof(file));
+            strncpy(file, path, sizeof(file) - 1);
+            if (threads == 0)
+                threads = 1;
+            for (size_t i = 0; i < threads; ++i)
+                workers.push_back(std::thread(&async_io::run, this));
+        }
+
+        ~async_io()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mtx);
+                stopping = true;
+            }
+            queued.notify_all();
+            for (size_t i = 0; i < workers.size(); ++i)
+                workers[i].join();
+        }
+
+        //--------------------------------
+        //提交读请求（block在请求完成前必须保持有效）
+        //返回值：
+        //  请求编号
+        //--------------------------------
+        size_t submit_read(void *block, off_t offset, size_t size)
+        {
+            return submit(false, block, offset, size);
+        }
+
+        //--------------------------------
+        //提交写请求（block在请求完成前必须保持有效）
+        //--------------------------------
+        size_t submit_write(const void *block, off_t offset, size_t size)
+        {
+            return submit(true, const_cast<void *>(block), offset, size);
+        }
+
+        //--------------------------------
+        //等待请求完成
+        //返回值：
+        //  实际读写的字节数（读到文件末尾时可能比请求的少）
+        //--------------------------------
+        size_t wait(size_t id)
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            done_cv.wait(lock, [&] { return finished.count(id) != 0; });
+            size_t bytes = finished[id];
+            finished.erase(id);
+            return bytes;
+        }
+
+        //--------------------------------
+        //请求是否已经完成（不阻塞）
+        //--------------------------------
+        bool ready(size_t id)
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            return finished.count(id) != 0;
+        }
+
+        size_t threads() const
+        {
+            return workers.size();
+        }
+
+    private:
+        struct request_t
+        {
+            size_t id;
+            bool write;
+            void *block;
+            off_t offset;
+            size_t size;
+        };
+
+        char file[512];
+        size_t next_id;
+        bool stopping;
+        std::mutex mtx;
+        std::condition_variable queued;  //有新请求
+        std::condition_variable done_cv; //有请求完成
+        std::deque<request_t> requests;
+        std::unordered_map<size_t, size_t> finished; //请求编号 -> 读写字节数
+        std::vector<std::thread> workers;
+
+        size_t submit(bool write, void *block, off_t offset, size_t size)
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            request_t req = {next_id++, write, block, offset, size};
+            requests.push_back(req);
+            queued.notify_one();
+            return req.id;
+        }
+
+        //工作线程：取出请求并用自己的文件句柄完成读写
+        void run()
+        {
+            //不使用stdio缓冲，避免读到其他句柄已经改写过的旧数据
+            FILE *fp = fopen(file, "rb+");
+            if (fp != NULL)
+                setvbuf(fp, NULL, _IONBF, 0);
+            while (true)
+            {
+                request_t req;
+                {
+                    std::unique_lock<std::mutex> lock(mtx);
+                    queued.wait(lock, [&] { return stopping || !requests.empty(); });
+                    if (requests.empty())
+                        break;
+                    req = requests.front();
+                    requests.pop_front();
+                }
+
+                size_t bytes = 0;
+                if (fp != NULL && fseek(fp, req.offset, SEEK_SET) == 0)
+                {
+                    if (req.write)
+                    {
+                        bytes = fwrite(req.block, 1, req.size, fp);
+                        fflush(fp); //让其他文件句柄能看到写入的数据
+                    }
+                    else
+                        bytes = fread(req.block, 1, req.size, fp);
+                }
+
+                {
+                    std::lock_guard<std::mutex> lock(mtx);
+                    finished[req.id] = bytes;
+                }
+                done_cv.notify_all();
+            }
+            if (fp != NULL)
+                fclose(fp);
+        }
+    };
+}
+
+#endif /* ASYNC_IO_H */
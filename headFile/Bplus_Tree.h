@@ -7,15 +7,27 @@
 #ifndef BPLUS_NODE
 #define BPLUS_NODE
 
+#include <algorithm>
 #include <assert.h>
+#include <functional>
+#include <future>
+#include <list>
+#include <map>
+#include <memory>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <vector>
 
 #ifndef PREDEFINED_H
 #include "predefined.h"
 #endif
 
+#include "Async_IO.h"
+#include "Compress.h"
+#include "Node_Pool.h"
+#include "Page_Cache.h"
+
 /*
     说明：
     stddef——定义各种变量类型的宏
@@ -41,7 +53,18 @@ namespace bpt
 /* offsets */
 #define OFFSET_META 0
 #define OFFSET_BLOCK OFFSET_META + sizeof(meta_t)
-#define SIZE_NO_CHILDREN sizeof(leaf_node_t) - BP_ORDER * sizeof(record_t)
+#define SIZE_NO_CHILDREN offsetof(leaf_node_t, children)
+
+/* storage flags */
+#define BP_FLAG_COMPRESS 0x1 //叶子节点压缩存储
+#define BP_FLAG_BUFFERED 0x2 //内节点带消息缓冲区（写优化）
+
+/* redo journal written by commit: <path>.journal */
+#define BP_JOURNAL_MAGIC 0x4250544a   //日志开头
+#define BP_JOURNAL_COMMIT 0x434d4954  //日志完整写入的标记
+
+/* max number of internal levels on a descent path (fan-out >= 2) */
+#define BP_MAX_HEIGHT 64
 
     /*meta information of B+ tree */
     //主要用于记录B+树的信息
@@ -56,6 +79,7 @@ namespace bpt
         off_t slot;               //存储新块的指针
         off_t root_offset;        //内节点的根节点
         off_t leaf_offset;        //第一个叶子节点
+        size_t flags;             //存储选项（BP_FLAG_*）
     } meta_t;
 
     /* internal nodes' index segment*/
@@ -69,7 +93,11 @@ namespace bpt
     struct internal_node_t
     {
         typedef index_t *child_t;
-        off_t parent;               //父结点
+        union
+        {
+            off_t parent; //父结点（不再使用，新节点写入0，结构修改使用下降路径）
+            off_t buffer; //缓冲模式下为消息缓冲区的位置（0表示还没有分配）
+        };
         off_t next;                 //后继关键字
         off_t prev;                 //前驱关键字
         size_t n;                   //子节点个数
@@ -94,34 +122,733 @@ namespace bpt
         record_t children[BP_ORDER];
     };
 
+    /* compressed leaf block on disk: header, compressed length and at most n raw records */
+    struct leaf_block_t
+    {
+        char data[sizeof(leaf_node_t) + sizeof(size_t)];
+    };
+
+    /* kinds of buffered messages, applied to the leaves in arrival order */
+    enum
+    {
+        BP_MSG_INSERT, //关键字不存在时插入
+        BP_MSG_UPDATE, //关键字存在时更新
+        BP_MSG_REMOVE, //关键字存在时删除
+        BP_MSG_UPSERT  //不论是否存在都改为这个值
+    };
+
+    /* a write waiting in an internal node's buffer */
+    struct message_t
+    {
+        key_t key;
+        int type;
+        value_t value;
+    };
+
+    /* message buffer block: messages in arrival order, only the first n are written to disk */
+    struct buffer_node_t
+    {
+        size_t n;
+        message_t msgs[BP_BUFFER_MSGS];
+    };
+
+/* latency histogram: bucket i counts operations shorter than 2^i microseconds */
+#define BP_HIST_BUCKETS 24
+
+    /* operations with latency statistics */
+    enum
+    {
+        BP_OP_SEARCH,
+        BP_OP_SEARCH_BATCH,
+        BP_OP_SEARCH_RANGE,
+        BP_OP_INSERT,
+        BP_OP_UPDATE,
+        BP_OP_REMOVE,
+        BP_OP_MODIFY,
+        BP_OP_NUM
+    };
+
+    /* latency histogram of one operation */
+    struct latency_hist_t
+    {
+        size_t count;
+        double total_us;
+        size_t buckets[BP_HIST_BUCKETS];
+
+        void add(double us)
+        {
+            size_t i = 0;
+            while (i + 1 < BP_HIST_BUCKETS && us >= (double)(1UL << i))
+                ++i;
+            buckets[i]++;
+            count++;
+            total_us += us;
+        }
+
+        //百分位延迟（返回所在桶的上界，单位微秒）
+        double percentile(double p) const
+        {
+            size_t target = (size_t)(p * count), seen = 0;
+            for (size_t i = 0; i < BP_HIST_BUCKETS; ++i)
+            {
+                seen += buckets[i];
+                if (seen > target)
+                    return (double)(1UL << i);
+            }
+            return 0;
+        }
+    };
+
+    /* statistics of a tree */
+    struct stats_t
+    {
+        size_t reads;       //磁盘读取次数
+        size_t read_bytes;  //读取的字节数
+        size_t writes;      //磁盘写入次数
+        size_t write_bytes; //写入的字节数
+
+        size_t map_calls;    //map调用次数
+        size_t map_bytes;    //map请求的字节数
+        size_t unmap_calls;  //unmap调用次数
+        size_t unmap_bytes;  //unmap写入的字节数
+        size_t cache_hits;   //页缓存命中
+        size_t cache_misses; //页缓存未命中
+
+        size_t leaf_splits;       //叶子节点分裂
+        size_t internal_splits;   //内节点分裂
+        size_t leaf_merges;       //叶子节点合并
+        size_t internal_merges;   //内节点合并
+        size_t leaf_borrows;      //叶子节点借用
+        size_t internal_borrows;  //内节点借用
+        size_t height_increases;  //根节点分裂
+        size_t height_decreases;  //根节点收缩
+        size_t deferred_removes;  //宽松填充下推迟再平衡的删除
+        size_t buffered_msgs;     //缓冲模式下放入根节点缓冲区的消息
+        size_t flushed_msgs;      //从缓冲区推到下一层或写入叶子节点的消息
+        size_t memtable_writes;   //内存表吸收的写操作
+        size_t memtable_merges;   //内存表合并到树中的次数
+
+        latency_hist_t latency[BP_OP_NUM]; //各操作的延迟分布
+    };
+
+/* fill factor histogram: bucket i counts nodes filled [i*10%, (i+1)*10%) */
+#define BP_FILL_BUCKETS 10
+
+    /* shape of one level of the tree */
+    struct level_stat_t
+    {
+        size_t nodes;                 //节点个数
+        size_t keys;                  //子节点（内节点）或记录（叶子节点）总数
+        size_t fill[BP_FILL_BUCKETS]; //填充率直方图
+    };
+
+    /* result of analyzing the tree file */
+    struct analyze_t
+    {
+        std::vector<level_stat_t> levels; //从根节点到叶子节点
+        size_t non_adjacent_leaves;       //next不是物理上下一个叶子节点的叶子数
+        double avg_keys_per_leaf;
+        size_t file_bytes;        //meta.slot，文件已分配的大小
+        size_t live_bytes;        //meta、现存节点和它们的消息缓冲区占用的大小
+        size_t dead_bytes;        //已释放但没有回收的节点占用的大小
+        size_t leaf_stored_bytes; //叶子节点实际写入的字节数（压缩模式下小于块大小）
+        size_t buffer_bytes;      //缓冲模式下内节点已分配的消息缓冲区的大小
+    };
+
+    /* count / sum / min / max of age over the records of a scan */
+    struct aggregate_t
+    {
+        size_t count;
+        long long age_sum;
+        int age_min; //count为0时没有意义
+        int age_max;
+        bool failed; //扫描时有叶子节点读取失败，结果不完整
+
+        void clear()
+        {
+            count = 0;
+            age_sum = 0;
+            age_min = age_max = 0;
+            failed = false;
+        }
+
+        void add(const record_t &r)
+        {
+            if (count == 0 || r.value.age < age_min)
+                age_min = r.value.age;
+            if (count == 0 || r.value.age > age_max)
+                age_max = r.value.age;
+            count++;
+            age_sum += r.value.age;
+        }
+
+        //合并另一部分记录的结果
+        void merge(const aggregate_t &o)
+        {
+            failed = failed || o.failed;
+            if (o.count == 0)
+                return;
+            if (count == 0 || o.age_min < age_min)
+                age_min = o.age_min;
+            if (count == 0 || o.age_max > age_max)
+                age_max = o.age_max;
+            count += o.count;
+            age_sum += o.age_sum;
+        }
+
+        double age_avg() const
+        {
+            return count == 0 ? 0 : (double)age_sum / count;
+        }
+    };
+
+    /*
+        一条记录的只读视图：指向缓存中被钉住的叶子节点页，不复制value_t，只读用到的字节。
+        钉住的页不会被淘汰；页被修改时缓存换用新的副本，视图看到的一直是取得时的内容。
+        release或析构时放开，必须在树析构之前放开
+    */
+    class record_ref
+    {
+    public:
+        record_ref() : cache(NULL), offset(0), page(NULL), rec(NULL) {}
+
+        record_ref(record_ref &&o)
+            : cache(o.cache), offset(o.offset), page(o.page), rec(o.rec), own(std::move(o.own))
+        {
+            o.page = NULL;
+            o.rec = NULL;
+        }
+
+        record_ref &operator=(record_ref &&o)
+        {
+            if (this != &o)
+            {
+                release();
+                cache = o.cache;
+                offset = o.offset;
+                page = o.page;
+                rec = o.rec;
+                own = std::move(o.own);
+                o.page = NULL;
+                o.rec = NULL;
+            }
+            return *this;
+        }
+
+        ~record_ref()
+        {
+            release();
+        }
+
+        bool valid() const
+        {
+            return rec != NULL;
+        }
+
+        const key_t &key() const
+        {
+            return rec->key;
+        }
+
+        const value_t &value() const
+        {
+            return rec->value;
+        }
+
+        void release()
+        {
+            if (page != NULL)
+                cache->unpin(offset, page);
+            page = NULL;
+            rec = NULL;
+            own.reset();
+        }
+
+    private:
+        friend class bplus_tree;
+        page_cache *cache;
+        off_t offset;
+        const char *page;             //钉住的缓存页，NULL表示没有钉住
+        const record_t *rec;
+        std::unique_ptr<record_t> own; //不能钉住缓存页时（有没写入叶子节点的修改或缓存关闭）持有的副本
+    };
+
     /* the class of B+ tree */
     class bplus_tree
     {
     public:
-        bplus_tree(const char *path, bool force_empty = false);
+        bplus_tree(const char *path, bool force_empty = false, bool compress = false,
+                   bool buffered = false);
+
+        /* merge the memtable into the tree before closing */
+        ~bplus_tree();
 
         int search(const key_t &key, value_t *value) const;
 
+        /* look up n keys level by level, reading each level's nodes concurrently */
+        int search_batch(const key_t *keys, value_t *values, int *results,
+                         size_t n) const;
+
         int search_range(key_t *left, const key_t &right,
                          value_t *values, size_t max, bool *next = NULL) const;
+
+        /* same as above but returns whole records, so the caller also gets the keys */
+        int search_range(key_t *left, const key_t &right,
+                         record_t *records, size_t max, bool *next = NULL) const;
+
+        /* zero-copy lookups: ref views the record inside a pinned cache page (see record_ref) */
+        int search(const key_t &key, record_ref &ref) const;
+        int search_range(key_t *left, const key_t &right,
+                         record_ref *refs, size_t max, bool *next = NULL) const;
+        /* call visit for every record from left to right in key order, return the number visited */
+        int scan(const key_t &left, const key_t &right,
+                 const std::function<void(const record_t &)> &visit) const;
+
+        /*
+            自底向上构建：树必须为空，next依次给出按关键字升序排列且不重复的记录，没有更多记录时返回false。
+            叶子节点按BP_BULK_FILL填充并连续存放，返回写入的记录数；树不为空或关键字不是升序时返回-1（树被清空）
+        */
+        int bulk_load(const std::function<bool(record_t &)> &next);
+
         int remove(const key_t &key);
         int insert(const key_t &key, value_t value);
         int update(const key_t &key, value_t value);
+
+        /*
+            upsert：关键字存在时更新，不存在时插入，只下降一次、写一次叶子节点。返回0表示插入，1表示更新。
+            modify：读-改-写，fn(value, found)直接修改叶子节点中的值（不存在时value清零，found为false），
+            返回true才写回（不存在时插入）；返回0表示插入，1表示更新，-1表示fn没有要求写回。
+            缓冲模式和内存表中upsert只是一条消息，不读取树，一律返回0；modify先读出合并后的值，再写入一条upsert
+        */
+        int upsert(const key_t &key, const value_t &value);
+        int modify(const key_t &key, const std::function<bool(value_t &, bool)> &fn);
+
+        /*
+            按字段更新：把value中从at开始的size个字节改为data，叶子节点只写回改动所在的扇区（BP_SECTOR_SIZE）。
+            返回0表示更新成功，-1表示关键字不存在或字段超出value_t
+        */
+        int update_field(const key_t &key, size_t at, const void *data, size_t size);
+
+        int update_age(const key_t &key, int age)
+        {
+            return update_field(key, offsetof(value_t, age), &age, sizeof(age));
+        }
+
         meta_t get_meta() const
         {
             return meta;
         }
 
+        /* whether the tree holds no record */
+        bool empty() const;
+
+        /*
+            事务：begin_transaction之后的insert/update/remove只记录在私有的写集合中，本树的查找先看写集合。
+            commit把写集合按关键字顺序作为一次批量写入提交：所有块先写入日志文件并落盘，再写数据文件；
+            写数据文件时中断的话，下次打开时重放日志，日志不完整则丢弃，不会留下一半的修改。
+            rollback直接丢弃写集合。已有事务时begin_transaction、没有事务时commit/rollback返回-1，
+            bulk_load在事务中返回-1，analyze只看已提交的数据
+        */
+        int begin_transaction();
+        int commit();
+        int rollback();
+        bool in_transaction() const
+        {
+            return txn != NULL;
+        }
+
+        /*
+            异步操作：提交后立即返回future，由poll/run推进。
+            查找在等待节点读取时挂起，不阻塞线程，多个查找的下降过程交错进行；
+            写操作等前面提交的操作全部完成后才执行，之后提交的操作等它完成。
+            提交、poll、run必须在同一个线程中调用，并且要在run之后再取future的结果。
+        */
+        std::future<int> search_async(const key_t &key, value_t *value);
+        std::future<int> insert_async(const key_t &key, const value_t &value);
+        std::future<int> update_async(const key_t &key, const value_t &value);
+        std::future<int> remove_async(const key_t &key);
+
+        /* advance pending async operations without blocking, return the number finished */
+        size_t poll();
+
+        /* advance until every pending async operation has finished */
+        void run();
+
+        /* walk the tree file with several threads and report its shape, 0 threads = one per core */
+        analyze_t analyze(size_t threads = 0) const;
+
+        /*
+            并行扫描：先从内节点得到[left, right]内按关键字排列的叶子节点，平均分给各线程，
+            每个线程用自己的文件句柄读取；做完自己的部分后，从剩余最多的线程那里窃取后一半。
+            visit(record, worker)在工作线程中调用（worker小于线程数，0表示每个CPU核心一个线程），
+            只保证同一叶子节点内的记录按关键字顺序。返回扫描的记录数，范围不合法返回-1；
+            有叶子节点读取失败时也返回-1，此时visit只见到了一部分记录。
+            事务中退化为当前线程上的scan（需要合并写集合）
+        */
+        int parallel_scan(const key_t &left, const key_t &right,
+                          const std::function<void(const record_t &, size_t)> &visit,
+                          size_t threads = 0) const;
+
+        /* parallel_scan that hands over each leaf's records in [left, right] as one span [begin, end) */
+        int parallel_scan_leaves(const key_t &left, const key_t &right,
+                                 const std::function<void(const record_t *, const record_t *, size_t)> &visit,
+                                 size_t threads = 0) const;
+
+        /* aggregate the records in [left, right] accepted by filter (NULL = all) with parallel_scan, failed is set when a leaf can't be read */
+        aggregate_t aggregate(const key_t &left, const key_t &right,
+                              const std::function<bool(const record_t &)> &filter = NULL,
+                              size_t threads = 0) const;
+
+        /* parallel_scan_leaves into one aggregate_t per worker, fold(begin, end, agg) adds a span to its worker's part; the parts are merged */
+        aggregate_t aggregate_leaves(const key_t &left, const key_t &right,
+                                     const std::function<void(const record_t *, const record_t *, aggregate_t &)> &fold,
+                                     size_t threads = 0) const;
+
+        /*
+            宽松填充：remove后低于半满的叶子节点不立即借用或合并，只记下来，
+            记下的叶子节点达到pending个时统一再平衡，期间被重新插入填满的叶子节点直接跳过，
+            删除后紧接着在附近插入时不再反复合并、分裂同一批节点。pending为0恢复立即再平衡。
+            记下的叶子节点只保存在内存中，没有处理的仍是合法的树，以后删除到它们时再处理
+        */
+        void set_relaxed_fill(size_t pending = BP_RELAXED_PENDING)
+        {
+            relaxed_pending = pending;
+            if (pending == 0)
+                rebalance();
+        }
+
+        /* rebalance the leaves left underfull by relaxed removes now, return the number fixed */
+        int rebalance();
+
+        /*
+            缓冲模式（新建文件时指定buffered，已有文件以meta中的记录为准）：每个内节点带一个消息缓冲区，
+            insert/update/remove只把消息追加到根节点的缓冲区；缓冲区满时把消息最多的子节点的那一批推到下一层，
+            到达叶子节点的父结点后成批写入叶子节点。查找时把路径上缓冲区中的消息合并到叶子节点的结果上。
+            写操作不读取叶子节点，不知道关键字是否存在，消息放入缓冲区后一律返回0，最终效果与普通模式相同
+            （insert不覆盖已有的关键字，update/remove忽略不存在的关键字）。
+            删除后低于半满的叶子节点与宽松填充一样先记下来，记下的个数达到宽松填充的pending
+            （没有设置宽松填充时为BP_RELAXED_PENDING）时清空所有缓冲区并统一再平衡，
+            rebalance和begin_transaction之前先清空所有缓冲区
+        */
+        bool buffered() const
+        {
+            return (meta.flags & BP_FLAG_BUFFERED) != 0;
+        }
+
+        /* push every buffered message down to the leaves */
+        void flush_buffers();
+
+        /*
+            内存表（LSM风格）：insert/update/remove先记在内存中按关键字排序的表里（每个关键字合并成一个总效果），
+            与缓冲模式一样不读取树，一律返回0；查找先看内存表，结果与树（以及缓冲区）中的合并。
+            内存表中的关键字达到keys个时，按关键字顺序作为一次批量写入合并到树中，
+            随机写入变成按叶子节点分组的顺序写入。keys为0时合并并关闭内存表。
+            内存表只在内存中：析构、begin_transaction和bulk_load之前会先合并，进程异常退出时其中的修改会丢失
+        */
+        void set_memtable(size_t keys = BP_MEMTABLE_KEYS);
+
+        /* merge the memtable into the tree now, return the number of keys merged */
+        int merge_memtable();
+
+        /* set the number of decompressed nodes kept in memory, 0 to disable */
+        void set_cache_size(size_t pages)
+        {
+            cache.resize(pages);
+        }
+
+        stats_t stats() const
+        {
+            return io_stats;
+        }
+
+        /* bytes held by the pool that backs node images, stays flat once the deepest call path has run */
+        size_t pool_bytes() const
+        {
+            return pool.bytes();
+        }
+
+        void reset_stats()
+        {
+            memset(&io_stats, 0, sizeof(io_stats));
+        }
+
+        /* issue node reads and split writes through a pool of I/O threads, 0 to disable */
+        void enable_async_io(size_t threads = 4)
+        {
+            aio.reset(threads == 0 ? NULL : new async_io(path, threads));
+        }
+
     private:
+        friend struct recovery_probe; //崩溃恢复检查（recovery_check.cpp）需要停在提交的中途
+
         char path[512];
         meta_t meta;
+        mutable page_cache cache;
+        mutable node_pool pool; //叶子节点和消息缓冲区的临时镜像
+        mutable stats_t io_stats;
+
+        /* 统计辅助函数 */
+        void count_map(const char *page, size_t size) const
+        {
+            io_stats.map_calls++;
+            io_stats.map_bytes += size;
+            if (page != NULL)
+                io_stats.cache_hits++;
+            else
+                io_stats.cache_misses++;
+        }
+
+        void count_unmap(size_t size) const
+        {
+            io_stats.unmap_calls++;
+            io_stats.unmap_bytes += size;
+        }
+
+        void count_split(leaf_node_t *) const
+        {
+            io_stats.leaf_splits++;
+        }
+
+        void count_split(internal_node_t *) const
+        {
+            io_stats.internal_splits++;
+        }
+        std::unique_ptr<async_io> aio;
+
+        /* 事务中一个关键字的最新状态 */
+        struct txn_entry_t
+        {
+            bool removed;  //在事务中被删除
+            bool existed;  //事务开始前树中是否存在（提交时决定插入还是更新）
+            value_t value;
+
+            /* 合并到树中的记录base（NULL表示不存在）上，返回是否存在 */
+            bool resolve(const record_t *, value_t &out) const
+            {
+                out = value;
+                return !removed;
+            }
+        };
+
+        /* 一个关键字上依次应用的一串消息的总效果，分树中不存在与存在两种情况 */
+        struct msg_effect_t
+        {
+            bool absent_found;    //不存在时：最后是否存在
+            value_t absent_value;
+            int present_state;    //存在时：0被删除，1改为present_value，2保持原值
+            value_t present_value;
+
+            void clear()
+            {
+                absent_found = false;
+                present_state = 2;
+            }
+
+            void apply(const message_t &m)
+            {
+                if (m.type == BP_MSG_INSERT)
+                {
+                    if (!absent_found)
+                        absent_value = m.value;
+                    absent_found = true;
+                    if (present_state == 0)
+                    {
+                        present_state = 1;
+                        present_value = m.value;
+                    }
+                }
+                else if (m.type == BP_MSG_UPSERT)
+                {
+                    absent_found = true;
+                    absent_value = m.value;
+                    present_state = 1;
+                    present_value = m.value;
+                }
+                else if (m.type == BP_MSG_UPDATE)
+                {
+                    if (absent_found)
+                        absent_value = m.value;
+                    if (present_state != 0)
+                    {
+                        present_state = 1;
+                        present_value = m.value;
+                    }
+                }
+                else
+                {
+                    absent_found = false;
+                    present_state = 0;
+                }
+            }
+
+            bool resolve(const record_t *base, value_t &out) const
+            {
+                if (base == NULL)
+                {
+                    out = absent_value;
+                    return absent_found;
+                }
+                out = present_state == 1 ? present_value : base->value;
+                return present_state != 0;
+            }
+
+            /* 合并到查找结果上（result为0表示存在，value为其值） */
+            void resolve(int &result, value_t *value) const
+            {
+                record_t base;
+                base.value = *value;
+                value_t out;
+                if (resolve(result == 0 ? &base : NULL, out))
+                {
+                    *value = out;
+                    result = 0;
+                }
+                else
+                    result = -1;
+            }
+
+            /* 在本效果之后再应用later的效果 */
+            void then(const msg_effect_t &later)
+            {
+                //原来不存在：看本效果之后是否存在
+                if (absent_found)
+                {
+                    absent_found = later.present_state != 0;
+                    if (later.present_state == 1)
+                        absent_value = later.present_value;
+                }
+                else
+                {
+                    absent_found = later.absent_found;
+                    absent_value = later.absent_value;
+                }
+
+                //原来存在
+                if (present_state == 0)
+                {
+                    if (later.absent_found)
+                    {
+                        present_state = 1;
+                        present_value = later.absent_value;
+                    }
+                }
+                else if (later.present_state != 2)
+                {
+                    present_state = later.present_state;
+                    present_value = later.present_value;
+                }
+            }
+        };
+
+        struct key_less
+        {
+            bool operator()(const key_t &a, const key_t &b) const
+            {
+                return keycmp(a, b) < 0;
+            }
+        };
+
+        typedef std::map<key_t, txn_entry_t, key_less> write_set_t;
+        typedef std::map<key_t, msg_effect_t, key_less> effect_map_t;
+        std::unique_ptr<write_set_t> txn; //当前事务的写集合，没有事务时为NULL
+
+        /* 事务中的写操作只修改写集合，返回值与对应的接口相同 */
+        int txn_insert(const key_t &key, const value_t &value);
+        int txn_update(const key_t &key, const value_t &value);
+        int txn_remove(const key_t &key);
+
+        /* range read with the records of changes (write set or buffered messages) merged in */
+        template <class Map, class Emit>
+        int merge_range(const Map &changes, key_t *left, const key_t &right, size_t max,
+                        bool *next, Emit emit) const;
+
+        /* scan with the records of changes merged in */
+        template <class Map>
+        int merge_scan(const Map &changes, const key_t &left, const key_t &right,
+                       const std::function<void(const record_t &)> &visit) const;
+
+        /* range read that sees the write set or the buffered messages */
+        template <class Emit>
+        int read_range(key_t *left, const key_t &right, size_t max, bool *next,
+                       Emit emit) const;
+
+        /* write-optimized mode */
+        int put_message(int type, const key_t &key, const value_t *value);
+        void flush_step(off_t offset, size_t height);
+        size_t buffered_count(off_t offset) const;
+        void split_buffer(internal_node_t &node, internal_node_t &next, const key_t &middle);
+
+        /* apply the messages buffered for key on the way down to the leaf's result */
+        void apply_messages(const key_t &key, int &result, value_t *value) const;
+
+        /* combined effect of the messages buffered below the node at offset for keys in [left, right] */
+        void collect_messages(off_t offset, size_t height, const key_t &left, const key_t &right,
+                              effect_map_t &effects) const;
+
+        /* LSM-style memtable in front of the tree */
+        size_t memtable_keys; //内存表的容量，0表示不使用内存表
+        effect_map_t memtable;
+        int memtable_put(int type, const key_t &key, const value_t *value);
+
+        /* apply the effects from `from` that fall into one leaf with a single descent, return the first one left */
+        effect_map_t::const_iterator merge_into_leaf(effect_map_t::const_iterator from,
+                                                     effect_map_t::const_iterator to);
+
+        /* the effect kept for key in effects, a cleared one is added when there is none */
+        static msg_effect_t &effect_of(effect_map_t &effects, const key_t &key);
+
+        /* combined effect of the buffered messages and the memtable for keys in [left, right] */
+        void collect_changes(const key_t &left, const key_t &right, effect_map_t &effects) const;
+
+        /* write below the memtable: into the buffers in buffered mode, otherwise into the leaves */
+        int write_tree(int type, const key_t &key, const value_t *value);
+
+        /* the plain B+ tree writes, also used to apply flushed messages */
+        int insert_record(const key_t &key, const value_t &value);
+        int modify_record(const key_t &key, const std::function<bool(value_t &, bool)> &fn);
+        int update_record(const key_t &key, const value_t &value);
+        int remove_record(const key_t &key);
+
+        /* redo journal of the batch being committed */
+        void journal_path(char *buf, size_t size) const;
+        int write_journal() const;
+        void replay_journal() const;
 
         /*init empty tree*/
-        void init_from_empty();
+        void init_from_empty(size_t flags = 0);
 
         /* find index */
         off_t search_index(const key_t &key) const;
 
+        /* descent path of a key: nodes[0] is the root, nodes[depth - 1] the leaf's parent */
+        struct path_t
+        {
+            off_t nodes[BP_MAX_HEIGHT];
+            size_t depth;
+            internal_node_t *images;   //load_path读取的各节点内容，search_path为NULL
+            bool dirty[BP_MAX_HEIGHT]; //images中修改过、需要写回的节点
+        };
+        void search_path(const key_t &key, path_t &path) const;
+
+        /* remove keeps the nodes read on the way down, rebalances them in place and writes
+           each changed one once at the end */
+        std::vector<internal_node_t> path_images; //load_path的缓冲区（复用）
+        void load_path(const key_t &key, path_t &path);
+        void store_path(path_t &path);
+
+        /* put a new key into the leaf at offset found through path, splitting it when full */
+        void insert_into_leaf(path_t &path, off_t offset, leaf_node_t &leaf, const key_t &key,
+                              const value_t &value);
+
+        /* whether the leaves hold the latest records and can be pinned in the cache */
+        bool pinnable() const
+        {
+            return !txn && !buffered() && memtable.empty() && cache.capacity() > 0;
+        }
+
+        /* pin the cached image of the leaf at offset, reading it first when missing; NULL on error */
+        const leaf_node_t *pin_leaf(off_t offset) const;
+
         /* find leaf */
         off_t search_leaf(off_t index, const key_t &key) const;
         off_t search_leaf(const key_t &key) const
@@ -129,19 +856,32 @@ namespace bpt
             return search_leaf(search_index(key), key);
         }
 
-        /* remove internal node */
-        void remove_from_index(off_t offset, internal_node_t &node,
-                               const key_t &key);
+        /* remove the pos-th key and the child after it from the internal node path.images[depth - 1] */
+        void remove_from_index(path_t &path, size_t depth, size_t pos);
+
+        /* borrow into or merge the underfull leaf at offset, where is its entry in the parent */
+        void rebalance_leaf(path_t &path, index_t *where, leaf_node_t &leaf, off_t offset,
+                            const key_t &key);
+
+        size_t relaxed_pending;           //宽松填充时攒够多少个叶子节点再平衡，0表示立即再平衡
+        /* 攒够多少个低于半满的叶子节点再平衡：缓冲模式下不能立即再平衡，没有设置宽松填充时用默认值 */
+        size_t rebalance_threshold() const
+        {
+            return relaxed_pending > 0 ? relaxed_pending : buffered() ? BP_RELAXED_PENDING : 0;
+        }
+        std::map<off_t, key_t> underfull; //推迟再平衡的叶子节点，以及落在其中的一个关键字
 
-        /* borrow one key from other internal node */
+        /* borrow one key from a sibling under the same parent */
         bool borrow_key(bool from_right, internal_node_t &borrower,
-                        off_t offset);
+                        off_t offset, internal_node_t &parent);
 
         /*borrow one record from other leaf*/
-        bool borrow_key(bool from_right, leaf_node_t &borrower);
+        bool borrow_key(bool from_right, leaf_node_t &borrower, path_t &path,
+                        const key_t &key);
 
-        /* change one's parent key to another key */
-        void change_parent_child(off_t parent, const key_t &o, const key_t &n);
+        /* change the key separating the leaf on path from its left / right neighbour */
+        void change_separator(path_t &path, const key_t &key, bool right,
+                              const key_t &separator);
 
         /* merge right leaf to left leaf */
         void merge_leafs(leaf_node_t *left, leaf_node_t *right);
@@ -150,22 +890,89 @@ namespace bpt
         /* insert into leaf without split */
         void insert_record_no_split(leaf_node_t *leaf, const key_t &key, const value_t &value);
 
-        /* add key to the internal node */
-        void insert_key_to_index(off_t offset, const key_t &key, off_t value,
-                                 off_t after);
+        /* add key to the internal node path.nodes[depth - 1], depth 0 grows a new root */
+        void insert_key_to_index(const path_t &path, size_t depth, const key_t &key,
+                                 off_t value, off_t after);
         void insert_key_to_index_no_split(internal_node_t &node, const key_t &key,
                                           off_t value);
 
-        /* change children's parent */
-        void reset_index_children_parent(index_t *begin, index_t *end,
-                                         off_t parent);
-
         template <class T>
         void node_create(off_t offset, T *node, T *next);
 
         template <class T>
         void node_remove(T *prev, T *node);
 
+        /* start reading uncached nodes; map() waits for them when they are needed */
+        void prefetch(const off_t *offsets, size_t n, bool leaf) const;
+        bool complete_prefetch(off_t offset) const;
+        void drain_prefetch() const;
+
+        /* 尚未完成的预读请求 */
+        struct inflight_t
+        {
+            size_t id;
+            bool leaf;
+            std::vector<char> buf;
+        };
+        mutable std::map<off_t, inflight_t> inflight;
+
+        /* 挂起中的异步操作（按提交顺序） */
+        struct async_op_t
+        {
+            enum op_type_t
+            {
+                SEARCH,
+                INSERT,
+                UPDATE,
+                REMOVE
+            } type;
+            key_t key;
+            value_t value;  //插入或更新的值
+            value_t *out;   //查找结果
+            bool started;   //是否已经开始下降
+            off_t offset;   //当前所在节点
+            size_t levels;  //当前节点之下还有几层内节点（0表示offset是叶子节点）
+            std::promise<int> result;
+        };
+        std::list<async_op_t> ops;
+
+        std::future<int> submit_async(async_op_t::op_type_t type, const key_t &key,
+                                      const value_t *value, value_t *out);
+        bool step_async(async_op_t &op);
+
+        /* read the nodes of one level with several threads (used by analyze) */
+        void analyze_level(const std::vector<off_t> &nodes, bool leaf, size_t threads,
+                           level_stat_t &stat, std::vector<off_t> *children,
+                           std::vector<std::pair<off_t, off_t>> *links,
+                           size_t *stored) const;
+
+        /* leaves covering [left, right] in key order, found by descending the internal levels */
+        void scan_leaves(const key_t &left, const key_t &right, std::vector<off_t> &leaves) const;
+
+        /* read and decode a leaf through file without touching the cache, return bytes read (0 on error) */
+        size_t read_leaf(FILE *file, off_t offset, leaf_node_t *leaf) const;
+
+        /* walk the leaf chain from left to right, emit(record, i) for at most max records */
+        template <class Emit>
+        int scan_range(key_t *left, const key_t &right, size_t max, bool *next,
+                       Emit emit) const;
+
+        /* prefetch the next n leaves of a scan starting at leaf from, stop after leaf last */
+        size_t readahead(off_t &index, off_t from, off_t last, size_t n) const;
+
+        /* decode a leaf block whose first rd bytes are already in buf */
+        int load_leaf(char *buf, size_t rd, off_t offset, leaf_node_t *leaf) const;
+
+        /* collect writes and submit them together (e.g. all writes of a split),
+           a durable batch goes through the journal and is synced to disk */
+        mutable std::map<off_t, std::vector<char>> pending; //尚未提交的写入
+        mutable int batch_level;
+        void begin_write_batch() const
+        {
+            ++batch_level;
+        }
+        int end_write_batch(bool durable = false) const;
+
         /* multi-level file open/close */
         mutable FILE *fp;
         mutable int fp_level;
@@ -203,11 +1010,18 @@ namespace bpt
             return slot;
         }
 
+        /* 叶子节点在磁盘上占用的块大小（压缩模式下多存一个压缩长度） */
+        size_t leaf_block_size() const
+        {
+            return sizeof(leaf_node_t) +
+                   (meta.flags & BP_FLAG_COMPRESS ? sizeof(size_t) : 0);
+        }
+
         off_t alloc(leaf_node_t *leaf)
         {
             leaf->n = 0; //初始化叶子节点的
             meta.leaf_node_num++;
-            return alloc(sizeof(leaf_node_t));
+            return alloc(leaf_block_size());
         }
 
         off_t alloc(internal_node_t *node)
@@ -234,38 +1048,141 @@ namespace bpt
             offset：偏移量
             size：内存块大小
         */
-        int map(void *block, off_t offset, size_t size) const
+        size_t read_bytes(void *block, off_t offset, size_t size) const
         {
-            open_file();
-            fseek(fp, offset, SEEK_SET);           //从头开始找到偏移量为offset的位置
-            size_t rd = fread(block, size, 1, fp); //从给定流fp读取数据到ptr所指向的数组中
-            close_file();
-            return rd - 1;
+            //批量写入期间，尚未提交的数据比磁盘上的新
+            size_t rd = 0;
+            if (batch_level > 0)
+            {
+                //从offset开始或覆盖了offset的那次写入
+                auto it = pending.upper_bound(offset);
+                if (it != pending.begin() && (--it)->first + (off_t)it->second.size() > offset)
+                {
+                    size_t at = offset - it->first;
+                    rd = std::min(size, it->second.size() - at);
+                    memcpy(block, it->second.data() + at, rd);
+                }
+            }
+
+            size_t got = rd;
+            if (rd < size)
+            {
+                open_file();
+                fseek(fp, offset + rd, SEEK_SET);                     //从头开始找到偏移量为offset的位置
+                got += fread((char *)block + rd, 1, size - rd, fp); //从给定流fp读取数据到ptr所指向的数组中
+                close_file();
+
+                io_stats.reads++;
+                io_stats.read_bytes += got - rd;
+            }
+
+            //块中间尚未提交的写入（如追加到缓冲区中的消息）叠加到读到的数据上
+            for (auto it = pending.upper_bound(offset);
+                 batch_level > 0 && it != pending.end() && it->first < offset + (off_t)size; ++it)
+            {
+                size_t at = it->first - offset, n = std::min(it->second.size(), size - at);
+                memcpy((char *)block + at, it->second.data(), n);
+                got = std::max(got, at + n);
+            }
+            return got;
         }
 
-        template <class T>
-        int map(T *block, off_t offset) const //将读取到的数据存到block中
+        int read_block(void *block, off_t offset, size_t size) const
         {
-            return map(block, offset, sizeof(T));
+            return read_bytes(block, offset, size) == size ? 0 : -1;
         }
 
         /* write block to disk */
-        int unmap(void *block, off_t offset, size_t size) const
+        int write_block(const void *block, off_t offset, size_t size) const
         {
+            if (batch_level > 0)
+            {
+                //同一位置的多次写入合并为一次（只写头部时修补已有数据）；
+                //从更早写入的范围中间开始的写入（如叶子节点中的一个扇区）也合并到那次写入中，
+                //提交时各块互不重叠，异步I/O同时写入也不会让旧数据覆盖新数据
+                off_t start = offset;
+                auto prev = pending.upper_bound(offset);
+                if (prev != pending.begin() && (--prev)->first + (off_t)prev->second.size() > offset)
+                    start = prev->first;
+
+                std::vector<char> &buf = pending[start];
+                size_t from = offset - start;
+                if (buf.size() < from + size)
+                    buf.resize(from + size);
+                memcpy(buf.data() + from, block, size);
+
+                //块中间更早的写入被这次覆盖：超出这次写入的部分接到后面，然后删除
+                for (auto it = pending.upper_bound(offset);
+                     it != pending.end() && it->first < offset + (off_t)size;)
+                {
+                    size_t at = it->first - start;
+                    if (at + it->second.size() > buf.size())
+                        buf.insert(buf.end(), it->second.begin() + (buf.size() - at), it->second.end());
+                    it = pending.erase(it);
+                }
+                return 0;
+            }
+
             open_file();
             fseek(fp, offset, SEEK_SET);
             //将block写入fp中，返回fp中的元素总数
             size_t wd = fwrite(block, size, 1, fp);
             close_file();
 
+            io_stats.writes++;
+            io_stats.write_bytes += size;
             return wd - 1;
         }
 
+        /* 读取节点的一部分（通常是节点头部），优先从缓存中读取 */
+        int map(void *block, off_t offset, size_t size) const
+        {
+            const char *page = cache.get(offset, size);
+            count_map(page, size);
+            if (page != NULL)
+            {
+                memcpy(block, page, size);
+                return 0;
+            }
+            return read_block(block, offset, size);
+        }
+
+        template <class T>
+        int map(T *block, off_t offset) const //将读取到的数据存到block中
+        {
+            return map(block, offset, sizeof(T));
+        }
+
+        /* 读取完整节点（经过缓存，叶子节点在压缩模式下需要解压） */
+        int map(internal_node_t *node, off_t offset) const;
+        int map(leaf_node_t *leaf, off_t offset) const;
+
+        /* 写入节点的一部分，同时修补缓存 */
+        int unmap(void *block, off_t offset, size_t size) const
+        {
+            drain_prefetch(); //预读的旧数据不能晚于写入进入缓存
+            count_unmap(size);
+            cache.patch(offset, block, size);
+            return write_block(block, offset, size);
+        }
+
         template <class T>
         int unmap(T *block, off_t offset) const
         {
             return unmap(block, offset, sizeof(T));
         }
+
+        /* 写入完整节点（写穿透缓存，叶子节点在压缩模式下先压缩） */
+        int unmap(internal_node_t *node, off_t offset) const;
+        int unmap(leaf_node_t *leaf, off_t offset) const;
+
+        /* 只写回叶子节点中[at, at + size)所在的扇区；写回一条记录的值时只写新旧值不同的字节 */
+        int unmap(leaf_node_t *leaf, off_t offset, size_t at, size_t size) const;
+        int unmap_value(leaf_node_t *leaf, off_t offset, const record_t *record, const value_t &old) const;
+
+        /* 读取消息缓冲区的前n条消息；写入时只写头部和第from条之后的消息 */
+        int map(buffer_node_t *buf, off_t offset) const;
+        int unmap(buffer_node_t *buf, off_t offset, size_t from = 0) const;
     };
 }
 
@@ -0,0 +1,537 @@
+/******************************
+ * Topic: CSV批量导入与导出
+ * Author: Sliverchen
+ * Create file date : 2026 / 10 / 18
+ * Explanation:
+ *      1、导入：按块读取CSV，每块按行切分后由多个线程并行解析
+ *      2、空树且输入已按关键字升序时，边解析边交给bulk_load自底向上构建；
+ *         输入无序时先外部排序（每块排序后写成顺串文件，再多路归并去重），再构建
+ *      3、非空树或事务中逐条插入（每块先排序，提高节点缓存的命中率），事务中的插入进入写集合
+ *      4、导出：沿叶子链表顺序扫描，通过row_writer和大缓冲区写出
+ * ****************************/
+
+#ifndef BULK_IO_H
+#define BULK_IO_H
+
+#include "Bplus_Tree.h"
+#include "Row_Writer.h"
+#include <algorithm>
+#include <errno.h>
+#include <queue>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace bpt
+{
+/* 每次解析的CSV字节数与文件读写缓冲区大小 */
+#define BI_CHUNK_BYTES (2 << 20)
+#define BI_IO_BUFFER (1 << 20)
+
+    /* 导入结果 */
+    struct import_result_t
+    {
+        size_t loaded;     //写入的记录数
+        size_t duplicates; //关键字重复而跳过的行数
+        size_t invalid;    //格式错误的行数
+        size_t runs;       //外部排序产生的顺串个数（0表示输入有序或逐条插入）
+        bool bulk;         //是否自底向上构建
+    };
+
+    //--------------------------------
+    //解析一个CSV字段（支持RFC 4180引号），p指向字段开头
+    //返回值：
+    //  字段后面的位置（分隔符或行尾），字段过长时返回NULL
+    //--------------------------------
+    inline const char *csv_field(const char *p, const char *end, char *out, size_t cap)
+    {
+        size_t n = 0;
+        if (p < end && *p == '"')
+        {
+            for (++p; p < end; ++p)
+            {
+                if (*p == '"')
+                {
+                    if (p + 1 < end && p[1] == '"')
+                        ++p;
+                    else
+                    {
+                        ++p;
+                        break;
+                    }
+                }
+                if (n + 1 >= cap)
+                    return NULL;
+                out[n++] = *p;
+            }
+        }
+        else
+        {
+            for (; p < end && *p != ','; ++p)
+            {
+                if (n + 1 >= cap)
+                    return NULL;
+                out[n++] = *p;
+            }
+        }
+        out[n] = '\0';
+        return p;
+    }
+
+    /* 整数字段：-?[0-9]+ */
+    inline bool csv_integer(const char *s)
+    {
+        if (*s == '-')
+            ++s;
+        if (*s == '\0')
+            return false;
+        for (; *s != '\0'; ++s)
+            if (*s < '0' || *s > '9')
+                return false;
+        return true;
+    }
+
+    //--------------------------------
+    //解析一行：id,name,age[,email]
+    //返回值：
+    //  格式正确返回true
+    //--------------------------------
+    inline bool csv_parse_line(const char *p, const char *end, record_t &rec)
+    {
+        if (end > p && end[-1] == '\r')
+            --end;
+
+        char id[sizeof(rec.key.k)], age[16];
+        memset((void *)&rec, 0, sizeof(rec));
+
+        if ((p = csv_field(p, end, id, sizeof(id))) == NULL || p == end || *p++ != ',' ||
+            (p = csv_field(p, end, rec.value.name, sizeof(rec.value.name))) == NULL ||
+            p == end || *p++ != ',' || (p = csv_field(p, end, age, sizeof(age))) == NULL)
+            return false;
+        if (p != end && (*p++ != ',' ||
+                         (p = csv_field(p, end, rec.value.email, sizeof(rec.value.email))) == NULL ||
+                         p != end))
+            return false;
+        if (!csv_integer(id) || !csv_integer(age))
+            return false;
+
+        //年龄不能超出int范围（long只有32位时超出的值被截成LONG_MAX并设置ERANGE）
+        char *stop;
+        errno = 0;
+        long v = strtol(age, &stop, 10);
+        if (*stop != '\0' || errno == ERANGE || v > 2147483647L || v < -2147483647L - 1)
+            return false;
+
+        memcpy(rec.key.k, id, sizeof(id));
+        rec.value.age = (int)v;
+        return true;
+    }
+
+    inline bool record_less(const record_t &a, const record_t &b)
+    {
+        return keycmp(a.key, b.key) < 0;
+    }
+
+    /* 按块读取CSV并行解析 */
+    class csv_reader
+    {
+    public:
+        csv_reader(size_t threads = 0) : fp(NULL), first(true), eof(true)
+        {
+            workers = threads != 0 ? threads : std::thread::hardware_concurrency();
+            if (workers == 0)
+                workers = 1;
+        }
+
+        ~csv_reader()
+        {
+            close();
+        }
+
+        bool open(const char *path)
+        {
+            close();
+            fp = fopen(path, "rb");
+            first = true;
+            eof = fp == NULL;
+            carry.clear();
+            return fp != NULL;
+        }
+
+        void close()
+        {
+            if (fp != NULL)
+                fclose(fp);
+            fp = NULL;
+        }
+
+        //--------------------------------
+        //读取并解析下一块（按行对齐）
+        //参数说明：
+        //  out：    解析出的记录（保持文件中的顺序）
+        //  invalid：累加格式错误的行数
+        //返回值：
+        //  没有更多数据时返回false
+        //--------------------------------
+        bool next(std::vector<record_t> &out, size_t &invalid)
+        {
+            out.clear();
+            if (eof && carry.empty())
+                return false;
+
+            //读入一块，在最后一个换行处截断，剩余部分留给下一块
+            std::vector<char> buf(carry);
+            size_t want = BI_CHUNK_BYTES;
+            size_t cut = 0;
+            while (true)
+            {
+                size_t old = buf.size();
+                buf.resize(old + want);
+                size_t rd = eof ? 0 : fread(buf.data() + old, 1, want, fp);
+                buf.resize(old + rd);
+                if (rd < want)
+                    eof = true;
+
+                const char *nl = NULL;
+                for (size_t i = buf.size(); i > 0 && nl == NULL; --i)
+                    if (buf[i - 1] == '\n')
+                        nl = buf.data() + i - 1;
+
+                if (nl != NULL || eof)
+                {
+                    cut = nl != NULL && !eof ? nl - buf.data() + 1 : buf.size();
+                    break;
+                }
+                want *= 2; //一行比整块还长
+            }
+            carry.assign(buf.begin() + cut, buf.end());
+
+            const char *p = buf.data(), *end = buf.data() + cut;
+
+            //第一行是表头时跳过
+            if (first)
+            {
+                first = false;
+                if (end - p >= 3 && strncmp(p, "id,", 3) == 0)
+                {
+                    const char *nl = (const char *)memchr(p, '\n', end - p);
+                    p = nl == NULL ? end : nl + 1;
+                }
+            }
+
+            //按换行切分成workers段并行解析
+            std::vector<const char *> bounds(1, p);
+            for (size_t w = 1; w < workers; ++w)
+            {
+                const char *q = p + (end - p) * w / workers;
+                if (q < bounds.back())
+                    q = bounds.back();
+                const char *nl = (const char *)memchr(q, '\n', end - q);
+                bounds.push_back(nl == NULL ? end : nl + 1);
+            }
+            bounds.push_back(end);
+
+            std::vector<std::vector<record_t>> parts(workers);
+            std::vector<size_t> bad(workers, 0);
+            std::vector<std::thread> pool;
+            for (size_t w = 0; w < workers; ++w)
+                pool.push_back(std::thread(parse_range, bounds[w], bounds[w + 1],
+                                           &parts[w], &bad[w]));
+            for (size_t w = 0; w < workers; ++w)
+            {
+                pool[w].join();
+                invalid += bad[w];
+                out.insert(out.end(), parts[w].begin(), parts[w].end());
+            }
+            return true;
+        }
+
+    private:
+        FILE *fp;
+        bool first, eof;
+        size_t workers;
+        std::vector<char> carry; //上一块中不完整的最后一行
+
+        static void parse_range(const char *p, const char *end,
+                                std::vector<record_t> *out, size_t *invalid)
+        {
+            record_t rec;
+            while (p < end)
+            {
+                const char *nl = (const char *)memchr(p, '\n', end - p);
+                const char *line_end = nl == NULL ? end : nl;
+                const char *q = p;
+                while (q < line_end && (*q == ' ' || *q == '\t' || *q == '\r'))
+                    ++q;
+                if (q != line_end)
+                {
+                    if (csv_parse_line(p, line_end, rec))
+                        out->push_back(rec);
+                    else
+                        ++*invalid;
+                }
+                p = line_end + 1;
+            }
+        }
+    };
+
+    /* 顺串文件：key_t、age，以及以'\0'结尾的name和email */
+    inline void run_write(FILE *fp, const record_t &rec)
+    {
+        fwrite(rec.key.k, 1, sizeof(rec.key.k), fp);
+        fwrite(&rec.value.age, 1, sizeof(rec.value.age), fp);
+        fwrite(rec.value.name, 1, strlen(rec.value.name) + 1, fp);
+        fwrite(rec.value.email, 1, strlen(rec.value.email) + 1, fp);
+    }
+
+    inline bool run_read(FILE *fp, record_t &rec)
+    {
+        memset((void *)&rec, 0, sizeof(rec));
+        if (fread(rec.key.k, 1, sizeof(rec.key.k), fp) != sizeof(rec.key.k) ||
+            fread(&rec.value.age, 1, sizeof(rec.value.age), fp) != sizeof(rec.value.age))
+            return false;
+        char *fields[2] = {rec.value.name, rec.value.email};
+        for (int f = 0; f < 2; ++f)
+        {
+            int c;
+            size_t n = 0;
+            while ((c = getc(fp)) != EOF && c != '\0')
+                if (n + 1 < sizeof(rec.value.name))
+                    fields[f][n++] = (char)c;
+            if (c == EOF)
+                return false;
+        }
+        return true;
+    }
+
+    //--------------------------------
+    //导入CSV
+    //参数说明：
+    //  tree：   B+树
+    //  path：   CSV文件（id,name,age[,email]，可以有表头）
+    //  result： 导入结果
+    //  threads：解析线程数，0表示每个核一个
+    //返回值：
+    //  0：成功   -1：文件无法打开或临时文件无法写入
+    //--------------------------------
+    inline int import_csv(bplus_tree &tree, const char *path, import_result_t &result,
+                          size_t threads = 0)
+    {
+        memset(&result, 0, sizeof(result));
+        csv_reader reader(threads);
+        if (!reader.open(path))
+            return -1;
+
+        std::vector<record_t> chunk;
+
+        //非空树或事务中：逐条插入
+        if (!tree.empty() || tree.in_transaction())
+        {
+            while (reader.next(chunk, result.invalid))
+            {
+                std::stable_sort(chunk.begin(), chunk.end(), record_less);
+                for (size_t i = 0; i < chunk.size(); ++i)
+                {
+                    if (tree.insert(chunk[i].key, chunk[i].value) == 0)
+                        ++result.loaded;
+                    else
+                        ++result.duplicates;
+                }
+            }
+            return 0;
+        }
+
+        result.bulk = true;
+
+        //step1：假设输入有序，边解析边构建；遇到无序的记录bulk_load会失败并清空树
+        size_t pos = 0, invalid = 0;
+        bool more = true;
+        int loaded = tree.bulk_load([&](record_t &rec) {
+            while (pos == chunk.size())
+            {
+                if (!more || !(more = reader.next(chunk, invalid)))
+                    return false;
+                pos = 0;
+            }
+            rec = chunk[pos++];
+            return true;
+        });
+        if (loaded >= 0)
+        {
+            result.loaded = loaded;
+            result.invalid = invalid;
+            return 0;
+        }
+
+        //step2：外部排序，每块排序后写成一个顺串
+        if (!reader.open(path))
+            return -1;
+        std::vector<std::string> runs;
+        std::vector<record_t> last;
+        while (reader.next(chunk, result.invalid))
+        {
+            std::stable_sort(chunk.begin(), chunk.end(), record_less);
+            if (runs.empty() && last.empty())
+            {
+                last.swap(chunk); //只有一块时不写文件
+                continue;
+            }
+            std::vector<record_t> *blocks[2] = {&last, &chunk};
+            for (int b = 0; b < 2; ++b)
+            {
+                if (blocks[b]->empty())
+                    continue;
+                std::string run = std::string(path) + ".run" + std::to_string(runs.size());
+                FILE *fp = fopen(run.c_str(), "wb");
+                if (fp == NULL)
+                {
+                    for (size_t r = 0; r < runs.size(); ++r)
+                        remove(runs[r].c_str());
+                    return -1;
+                }
+                setvbuf(fp, NULL, _IOFBF, BI_IO_BUFFER);
+                for (size_t i = 0; i < blocks[b]->size(); ++i)
+                    run_write(fp, (*blocks[b])[i]);
+                fclose(fp);
+                runs.push_back(run);
+                blocks[b]->clear();
+            }
+        }
+        reader.close();
+
+        //step3：多路归并，关键字相同时保留文件中先出现的记录
+        std::vector<FILE *> files;
+        for (size_t r = 0; r < runs.size(); ++r)
+        {
+            FILE *fp = fopen(runs[r].c_str(), "rb");
+            if (fp != NULL)
+                setvbuf(fp, NULL, _IOFBF, BI_IO_BUFFER / 4);
+            files.push_back(fp);
+        }
+
+        struct head_t
+        {
+            record_t rec;
+            size_t run;
+        };
+        auto greater = [](const head_t *a, const head_t *b) {
+            int c = keycmp(a->rec.key, b->rec.key);
+            return c != 0 ? c > 0 : a->run > b->run;
+        };
+        std::vector<head_t> heads(files.size());
+        std::priority_queue<head_t *, std::vector<head_t *>, decltype(greater)> heap(greater);
+        for (size_t r = 0; r < files.size(); ++r)
+        {
+            heads[r].run = r;
+            if (files[r] != NULL && run_read(files[r], heads[r].rec))
+                heap.push(&heads[r]);
+        }
+
+        pos = 0;
+        bool has_prev = false;
+        key_t prev;
+        loaded = tree.bulk_load([&](record_t &rec) {
+            while (true)
+            {
+                if (runs.empty())
+                {
+                    if (pos == last.size())
+                        return false;
+                    rec = last[pos++];
+                }
+                else
+                {
+                    if (heap.empty())
+                        return false;
+                    head_t *h = heap.top();
+                    heap.pop();
+                    rec = h->rec;
+                    if (run_read(files[h->run], h->rec))
+                        heap.push(h);
+                }
+
+                if (has_prev && keycmp(prev, rec.key) == 0)
+                {
+                    ++result.duplicates;
+                    continue;
+                }
+                has_prev = true;
+                prev = rec.key;
+                return true;
+            }
+        });
+
+        for (size_t r = 0; r < runs.size(); ++r)
+        {
+            if (files[r] != NULL)
+                fclose(files[r]);
+            remove(runs[r].c_str());
+        }
+        result.runs = runs.size();
+        result.loaded = loaded < 0 ? 0 : loaded;
+        return loaded < 0 ? -1 : 0;
+    }
+
+    //--------------------------------
+    //导出CSV
+    //参数说明：
+    //  tree： B+树
+    //  path： 输出文件
+    //  range：为true时只导出id在[start, end]内的记录，否则导出全部
+    //返回值：
+    //  导出的行数，文件无法打开时返回-1
+    //--------------------------------
+    inline long export_csv(bplus_tree &tree, const char *path, bool range = false,
+                           int start = 0, int end = 0)
+    {
+        FILE *fp = fopen(path, "wb");
+        if (fp == NULL)
+            return -1;
+        setvbuf(fp, NULL, _IOFBF, BI_IO_BUFFER);
+
+        std::unique_ptr<row_writer> writer(new row_writer(fp, ROW_CSV, true));
+        writer->begin();
+        auto visit = [&writer](const record_t &rec) { writer->write(rec); };
+
+        //最大的关键字：关键字先比较长度，再逐字节比较
+        char max_key[sizeof(key_t)];
+        memset(max_key, 0xff, sizeof(max_key) - 1);
+        max_key[sizeof(max_key) - 1] = '\0';
+
+        if (!range)
+            tree.scan(key_t(""), key_t(max_key), visit);
+        else
+        {
+            //负数与非负数按关键字排序时交错，负数部分逐个查找（同searchAll）
+            value_t value;
+            char id[16];
+            for (int i = start; i <= end && i < 0; ++i)
+            {
+                sprintf(id, "%d", i);
+                if (tree.search(key_t(id), &value) == 0)
+                    writer->write(id, value);
+            }
+            if (end >= 0)
+            {
+                char left[16], right[16];
+                sprintf(left, "%d", start > 0 ? start : 0);
+                sprintf(right, "%d", end);
+                tree.scan(key_t(left), key_t(right), [&writer](const record_t &rec) {
+                    if (rec.key.k[0] != '-')
+                        writer->write(rec);
+                });
+            }
+        }
+
+        long rows = (long)writer->finish();
+        writer->flush();
+        writer.reset();
+        fclose(fp);
+        return rows;
+    }
+}
+
+#endif /* BULK_IO_H */
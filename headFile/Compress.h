@@ -0,0 +1,198 @@
+/******************************
+ * Topic: 叶子节点压缩
+ * Author: Sliverchen
+ * Create file date : 2026 / 10 / 18
+ * Explanation:
+ *      1、LZ4风格的块压缩（token + 字面量 + 回溯偏移 + 匹配长度）
+ *      2、叶子节点中大量补零的name/email字段可以被压缩成很短的匹配
+ *      3、不依赖任何第三方库
+ * ****************************/
+
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <stddef.h>
+#include <string.h>
+
+namespace bpt
+{
+/* 最短匹配长度与哈希表大小 */
+#define LZ_MIN_MATCH 4
+#define LZ_HASH_BITS 12
+#define LZ_MAX_OFFSET 65535
+
+    inline unsigned lz_read32(const unsigned char *p)
+    {
+        unsigned v;
+        memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    inline unsigned lz_hash(unsigned v)
+    {
+        return (v * 2654435761U) >> (32 - LZ_HASH_BITS);
+    }
+
+    //--------------------------------
+    //写入扩展长度（超过15的部分用255链表示）
+    //返回写入后的位置，空间不足返回NULL
+    //--------------------------------
+    inline unsigned char *lz_put_length(unsigned char *op, unsigned char *oend, size_t len)
+    {
+        for (; len >= 255; len -= 255)
+        {
+            if (op >= oend)
+                return NULL;
+            *op++ = 255;
+        }
+        if (op >= oend)
+            return NULL;
+        *op++ = (unsigned char)len;
+        return op;
+    }
+
+    //--------------------------------
+    //输出一个序列
+    //参数说明：
+    //  lit/lit_len：字面量
+    //  offset/match_len：匹配（match_len为0表示最后一个序列）
+    //--------------------------------
+    inline unsigned char *lz_put_sequence(unsigned char *op, unsigned char *oend,
+                                          const unsigned char *lit, size_t lit_len,
+                                          size_t offset, size_t match_len)
+    {
+        if (op >= oend)
+            return NULL;
+
+        unsigned char *token = op++;
+        size_t ml = match_len ? match_len - LZ_MIN_MATCH : 0;
+        *token = (unsigned char)(((lit_len < 15 ? lit_len : 15) << 4) | (ml < 15 ? ml : 15));
+
+        if (lit_len >= 15 && (op = lz_put_length(op, oend, lit_len - 15)) == NULL)
+            return NULL;
+        if ((size_t)(oend - op) < lit_len)
+            return NULL;
+        memcpy(op, lit, lit_len);
+        op += lit_len;
+
+        if (match_len == 0)
+            return op;
+
+        if (oend - op < 2)
+            return NULL;
+        *op++ = (unsigned char)(offset & 0xff);
+        *op++ = (unsigned char)(offset >> 8);
+        if (ml >= 15)
+            op = lz_put_length(op, oend, ml - 15);
+        return op;
+    }
+
+    //--------------------------------
+    //压缩
+    //参数说明：
+    //  src/n：原始数据
+    //  dst/cap：输出缓冲区
+    //返回值：
+    //  压缩后的字节数，输出空间不足时返回0
+    //--------------------------------
+    inline size_t lz_compress(const void *src, size_t n, void *dst, size_t cap)
+    {
+        const unsigned char *in = (const unsigned char *)src;
+        unsigned char *op = (unsigned char *)dst, *oend = op + cap;
+        size_t table[1 << LZ_HASH_BITS] = {0}; //记录位置+1，0表示空
+        size_t i = 0, anchor = 0;
+
+        while (i + LZ_MIN_MATCH <= n)
+        {
+            unsigned h = lz_hash(lz_read32(in + i));
+            size_t cand = table[h];
+            table[h] = i + 1;
+
+            if (cand != 0 && i - (cand - 1) <= LZ_MAX_OFFSET &&
+                lz_read32(in + cand - 1) == lz_read32(in + i))
+            {
+                size_t ref = cand - 1, len = LZ_MIN_MATCH;
+                while (i + len < n && in[ref + len] == in[i + len])
+                    ++len;
+
+                op = lz_put_sequence(op, oend, in + anchor, i - anchor, i - ref, len);
+                if (op == NULL)
+                    return 0;
+                i += len;
+                anchor = i;
+            }
+            else
+                ++i;
+        }
+
+        op = lz_put_sequence(op, oend, in + anchor, n - anchor, 0, 0);
+        return op == NULL ? 0 : op - (unsigned char *)dst;
+    }
+
+    //--------------------------------
+    //解压
+    //参数说明：
+    //  src/n：压缩数据
+    //  dst/cap：输出缓冲区
+    //返回值：
+    //  解压后的字节数，数据损坏时返回0
+    //--------------------------------
+    inline size_t lz_decompress(const void *src, size_t n, void *dst, size_t cap)
+    {
+        const unsigned char *ip = (const unsigned char *)src, *iend = ip + n;
+        unsigned char *out = (unsigned char *)dst;
+        size_t o = 0;
+
+        while (ip < iend)
+        {
+            unsigned token = *ip++;
+            size_t lit_len = token >> 4;
+            if (lit_len == 15)
+            {
+                unsigned char c;
+                do
+                {
+                    if (ip >= iend)
+                        return 0;
+                    c = *ip++;
+                    lit_len += c;
+                } while (c == 255);
+            }
+            if ((size_t)(iend - ip) < lit_len || cap - o < lit_len)
+                return 0;
+            memcpy(out + o, ip, lit_len);
+            ip += lit_len;
+            o += lit_len;
+
+            //最后一个序列只有字面量
+            if (ip == iend)
+                break;
+
+            if (iend - ip < 2)
+                return 0;
+            size_t offset = ip[0] | (ip[1] << 8);
+            ip += 2;
+            size_t len = (token & 0x0f) + LZ_MIN_MATCH;
+            if ((token & 0x0f) == 15)
+            {
+                unsigned char c;
+                do
+                {
+                    if (ip >= iend)
+                        return 0;
+                    c = *ip++;
+                    len += c;
+                } while (c == 255);
+            }
+            if (offset == 0 || offset > o || cap - o < len)
+                return 0;
+
+            //匹配区域可能与输出重叠，逐字节复制
+            for (size_t k = 0; k < len; ++k, ++o)
+                out[o] = out[o - offset];
+        }
+        return o;
+    }
+}
+
+#endif /* COMPRESS_H */
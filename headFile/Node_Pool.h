@@ -0,0 +1,141 @@
+/******************************
+ * Topic: 节点缓冲区池
+ * Author: Sliverchen
+ * Create file date : 2026 / 10 / 19
+ * Explanation:
+ *      1、按块大小分组的空闲链表：块的大小向上取整到BP_POOL_ALIGN，首地址按BP_POOL_ALIGN对齐，
+ *         可以直接用作O_DIRECT读写的缓冲区
+ *      2、pooled<T>构造时从池中取一块、析构时放回，代替栈上的叶子节点（约26KB）、压缩模式下的叶子节点磁盘块
+ *         和每次new出来的消息缓冲区，嵌套调用时栈上只剩一个指针
+ *      3、放回的块留在池中重复使用，池的大小只取决于同时使用的块的最大个数，
+ *         长时间运行内存占用不增长；池析构时一起释放
+ *      4、不加锁，只能在树所在的线程中使用（并行扫描的工作线程仍使用自己的节点）
+ * ****************************/
+
+#ifndef NODE_POOL_H
+#define NODE_POOL_H
+
+#include <map>
+#include <new>
+#include <stddef.h>
+#include <stdlib.h>
+#include <vector>
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
+namespace bpt
+{
+/* 块的对齐与大小粒度（与磁盘扇区、内存页对齐） */
+#define BP_POOL_ALIGN 4096
+
+    class node_pool
+    {
+    public:
+        node_pool() : total(0) {}
+
+        ~node_pool()
+        {
+            for (auto it = free_lists.begin(); it != free_lists.end(); ++it)
+                for (size_t i = 0; i < it->second.size(); ++i)
+                    release_block(it->second[i]);
+        }
+
+        //--------------------------------
+        //取一块至少size字节的缓冲区（内容未初始化）
+        //--------------------------------
+        void *acquire(size_t size)
+        {
+            std::vector<void *> &list = free_lists[round(size)];
+            if (!list.empty())
+            {
+                void *p = list.back();
+                list.pop_back();
+                return p;
+            }
+
+            total += round(size);
+            return alloc_block(round(size));
+        }
+
+        //--------------------------------
+        //放回acquire(size)取得的缓冲区
+        //--------------------------------
+        void release(void *p, size_t size)
+        {
+            free_lists[round(size)].push_back(p);
+        }
+
+        /* 池向系统申请的总字节数 */
+        size_t bytes() const
+        {
+            return total;
+        }
+
+    private:
+        std::map<size_t, std::vector<void *>> free_lists; //块大小 -> 空闲的块
+        size_t total;
+
+        static size_t round(size_t size)
+        {
+            return (size + BP_POOL_ALIGN - 1) / BP_POOL_ALIGN * BP_POOL_ALIGN;
+        }
+
+        static void *alloc_block(size_t size)
+        {
+#if defined(_WIN32)
+            void *p = _aligned_malloc(size, BP_POOL_ALIGN);
+#else
+            void *p = NULL;
+            if (posix_memalign(&p, BP_POOL_ALIGN, size) != 0)
+                p = NULL;
+#endif
+            if (p == NULL)
+                abort();
+            return p;
+        }
+
+        static void release_block(void *p)
+        {
+#if defined(_WIN32)
+            _aligned_free(p);
+#else
+            free(p);
+#endif
+        }
+    };
+
+    /* 从池中借用的一个T（T只能是析构时不需要做任何事的节点类型），离开作用域时放回 */
+    template <class T>
+    class pooled
+    {
+    public:
+        explicit pooled(node_pool &p) : pool(p), block(new (p.acquire(sizeof(T))) T) {}
+
+        ~pooled()
+        {
+            pool.release(block, sizeof(T));
+        }
+
+        T *get() const
+        {
+            return block;
+        }
+
+        T &operator*() const
+        {
+            return *block;
+        }
+
+        T *operator->() const
+        {
+            return block;
+        }
+
+    private:
+        node_pool &pool;
+        T *block;
+    };
+}
+
+#endif /* NODE_POOL_H */
@@ -0,0 +1,249 @@
+/******************************
+ * Topic: 节点页缓存
+ * Author: Sliverchen
+ * Create file date : 2026 / 10 / 18
+ * Explanation:
+ *      1、按偏移量缓存解压后的节点镜像（LRU淘汰）
+ *      2、写穿透：unmap时同时更新磁盘和缓存
+ *      3、只写节点头部（SIZE_NO_CHILDREN）时对缓存做局部修补
+ *      4、消息缓冲区追加消息时在缓存页末尾接着写
+ *      5、钉住的页不会被淘汰；钉住的页被替换、修改或删除时移到retired中保留到放开为止，
+ *         缓存换用新的副本，所以钉住时取得的地址和内容一直有效
+ * ****************************/
+
+#ifndef PAGE_CACHE_H
+#define PAGE_CACHE_H
+
+#include <list>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <unordered_map>
+#include <vector>
+
+namespace bpt
+{
+    class page_cache
+    {
+    public:
+        page_cache(size_t capacity = 0) : cap(capacity) {}
+
+        //--------------------------------
+        //查找缓存页
+        //参数说明：
+        //  offset：节点偏移量
+        //  size：  需要的字节数（缓存页比size小视为未命中）
+        //返回值：
+        //  缓存页首地址，未命中返回NULL
+        //--------------------------------
+        const char *get(off_t offset, size_t size)
+        {
+            auto it = index.find(offset);
+            if (it == index.end() || it->second->data.size() < size)
+                return NULL;
+
+            pages.splice(pages.begin(), pages, it->second); //移到最近使用
+            return it->second->data.data();
+        }
+
+        //--------------------------------
+        //查找并钉住缓存页，用完后调用unpin
+        //返回值：
+        //  缓存页首地址，未命中返回NULL
+        //--------------------------------
+        const char *pin(off_t offset, size_t size)
+        {
+            const char *page = get(offset, size);
+            if (page != NULL)
+                pages.front().pins++;
+            return page;
+        }
+
+        //--------------------------------
+        //已经钉住的页再钉住n次（页必须在缓存中）
+        //--------------------------------
+        void pin_more(off_t offset, size_t n)
+        {
+            index.find(offset)->second->pins += n;
+        }
+
+        //--------------------------------
+        //放开pin取得的页，已经不在缓存中的页没有人钉住时释放
+        //--------------------------------
+        void unpin(off_t offset, const char *page)
+        {
+            auto it = index.find(offset);
+            if (it != index.end() && it->second->data.data() == page)
+            {
+                it->second->pins--;
+                return;
+            }
+            for (auto r = retired.begin(); r != retired.end(); ++r)
+            {
+                if (r->data.data() == page)
+                {
+                    if (--r->pins == 0)
+                        retired.erase(r);
+                    return;
+                }
+            }
+        }
+
+        //--------------------------------
+        //放入（或替换）缓存页
+        //--------------------------------
+        void put(off_t offset, const void *block, size_t size)
+        {
+            if (cap == 0)
+                return;
+
+            auto it = index.find(offset);
+            if (it != index.end() && it->second->pins > 0)
+            {
+                retire(it->second);
+                it = index.end();
+            }
+
+            if (it != index.end())
+            {
+                pages.splice(pages.begin(), pages, it->second);
+            }
+            else
+            {
+                //淘汰最久未使用的页，并复用它的缓冲区（钉住的页不能复用）
+                if (pages.size() >= cap && pages.back().pins == 0)
+                {
+                    index.erase(pages.back().offset);
+                    pages.splice(pages.begin(), pages, --pages.end());
+                }
+                else
+                {
+                    if (pages.size() >= cap)
+                        retire(--pages.end());
+                    pages.push_front(page_t());
+                }
+
+                pages.front().offset = offset;
+                index[offset] = pages.begin();
+            }
+
+            std::vector<char> &data = pages.front().data;
+            data.resize(size);
+            memcpy(data.data(), block, size);
+        }
+
+        //--------------------------------
+        //修补缓存页的前size个字节（页不存在则忽略）
+        //--------------------------------
+        void patch(off_t offset, const void *block, size_t size)
+        {
+            auto it = index.find(offset);
+            if (it == index.end())
+                return;
+
+            std::vector<char> &data = detach(it->second)->data;
+            if (data.size() < size)
+                erase(offset);
+            else
+                memcpy(data.data(), block, size);
+        }
+
+        //--------------------------------
+        //修改缓存页从at开始的size个字节，超出页尾时把页加长（页不存在则忽略）
+        //--------------------------------
+        void write(off_t offset, size_t at, const void *block, size_t size)
+        {
+            auto it = index.find(offset);
+            if (it == index.end())
+                return;
+
+            std::vector<char> &data = detach(it->second)->data;
+            if (data.size() < at)
+            {
+                erase(offset);
+                return;
+            }
+            if (data.size() < at + size)
+                data.resize(at + size);
+            memcpy(data.data() + at, block, size);
+        }
+
+        void erase(off_t offset)
+        {
+            auto it = index.find(offset);
+            if (it == index.end())
+                return;
+            if (it->second->pins > 0)
+                retire(it->second);
+            else
+            {
+                pages.erase(it->second);
+                index.erase(it);
+            }
+        }
+
+        void clear()
+        {
+            while (!pages.empty())
+                erase(pages.front().offset);
+        }
+
+        //修改容量（页数），0表示关闭缓存
+        void resize(size_t capacity)
+        {
+            cap = capacity;
+            while (pages.size() > cap)
+                erase(pages.back().offset);
+        }
+
+        size_t capacity() const
+        {
+            return cap;
+        }
+
+        size_t size() const
+        {
+            return pages.size();
+        }
+
+    private:
+        struct page_t
+        {
+            off_t offset;
+            std::vector<char> data;
+            size_t pins; //钉住的次数
+        };
+        typedef std::list<page_t>::iterator page_iter;
+
+        size_t cap;
+        std::list<page_t> pages;                                           //按最近使用排序
+        std::unordered_map<off_t, std::list<page_t>::iterator> index; //偏移量到页的索引
+        std::list<page_t> retired;                                         //已离开缓存、仍被钉住的页
+
+        //把钉住的页移出缓存（节点在链表之间移动，数据地址不变）
+        void retire(page_iter it)
+        {
+            index.erase(it->offset);
+            retired.splice(retired.end(), pages, it);
+        }
+
+        //要修改钉住的页时，先换成一个副本放在原来的位置
+        page_iter detach(page_iter it)
+        {
+            if (it->pins == 0)
+                return it;
+
+            page_t copy;
+            copy.offset = it->offset;
+            copy.data = it->data;
+            copy.pins = 0;
+            page_iter fresh = pages.insert(it, copy);
+            retire(it);
+            index[fresh->offset] = fresh;
+            return fresh;
+        }
+    };
+}
+
+#endif /* PAGE_CACHE_H */
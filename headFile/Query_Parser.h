@@ -0,0 +1,746 @@
+/******************************
+ * Topic: 命令解析与预编译语句
+ * Author: Sliverchen
+ * Create file date : 2026 / 10 / 18
+ * Explanation:
+ *      1、词法分析：把一行命令切分成关键字、数字、字符串、参数占位符(?)和符号
+ *      2、语法分析：生成prepared_stmt，字面量直接绑定，?留给bind绑定
+ *      3、语句缓存：按“形状”（关键字与符号不变、字面量替换为占位）缓存解析结果，
+ *         重复的语句只做词法分析和参数绑定，跳过语法分析
+ *      4、所有缓冲区都是定长的，解析一条命令不进行堆内存分配
+ * ****************************/
+
+#ifndef QUERY_PARSER_H
+#define QUERY_PARSER_H
+
+#include "predefined.h"
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+namespace bpt
+{
+/* 一条命令最多的记号数、缓存的语句数与形状的最大长度 */
+#define QP_MAX_TOKENS 32
+#define QP_CACHE_SIZE 16
+#define QP_SHAPE_LEN 160
+
+    /* 记号类型 */
+    enum token_type_t
+    {
+        TK_WORD,   //关键字或不带引号的字符串
+        TK_NUMBER, //整数
+        TK_STRING, //带引号的字符串
+        TK_PARAM,  //参数占位符 ?
+        TK_SYMBOL  //( ) , = ; * < >
+    };
+
+    struct token_t
+    {
+        token_type_t type;
+        const char *text; //指向原命令，不复制
+        size_t len;
+    };
+
+    /* 语句类型 */
+    enum stmt_type_t
+    {
+        STMT_NONE,
+        STMT_HELP,
+        STMT_EXIT,
+        STMT_RESET,
+        STMT_STATS,
+        STMT_ANALYZE,
+        STMT_MODE,   //参数保存在value.name中
+        STMT_OUTPUT, //参数保存在value.name中
+        STMT_IMPORT, //参数保存在value.name中
+        STMT_EXPORT, //参数保存在value.name中，可选的范围在id、id_end中
+        STMT_INSERT,
+        STMT_DELETE,
+        STMT_UPDATE,
+        STMT_SELECT,
+        STMT_SELECT_RANGE,
+        STMT_AGGREGATE, //函数保存在agg中，可选的条件：范围在id、id_end中，
+                        //age条件在age_cmp、value.age中，like的模式在value.email中
+        STMT_BEGIN,
+        STMT_COMMIT,
+        STMT_ROLLBACK
+    };
+
+    /* 语句中可以绑定的字段 */
+    enum param_slot_t
+    {
+        SLOT_ID,
+        SLOT_ID_END,
+        SLOT_NAME,
+        SLOT_AGE,
+        SLOT_EMAIL,
+        SLOT_NUM
+    };
+
+    /* 聚合函数 */
+    enum agg_func_t
+    {
+        AGG_COUNT, //count(*)
+        AGG_SUM,   //sum(age)
+        AGG_AVG,   //avg(age)
+        AGG_MIN,   //min(age)
+        AGG_MAX    //max(age)
+    };
+
+    /* 比较运算 */
+    enum cmp_op_t
+    {
+        CMP_EQ, // =
+        CMP_LT, // <
+        CMP_LE, // <=
+        CMP_GT, // >
+        CMP_GE  // >=
+    };
+
+    /* 预编译语句：解析一次，之后只需重新绑定参数 */
+    class prepared_stmt
+    {
+    public:
+        stmt_type_t type;
+        int id;       //where id = / insert的关键字，范围查找的起点
+        int id_end;   //范围查找的终点
+        value_t value; //insert / update的数据
+        agg_func_t agg; //聚合函数
+        cmp_op_t age_cmp; //age条件的比较运算
+
+        prepared_stmt() { clear(); }
+
+        void clear()
+        {
+            type = STMT_NONE;
+            id = id_end = 0;
+            memset(&value, 0, sizeof(value));
+            agg = AGG_COUNT;
+            age_cmp = CMP_EQ;
+            param_count = 0;
+            required = bound = 0;
+        }
+
+        /* 参数占位符的个数 */
+        size_t params() const
+        {
+            return param_count;
+        }
+
+        //--------------------------------
+        //绑定第i个占位符（从0开始）
+        //参数说明：
+        //  text/len：参数的文本，数字字段会被转换成整数
+        //返回值：
+        //  0：成功   -1：下标越界、不是整数或字符串过长
+        //--------------------------------
+        int bind(size_t i, const char *text, size_t len)
+        {
+            if (i >= param_count)
+                return -1;
+            return set(param_slot[i], text, len);
+        }
+
+        int bind(size_t i, const char *text)
+        {
+            return bind(i, text, strlen(text));
+        }
+
+        int bind(size_t i, int number)
+        {
+            if (i >= param_count)
+                return -1;
+            return set(param_slot[i], number);
+        }
+
+        /* 所有必需的字段是否都已绑定 */
+        bool ready() const
+        {
+            return type != STMT_NONE && (bound & required) == required;
+        }
+
+        /* 字段是否已绑定 */
+        bool has(param_slot_t slot) const
+        {
+            return (bound & (1u << slot)) != 0;
+        }
+
+        /* 清除占位符绑定的值，保留字面量 */
+        void reset_params()
+        {
+            for (size_t i = 0; i < param_count; ++i)
+                bound &= ~(1u << param_slot[i]);
+        }
+
+    private:
+        friend class query_parser;
+
+        size_t param_count;
+        unsigned char param_slot[SLOT_NUM]; //第i个占位符对应的字段
+        unsigned required;                  //必需字段的位图
+        unsigned bound;                     //已绑定字段的位图
+
+        static bool is_number_slot(unsigned slot)
+        {
+            return slot == SLOT_ID || slot == SLOT_ID_END || slot == SLOT_AGE;
+        }
+
+        int set(unsigned slot, int number)
+        {
+            if (slot == SLOT_ID)
+                id = number;
+            else if (slot == SLOT_ID_END)
+                id_end = number;
+            else if (slot == SLOT_AGE)
+                value.age = number;
+            else
+                return -1;
+            bound |= 1u << slot;
+            return 0;
+        }
+
+        int set(unsigned slot, const char *text, size_t len)
+        {
+            if (is_number_slot(slot))
+            {
+                //只接受 -?[0-9]+，并且不能超出int范围
+                char buf[16];
+                if (len == 0 || len >= sizeof(buf))
+                    return -1;
+                memcpy(buf, text, len);
+                buf[len] = '\0';
+                char *end;
+                long v = strtol(buf, &end, 10);
+                if (*end != '\0' || end == buf || v > 2147483647L || v < -2147483647L - 1)
+                    return -1;
+                return set(slot, (int)v);
+            }
+
+            char *dst = slot == SLOT_NAME ? value.name : value.email;
+            if (len >= sizeof(value.name))
+                return -1;
+            memset(dst, 0, sizeof(value.name));
+            memcpy(dst, text, len);
+            bound |= 1u << slot;
+            return 0;
+        }
+    };
+
+    class query_parser
+    {
+    public:
+        query_parser() : hits(0), misses(0), tick(0)
+        {
+            for (size_t i = 0; i < QP_CACHE_SIZE; ++i)
+                cache[i].used = 0;
+        }
+
+        //--------------------------------
+        //词法分析
+        //参数说明：
+        //  sql：   命令（记号直接指向它，使用期间必须保持有效）
+        //  tokens：输出的记号
+        //  max：   tokens的容量
+        //返回值：
+        //  记号个数，引号不匹配或记号过多时返回-1
+        //--------------------------------
+        static int tokenize(const char *sql, token_t *tokens, size_t max)
+        {
+            size_t n = 0;
+            const char *p = sql;
+            while (true)
+            {
+                while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n')
+                    ++p;
+                if (*p == '\0')
+                    break;
+                if (n == max)
+                    return -1;
+
+                token_t &t = tokens[n++];
+                if (*p == '\'' || *p == '"')
+                {
+                    char quote = *p++;
+                    t.type = TK_STRING;
+                    t.text = p;
+                    while (*p != '\0' && *p != quote)
+                        ++p;
+                    if (*p == '\0')
+                        return -1;
+                    t.len = p++ - t.text;
+                }
+                else if (is_symbol(*p) || *p == '?')
+                {
+                    t.type = *p == '?' ? TK_PARAM : TK_SYMBOL;
+                    t.text = p++;
+                    t.len = 1;
+                }
+                else
+                {
+                    t.text = p;
+                    while (*p != '\0' && *p != ' ' && *p != '\t' && *p != '\r' &&
+                           *p != '\n' && !is_symbol(*p))
+                        ++p;
+                    t.len = p - t.text;
+                    t.type = is_integer(t.text, t.len) ? TK_NUMBER : TK_WORD;
+                }
+            }
+            return (int)n;
+        }
+
+        //--------------------------------
+        //解析命令，生成预编译语句（使用语句缓存）
+        //参数说明：
+        //  sql：  命令
+        //  stmt： 输出的语句，字面量已经绑定，占位符等待bind
+        //返回值：
+        //  0：成功   -1：语法错误
+        //--------------------------------
+        int prepare(const char *sql, prepared_stmt *stmt)
+        {
+            token_t tokens[QP_MAX_TOKENS];
+            int n = tokenize(sql, tokens, QP_MAX_TOKENS);
+            if (n <= 0)
+                return -1;
+
+            //计算形状并查找缓存
+            char shape[QP_SHAPE_LEN];
+            size_t shape_len = make_shape(tokens, n, shape);
+            entry_t *e = shape_len == 0 ? NULL : lookup(shape, shape_len);
+            if (e != NULL)
+            {
+                ++hits;
+                e->used = ++tick;
+                return bind_tokens(e->slot_of, e->stmt, tokens, n, stmt);
+            }
+
+            ++misses;
+            signed char slot_of[QP_MAX_TOKENS];
+            prepared_stmt tmpl;
+            if (parse(tokens, n, &tmpl, slot_of) != 0)
+                return -1;
+
+            if (shape_len != 0)
+            {
+                e = victim();
+                memcpy(e->shape, shape, shape_len);
+                e->shape_len = shape_len;
+                memcpy(e->slot_of, slot_of, sizeof(slot_of));
+                e->stmt = tmpl;
+                e->used = ++tick;
+            }
+            return bind_tokens(slot_of, tmpl, tokens, n, stmt);
+        }
+
+        size_t cache_hits() const
+        {
+            return hits;
+        }
+
+        size_t cache_misses() const
+        {
+            return misses;
+        }
+
+    private:
+        /* 缓存项：形状 -> 语句模板，以及每个记号对应的字段 */
+        struct entry_t
+        {
+            char shape[QP_SHAPE_LEN];
+            size_t shape_len;
+            size_t used; //最近使用时间，0表示空
+            signed char slot_of[QP_MAX_TOKENS];
+            prepared_stmt stmt;
+        };
+
+        entry_t cache[QP_CACHE_SIZE];
+        size_t hits, misses, tick;
+
+        static bool is_symbol(char c)
+        {
+            return c == '(' || c == ')' || c == ',' || c == '=' || c == ';' || c == '*' || c == '<' || c == '>';
+        }
+
+        static bool is_integer(const char *s, size_t len)
+        {
+            size_t i = (len > 1 && s[0] == '-') ? 1 : 0;
+            if (i == len)
+                return false;
+            for (; i < len; ++i)
+                if (s[i] < '0' || s[i] > '9')
+                    return false;
+            return true;
+        }
+
+        /* 不区分大小写比较记号与关键字 */
+        static bool is_keyword(const token_t &t, const char *word)
+        {
+            if (t.type != TK_WORD)
+                return false;
+            size_t i = 0;
+            for (; i < t.len; ++i)
+            {
+                char c = t.text[i];
+                if (c >= 'A' && c <= 'Z')
+                    c += 'a' - 'A';
+                if (word[i] == '\0' || c != word[i])
+                    return false;
+            }
+            return word[i] == '\0';
+        }
+
+        static bool is_known_keyword(const token_t &t)
+        {
+            static const char *const keywords[] = {
+                ".help", ".exit", ".reset", ".stats", ".analyze", ".mode", ".output", ".import", ".export", "insert", "delete",
+                "update", "select", "from", "where", "id", "in", "db", "begin", "commit", "rollback",
+                "count", "sum", "avg", "min", "max", "age", "email", "like", "and"};
+            for (size_t i = 0; i < sizeof(keywords) / sizeof(keywords[0]); ++i)
+                if (is_keyword(t, keywords[i]))
+                    return true;
+            return false;
+        }
+
+        static bool is_symbol(const token_t &t, char c)
+        {
+            return t.type == TK_SYMBOL && t.text[0] == c;
+        }
+
+        static bool is_value(const token_t &t)
+        {
+            return t.type != TK_SYMBOL;
+        }
+
+        //--------------------------------
+        //形状：关键字保留原文（小写），数字记为#，字符串记为$，占位符记为?，符号保留
+        //返回值：
+        //  形状长度，超出缓冲区时返回0（不缓存）
+        //--------------------------------
+        static size_t make_shape(const token_t *tokens, int n, char *shape)
+        {
+            size_t len = 0;
+            for (int i = 0; i < n; ++i)
+            {
+                const token_t &t = tokens[i];
+                bool keyword = is_known_keyword(t);
+                size_t need = keyword ? t.len + 1 : 2;
+                if (len + need > QP_SHAPE_LEN)
+                    return 0;
+
+                if (keyword)
+                {
+                    for (size_t k = 0; k < t.len; ++k)
+                    {
+                        char c = t.text[k];
+                        shape[len++] = (c >= 'A' && c <= 'Z') ? c + 'a' - 'A' : c;
+                    }
+                }
+                else if (t.type == TK_NUMBER)
+                    shape[len++] = '#';
+                else if (t.type == TK_PARAM)
+                    shape[len++] = '?';
+                else if (t.type == TK_SYMBOL)
+                    shape[len++] = t.text[0];
+                else
+                    shape[len++] = '$';
+                shape[len++] = ' ';
+            }
+            return len;
+        }
+
+        entry_t *lookup(const char *shape, size_t len)
+        {
+            for (size_t i = 0; i < QP_CACHE_SIZE; ++i)
+                if (cache[i].used != 0 && cache[i].shape_len == len &&
+                    memcmp(cache[i].shape, shape, len) == 0)
+                    return &cache[i];
+            return NULL;
+        }
+
+        /* 空位或最久未使用的缓存项 */
+        entry_t *victim()
+        {
+            entry_t *e = &cache[0];
+            for (size_t i = 1; i < QP_CACHE_SIZE && e->used != 0; ++i)
+                if (cache[i].used < e->used)
+                    e = &cache[i];
+            return e;
+        }
+
+        //--------------------------------
+        //按记号与字段的对应关系，把字面量绑定到模板的副本中
+        //--------------------------------
+        static int bind_tokens(const signed char *slot_of, const prepared_stmt &tmpl,
+                               const token_t *tokens, int n, prepared_stmt *stmt)
+        {
+            *stmt = tmpl;
+            for (int i = 0; i < n; ++i)
+            {
+                if (slot_of[i] < 0 || tokens[i].type == TK_PARAM)
+                    continue;
+                if (stmt->set(slot_of[i], tokens[i].text, tokens[i].len) != 0)
+                    return -1;
+            }
+            return 0;
+        }
+
+        /* 语法分析时的游标 */
+        struct cursor_t
+        {
+            const token_t *tokens;
+            int n, pos;
+            prepared_stmt *stmt;
+            signed char *slot_of;
+
+            bool keyword(const char *word)
+            {
+                if (pos < n && is_keyword(tokens[pos], word))
+                {
+                    ++pos;
+                    return true;
+                }
+                return false;
+            }
+
+            bool symbol(char c)
+            {
+                if (pos < n && is_symbol(tokens[pos], c))
+                {
+                    ++pos;
+                    return true;
+                }
+                return false;
+            }
+
+            //读取一个值记号并记录它对应的字段
+            bool field(param_slot_t slot)
+            {
+                if (pos >= n || !is_value(tokens[pos]))
+                    return false;
+                const token_t &t = tokens[pos];
+                if (prepared_stmt::is_number_slot(slot) && t.type != TK_NUMBER && t.type != TK_PARAM)
+                    return false;
+                if (t.type == TK_PARAM)
+                    stmt->param_slot[stmt->param_count++] = (unsigned char)slot;
+                slot_of[pos++] = (signed char)slot;
+                return true;
+            }
+
+            //where id = x
+            bool where_id()
+            {
+                return keyword("where") && keyword("id") && symbol('=') && field(SLOT_ID);
+            }
+
+            //count(*) | sum(age) | avg(age) | min(age) | max(age)
+            bool aggregate()
+            {
+                static const struct
+                {
+                    const char *word;
+                    agg_func_t func;
+                } funcs[] = {{"count", AGG_COUNT},
+                             {"sum", AGG_SUM},
+                             {"avg", AGG_AVG},
+                             {"min", AGG_MIN},
+                             {"max", AGG_MAX}};
+                for (size_t i = 0; i < sizeof(funcs) / sizeof(funcs[0]); ++i)
+                {
+                    if (keyword(funcs[i].word))
+                    {
+                        stmt->agg = funcs[i].func;
+                        return symbol('(') && (funcs[i].func == AGG_COUNT ? symbol('*') : keyword("age")) &&
+                               symbol(')');
+                    }
+                }
+                return false;
+            }
+
+            //where之后的一个条件：id in ( id , id ) | age op n | email like pattern，每种最多一次
+            bool condition()
+            {
+                if (keyword("id"))
+                {
+                    const unsigned range = (1u << SLOT_ID) | (1u << SLOT_ID_END);
+                    if (stmt->required & range)
+                        return false;
+                    stmt->required |= range;
+                    return keyword("in") && symbol('(') && field(SLOT_ID) && symbol(',') &&
+                           field(SLOT_ID_END) && symbol(')');
+                }
+                if (keyword("age"))
+                {
+                    if (stmt->required & (1u << SLOT_AGE))
+                        return false;
+                    stmt->required |= 1u << SLOT_AGE;
+                    if (symbol('='))
+                        stmt->age_cmp = CMP_EQ;
+                    else if (symbol('<'))
+                        stmt->age_cmp = symbol('=') ? CMP_LE : CMP_LT;
+                    else if (symbol('>'))
+                        stmt->age_cmp = symbol('=') ? CMP_GE : CMP_GT;
+                    else
+                        return false;
+                    return field(SLOT_AGE);
+                }
+                if (keyword("email"))
+                {
+                    if (stmt->required & (1u << SLOT_EMAIL))
+                        return false;
+                    stmt->required |= 1u << SLOT_EMAIL;
+                    return keyword("like") && field(SLOT_EMAIL);
+                }
+                return false;
+            }
+
+            //命令结束，允许一个分号
+            bool end()
+            {
+                symbol(';');
+                return pos == n;
+            }
+        };
+
+        //--------------------------------
+        //语法分析
+        //  .help | .exit | .reset | .stats | .analyze
+        //  .mode table|csv|tsv|binary | .output file|stdout
+        //  .import file | .export file [id id]
+        //  begin | commit | rollback [;]
+        //  insert db id name age [email] [;]
+        //  delete from db where id = id [;]
+        //  update db name age email where id = id [;]
+        //  select * from db where id = id [;]
+        //  select * from db where id in ( id , id ) [;]
+        //  select count(*)|sum(age)|avg(age)|min(age)|max(age) from db
+        //      [where cond [and cond ...]] [;]
+        //      cond: id in ( id , id ) | age =|<|<=|>|>= n | email like pattern
+        //--------------------------------
+        static int parse(const token_t *tokens, int n, prepared_stmt *stmt, signed char *slot_of)
+        {
+            stmt->clear();
+            memset(slot_of, -1, QP_MAX_TOKENS);
+            cursor_t c = {tokens, n, 0, stmt, slot_of};
+
+            //不带参数的命令
+            static const struct
+            {
+                const char *word;
+                stmt_type_t type;
+            } plain_commands[] = {{".help", STMT_HELP},
+                                  {".exit", STMT_EXIT},
+                                  {".reset", STMT_RESET},
+                                  {".stats", STMT_STATS},
+                                  {".analyze", STMT_ANALYZE},
+                                  {"begin", STMT_BEGIN},
+                                  {"commit", STMT_COMMIT},
+                                  {"rollback", STMT_ROLLBACK}};
+            for (size_t i = 0; i < sizeof(plain_commands) / sizeof(plain_commands[0]); ++i)
+            {
+                if (c.keyword(plain_commands[i].word))
+                {
+                    stmt->type = plain_commands[i].type;
+                    return c.end() ? 0 : -1;
+                }
+            }
+
+            //带一个参数的点命令
+            static const struct
+            {
+                const char *word;
+                stmt_type_t type;
+            } arg_commands[] = {{".mode", STMT_MODE},
+                                {".output", STMT_OUTPUT},
+                                {".import", STMT_IMPORT},
+                                {".export", STMT_EXPORT}};
+            for (size_t i = 0; i < sizeof(arg_commands) / sizeof(arg_commands[0]); ++i)
+            {
+                if (!c.keyword(arg_commands[i].word))
+                    continue;
+                stmt->type = arg_commands[i].type;
+                stmt->required = 1u << SLOT_NAME;
+                bool ok = c.field(SLOT_NAME);
+
+                //.export可以带一个id范围
+                if (ok && stmt->type == STMT_EXPORT && c.pos < n && is_value(tokens[c.pos]))
+                {
+                    stmt->required |= (1u << SLOT_ID) | (1u << SLOT_ID_END);
+                    ok = c.field(SLOT_ID) && c.field(SLOT_ID_END);
+                }
+                if (ok && c.end())
+                    return 0;
+                stmt->clear();
+                return -1;
+            }
+
+            bool ok = false;
+            if (c.keyword("insert"))
+            {
+                stmt->type = STMT_INSERT;
+                stmt->required = (1u << SLOT_ID) | (1u << SLOT_NAME) | (1u << SLOT_AGE);
+                ok = c.keyword("db") && c.field(SLOT_ID) && c.field(SLOT_NAME) && c.field(SLOT_AGE);
+                if (ok && c.pos < n && is_value(tokens[c.pos]))
+                {
+                    ok = c.field(SLOT_EMAIL);
+                    stmt->required |= 1u << SLOT_EMAIL;
+                }
+            }
+            else if (c.keyword("delete"))
+            {
+                stmt->type = STMT_DELETE;
+                stmt->required = 1u << SLOT_ID;
+                ok = c.keyword("from") && c.keyword("db") && c.where_id();
+            }
+            else if (c.keyword("update"))
+            {
+                stmt->type = STMT_UPDATE;
+                stmt->required = (1u << SLOT_ID) | (1u << SLOT_NAME) |
+                                 (1u << SLOT_AGE) | (1u << SLOT_EMAIL);
+                ok = c.keyword("db") && c.field(SLOT_NAME) && c.field(SLOT_AGE) &&
+                     c.field(SLOT_EMAIL) && c.where_id();
+            }
+            else if (c.keyword("select"))
+            {
+                if (c.symbol('*'))
+                {
+                    ok = c.keyword("from") && c.keyword("db") && c.keyword("where") && c.keyword("id");
+                    if (ok && c.symbol('='))
+                    {
+                        stmt->type = STMT_SELECT;
+                        stmt->required = 1u << SLOT_ID;
+                        ok = c.field(SLOT_ID);
+                    }
+                    else if (ok)
+                    {
+                        stmt->type = STMT_SELECT_RANGE;
+                        stmt->required = (1u << SLOT_ID) | (1u << SLOT_ID_END);
+                        ok = c.keyword("in") && c.symbol('(') && c.field(SLOT_ID) &&
+                             c.symbol(',') && c.field(SLOT_ID_END) && c.symbol(')');
+                    }
+                }
+                else
+                {
+                    //聚合：条件都是可选的，用and连接
+                    stmt->type = STMT_AGGREGATE;
+                    ok = c.aggregate() && c.keyword("from") && c.keyword("db");
+                    if (ok && c.keyword("where"))
+                    {
+                        do
+                            ok = c.condition();
+                        while (ok && c.keyword("and"));
+                    }
+                }
+            }
+
+            if (!ok || !c.end())
+            {
+                stmt->clear();
+                return -1;
+            }
+            return 0;
+        }
+    };
+}
+
+#endif /* QUERY_PARSER_H */
@@ -0,0 +1,367 @@
+/******************************
+ * Topic: 流式结果输出
+ * Author: Sliverchen
+ * Create file date : 2026 / 10 / 18
+ * Explanation:
+ *      1、查询结果边扫描边输出，不保存整个结果集，内存占用与结果大小无关
+ *      2、表格格式：列宽固定，或者根据前RW_SAMPLE_ROWS行采样得到，
+ *         之后超出列宽的内容被截断并以~结尾
+ *      3、CSV（按RFC 4180加引号）、TSV、二进制（每行一个record_t）格式
+ *      4、输出先写入定长缓冲区，满了再一次写出
+ * ****************************/
+
+#ifndef ROW_WRITER_H
+#define ROW_WRITER_H
+
+#include "Bplus_Tree.h"
+#include <stdio.h>
+#include <string.h>
+
+namespace bpt
+{
+/* 输出缓冲区大小、表格格式采样的行数与列数 */
+#define RW_BUFFER_SIZE (1 << 16)
+#define RW_SAMPLE_ROWS 64
+#define RW_COLUMNS 4
+
+    enum row_format_t
+    {
+        ROW_TABLE,
+        ROW_CSV,
+        ROW_TSV,
+        ROW_BINARY
+    };
+
+    class row_writer
+    {
+    public:
+        //--------------------------------
+        //参数说明：
+        //  out：   输出文件
+        //  format：输出格式
+        //  header：是否输出表头（二进制格式没有表头）
+        //--------------------------------
+        row_writer(FILE *out = stdout, row_format_t format = ROW_TABLE, bool header = true)
+            : out(out), format(format), header(header), used(0), rows(0), sampled(0), open(false)
+        {
+            memset(fixed, 0, sizeof(fixed));
+        }
+
+        ~row_writer()
+        {
+            finish();
+            flush();
+        }
+
+        void set_output(FILE *file)
+        {
+            finish();
+            flush();
+            out = file;
+        }
+
+        FILE *output() const
+        {
+            return out;
+        }
+
+        void set_format(row_format_t f)
+        {
+            finish();
+            format = f;
+        }
+
+        row_format_t get_format() const
+        {
+            return format;
+        }
+
+        void set_header(bool h)
+        {
+            header = h;
+        }
+
+        //--------------------------------
+        //设置表格格式的固定列宽（widths为NULL或某一列为0时该列采样）
+        //--------------------------------
+        void set_widths(const size_t *widths)
+        {
+            for (size_t c = 0; c < RW_COLUMNS; ++c)
+                fixed[c] = widths == NULL ? 0 : widths[c];
+        }
+
+        /* 开始一个结果集 */
+        void begin()
+        {
+            finish();
+            open = true;
+            rows = sampled = 0;
+            if (format == ROW_TABLE)
+            {
+                bool sample = false;
+                for (size_t c = 0; c < RW_COLUMNS; ++c)
+                {
+                    width[c] = fixed[c] != 0 ? fixed[c] : strlen(names()[c]);
+                    sample = sample || fixed[c] == 0;
+                }
+                //所有列宽都固定时不需要采样，直接输出表头
+                if (!sample)
+                    table_header();
+            }
+            else if (header && (format == ROW_CSV || format == ROW_TSV))
+            {
+                char sep = format == ROW_CSV ? ',' : '\t';
+                for (size_t c = 0; c < RW_COLUMNS; ++c)
+                {
+                    if (c != 0)
+                        put(sep);
+                    put(names()[c], strlen(names()[c]));
+                }
+                put('\n');
+            }
+        }
+
+        /* 输出一行 */
+        void write(const char *id, const value_t &value)
+        {
+            if (!open)
+                begin();
+            ++rows;
+
+            if (format == ROW_BINARY)
+            {
+                record_t rec;
+                memset((void *)&rec, 0, sizeof(rec));
+                strncpy(rec.key.k, id, sizeof(rec.key.k) - 1);
+                rec.value = value;
+                put((const char *)&rec, sizeof(rec));
+                return;
+            }
+
+            char age[16];
+            snprintf(age, sizeof(age), "%d", value.age);
+            const char *cells[RW_COLUMNS] = {id, value.name, age, value.email};
+
+            if (format == ROW_TABLE)
+            {
+                //采样阶段：先保存下来，用于计算列宽
+                if (sampled < RW_SAMPLE_ROWS && rows == sampled + 1 && !widths_fixed())
+                {
+                    record_t &rec = samples[sampled++];
+                    memset((void *)&rec, 0, sizeof(rec));
+                    strncpy(rec.key.k, id, sizeof(rec.key.k) - 1);
+                    rec.value = value;
+                    for (size_t c = 0; c < RW_COLUMNS; ++c)
+                        if (fixed[c] == 0 && strlen(cells[c]) > width[c])
+                            width[c] = strlen(cells[c]);
+                    if (sampled == RW_SAMPLE_ROWS)
+                        flush_samples();
+                    return;
+                }
+                table_row(cells);
+                return;
+            }
+
+            char sep = format == ROW_CSV ? ',' : '\t';
+            for (size_t c = 0; c < RW_COLUMNS; ++c)
+            {
+                if (c != 0)
+                    put(sep);
+                if (format == ROW_CSV)
+                    csv_cell(cells[c]);
+                else
+                    tsv_cell(cells[c]);
+            }
+            put('\n');
+        }
+
+        void write(const record_t &rec)
+        {
+            write(rec.key.k, rec.value);
+        }
+
+        //--------------------------------
+        //结束当前结果集（输出采样中的行）
+        //返回值：
+        //  结果集的行数
+        //--------------------------------
+        size_t finish()
+        {
+            if (!open)
+                return 0;
+            if (format == ROW_TABLE && rows == sampled && !widths_fixed())
+                flush_samples();
+            open = false;
+            return rows;
+        }
+
+        /* 直接输出一段文本（例如提示信息），保持与结果行的先后顺序 */
+        void text(const char *s, size_t len)
+        {
+            put(s, len);
+        }
+
+        void text(const char *s)
+        {
+            put(s, strlen(s));
+        }
+
+        void flush()
+        {
+            if (used > 0 && out != NULL)
+                fwrite(buf, 1, used, out);
+            used = 0;
+            if (out != NULL)
+                fflush(out);
+        }
+
+    private:
+        FILE *out;
+        row_format_t format;
+        bool header;
+        char buf[RW_BUFFER_SIZE];
+        size_t used;
+
+        size_t fixed[RW_COLUMNS]; //固定列宽，0表示采样
+        size_t width[RW_COLUMNS]; //当前结果集的列宽
+        size_t rows;              //当前结果集已输出的行数
+        size_t sampled;           //采样中的行数
+        bool open;                //是否有未结束的结果集
+        record_t samples[RW_SAMPLE_ROWS];
+
+        /* 列名 */
+        static const char *const *names()
+        {
+            static const char *const columns[RW_COLUMNS] = {"id", "name", "age", "email"};
+            return columns;
+        }
+
+        bool widths_fixed() const
+        {
+            for (size_t c = 0; c < RW_COLUMNS; ++c)
+                if (fixed[c] == 0)
+                    return false;
+            return true;
+        }
+
+        void put(char c)
+        {
+            if (used == RW_BUFFER_SIZE)
+                flush_buffer();
+            buf[used++] = c;
+        }
+
+        void put(const char *s, size_t len)
+        {
+            while (len > 0)
+            {
+                if (used == RW_BUFFER_SIZE)
+                    flush_buffer();
+                size_t n = std::min(len, (size_t)RW_BUFFER_SIZE - used);
+                memcpy(buf + used, s, n);
+                used += n;
+                s += n;
+                len -= n;
+            }
+        }
+
+        void fill(char c, size_t n)
+        {
+            for (; n > 0; --n)
+                put(c);
+        }
+
+        /* 缓冲区满时写出，但不fflush */
+        void flush_buffer()
+        {
+            if (out != NULL)
+                fwrite(buf, 1, used, out);
+            used = 0;
+        }
+
+        /* 采样结束：确定列宽，输出表头和采样的行 */
+        void flush_samples()
+        {
+            table_header();
+            size_t n = sampled;
+            sampled = 0;
+            for (size_t r = 0; r < n; ++r)
+            {
+                char age[16];
+                snprintf(age, sizeof(age), "%d", samples[r].value.age);
+                const char *cells[RW_COLUMNS] = {samples[r].key.k, samples[r].value.name,
+                                                 age, samples[r].value.email};
+                table_row(cells);
+            }
+        }
+
+        /* 与TextTable相同的边框：+---+ */
+        void ruler()
+        {
+            put('+');
+            for (size_t c = 0; c < RW_COLUMNS; ++c)
+            {
+                fill('-', width[c]);
+                put('+');
+            }
+            put('\n');
+        }
+
+        void table_header()
+        {
+            ruler();
+            if (header)
+                table_row(names());
+        }
+
+        void table_row(const char *const *cells)
+        {
+            put('|');
+            for (size_t c = 0; c < RW_COLUMNS; ++c)
+            {
+                size_t len = strlen(cells[c]);
+                if (len > width[c])
+                {
+                    //超出列宽：截断，最后一个字符用~标记
+                    put(cells[c], width[c] - 1);
+                    put('~');
+                }
+                else
+                {
+                    put(cells[c], len);
+                    fill(' ', width[c] - len);
+                }
+                put('|');
+            }
+            put('\n');
+            ruler();
+        }
+
+        /* 含有逗号、引号或换行的字段加引号，引号写两次 */
+        void csv_cell(const char *s)
+        {
+            if (strpbrk(s, ",\"\r\n") == NULL)
+            {
+                put(s, strlen(s));
+                return;
+            }
+            put('"');
+            for (; *s != '\0'; ++s)
+            {
+                if (*s == '"')
+                    put('"');
+                put(*s);
+            }
+            put('"');
+        }
+
+        /* TSV不支持转义，制表符和换行替换成空格 */
+        void tsv_cell(const char *s)
+        {
+            for (; *s != '\0'; ++s)
+                put(*s == '\t' || *s == '\r' || *s == '\n' ? ' ' : *s);
+        }
+    };
+}
+
+#endif /* ROW_WRITER_H */
@@ -0,0 +1,621 @@
+/******************************
+ * Topic: 分片存储引擎
+ * Author: Sliverchen
+ * Create file date : 2026 / 10 / 18
+ * Explanation:
+ *      1、关键字空间按哈希或按范围分到N个bplus_tree文件（path.0 ... path.N-1），
+ *         分片方式和范围分界记录在path.shards中，重新打开时以它为准
+ *      2、每个分片有一个工作线程和一个任务队列，分片上的所有操作都在它的线程中执行，
+ *         所以一个bplus_tree始终只被一个线程访问，不同分片的操作并行进行
+ *      3、单关键字操作路由到所属分片；批量操作按分片分组后各分片同时执行
+ *      4、范围查找同时发给所有相关分片，再把各分片的有序结果多路归并；
+ *         顺序扫描按页读取，每个分片在归并当前页的同时预读下一页
+ *      5、事务只在单棵树上有效，引擎不提供跨分片的原子性
+ * ****************************/
+
+#ifndef SHARD_ENGINE_H
+#define SHARD_ENGINE_H
+
+#include "Bplus_Tree.h"
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <queue>
+#include <stdexcept>
+#include <stdio.h>
+#include <string>
+#include <string.h>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace bpt
+{
+/* 分片数上限、扫描时每个分片每次读取的记录数、分片描述文件的标记 */
+#define SE_MAX_SHARDS 64
+#define SE_SCAN_PAGE 256
+#define SE_MANIFEST_MAGIC 0x53485244
+
+    /* 分片方式 */
+    enum shard_mode_t
+    {
+        SHARD_HASH, //按关键字的哈希值分片，负载均匀，范围查找要访问所有分片
+        SHARD_RANGE //按关键字范围分片，范围查找只访问相交的分片
+    };
+
+    //--------------------------------
+    //把两个分片的统计信息相加（计数器都是size_t，延迟直方图逐桶相加）
+    //--------------------------------
+    inline void stats_add(stats_t &to, const stats_t &from)
+    {
+        size_t *a = (size_t *)&to;
+        const size_t *b = (const size_t *)&from;
+        for (size_t i = 0; i < offsetof(stats_t, latency) / sizeof(size_t); ++i)
+            a[i] += b[i];
+        for (size_t op = 0; op < BP_OP_NUM; ++op)
+        {
+            to.latency[op].count += from.latency[op].count;
+            to.latency[op].total_us += from.latency[op].total_us;
+            for (size_t i = 0; i < BP_HIST_BUCKETS; ++i)
+                to.latency[op].buckets[i] += from.latency[op].buckets[i];
+        }
+    }
+
+    class shard_engine
+    {
+    public:
+        //--------------------------------
+        //参数说明：
+        //  path：    分片文件的前缀
+        //  shards：  分片个数（1到SE_MAX_SHARDS）
+        //  mode：    分片方式
+        //  empty：   是否清空已有的数据；不清空且path.shards存在时，分片个数、方式和分界以它为准，
+        //            path.shards不存在或损坏而分片文件存在时抛出std::runtime_error，不会清空分片
+        //  bounds：  按范围分片时的shards-1个递增的分界关键字，
+        //            第i个分片存放[bounds[i-1], bounds[i])中的关键字
+        //  compress：新建分片时是否压缩存储叶子节点
+        //--------------------------------
+        shard_engine(const char *path, size_t shards, shard_mode_t mode = SHARD_HASH,
+                     bool empty = false, const std::vector<key_t> &bounds = std::vector<key_t>(),
+                     bool compress = false)
+            : mode(mode), bounds(bounds)
+        {
+            memset(prefix, 0, sizeof(prefix));
+            strncpy(prefix, path, sizeof(prefix) - 1);
+
+            if (empty || !load_manifest())
+            {
+                //没有描述文件却有分片文件时不知道原来的分片方式，不能当作新建而清空它们
+                if (!empty && any_shard_exists())
+                    throw std::runtime_error(std::string("shard_engine: missing or corrupt ") +
+                                             prefix + ".shards, refusing to overwrite existing shards");
+
+                assert(shards >= 1 && shards <= SE_MAX_SHARDS);
+                assert(mode == SHARD_HASH || bounds.size() + 1 == shards);
+                if (mode == SHARD_HASH)
+                    this->bounds.clear();
+                this->bounds.resize(shards - 1);
+                empty = true;
+                save_manifest();
+            }
+
+            for (size_t s = 0; s < this->bounds.size() + 1; ++s)
+            {
+                char file[sizeof(prefix) + 24];
+                shard_path(file, sizeof(file), s);
+                parts.push_back(std::unique_ptr<shard_t>(new shard_t()));
+                parts[s]->tree.reset(new bplus_tree(file, empty || !file_exists(file), compress));
+                parts[s]->worker = std::thread(&shard_engine::run, this, parts[s].get());
+            }
+        }
+
+        /* 等待所有分片执行完已提交的任务 */
+        ~shard_engine()
+        {
+            for (size_t s = 0; s < parts.size(); ++s)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(parts[s]->mtx);
+                    parts[s]->stopping = true;
+                }
+                parts[s]->cv.notify_all();
+            }
+            for (size_t s = 0; s < parts.size(); ++s)
+                parts[s]->worker.join();
+        }
+
+        //--------------------------------
+        //按十进制整数关键字把[0, max)平均分成shards段，返回shards-1个分界
+        //--------------------------------
+        static std::vector<key_t> int_bounds(size_t max, size_t shards)
+        {
+            std::vector<key_t> result;
+            for (size_t s = 1; s < shards; ++s)
+            {
+                char key[32];
+                snprintf(key, sizeof(key), "%zu", max / shards * s);
+                result.push_back(key_t(key));
+            }
+            return result;
+        }
+
+        size_t shard_count() const
+        {
+            return parts.size();
+        }
+
+        shard_mode_t get_mode() const
+        {
+            return mode;
+        }
+
+        /* 关键字所属的分片 */
+        size_t shard_of(const key_t &key) const
+        {
+            if (mode == SHARD_RANGE)
+                return std::upper_bound(bounds.begin(), bounds.end(), key, key_less()) - bounds.begin();
+
+            //FNV-1a
+            size_t hash = 2166136261u;
+            for (const char *p = key.k; *p != '\0'; ++p)
+                hash = (hash ^ (unsigned char)*p) * 16777619u;
+            return hash % parts.size();
+        }
+
+        //--------------------------------
+        //在分片s的线程中执行f(tree)
+        //返回值：
+        //  f的返回值的future
+        //--------------------------------
+        template <class F>
+        std::future<typename std::result_of<F(bplus_tree &)>::type> submit(size_t s, F f)
+        {
+            typedef typename std::result_of<F(bplus_tree &)>::type result_t;
+            shard_t *part = parts[s].get();
+            std::shared_ptr<std::packaged_task<result_t()>> task(
+                new std::packaged_task<result_t()>([part, f]() mutable { return f(*part->tree); }));
+            std::future<result_t> result = task->get_future();
+            {
+                std::lock_guard<std::mutex> lock(part->mtx);
+                part->tasks.push_back([task]() { (*task)(); });
+            }
+            part->cv.notify_one();
+            return result;
+        }
+
+        /* 单关键字操作：路由到所属分片，返回值与bplus_tree相同 */
+        std::future<int> search_async(const key_t &key, value_t *value)
+        {
+            return submit(shard_of(key), [key, value](bplus_tree &t) { return t.search(key, value); });
+        }
+
+        std::future<int> insert_async(const key_t &key, const value_t &value)
+        {
+            return submit(shard_of(key), [key, value](bplus_tree &t) { return t.insert(key, value); });
+        }
+
+        std::future<int> update_async(const key_t &key, const value_t &value)
+        {
+            return submit(shard_of(key), [key, value](bplus_tree &t) { return t.update(key, value); });
+        }
+
+        std::future<int> remove_async(const key_t &key)
+        {
+            return submit(shard_of(key), [key](bplus_tree &t) { return t.remove(key); });
+        }
+
+        int search(const key_t &key, value_t *value)
+        {
+            return search_async(key, value).get();
+        }
+
+        int insert(const key_t &key, const value_t &value)
+        {
+            return insert_async(key, value).get();
+        }
+
+        int update(const key_t &key, const value_t &value)
+        {
+            return update_async(key, value).get();
+        }
+
+        int remove(const key_t &key)
+        {
+            return remove_async(key).get();
+        }
+
+        //--------------------------------
+        //批量插入：按分片分组，各分片同时插入自己的那一组
+        //参数说明：
+        //  records：要插入的记录
+        //  results：每个记录的返回值（与insert相同，可以为NULL）
+        //  n：      记录个数
+        //返回值：
+        //  插入成功的个数
+        //--------------------------------
+        int insert_batch(const record_t *records, int *results, size_t n)
+        {
+            std::vector<std::vector<size_t>> groups = group(n, [records](size_t i) -> const key_t & {
+                return records[i].key;
+            });
+            return for_groups(groups, [records, results](bplus_tree &t, const std::vector<size_t> &ids) {
+                int done = 0;
+                for (size_t j = 0; j < ids.size(); ++j)
+                {
+                    int r = t.insert(records[ids[j]].key, records[ids[j]].value);
+                    if (results != NULL)
+                        results[ids[j]] = r;
+                    done += r == 0;
+                }
+                return done;
+            });
+        }
+
+        //--------------------------------
+        //批量查找：按分片分组，各分片同时用search_batch逐层查找自己的那一组
+        //参数与返回值同bplus_tree::search_batch
+        //--------------------------------
+        int search_batch(const key_t *keys, value_t *values, int *results, size_t n)
+        {
+            std::vector<std::vector<size_t>> groups = group(n, [keys](size_t i) -> const key_t & {
+                return keys[i];
+            });
+            return for_groups(groups, [keys, values, results](bplus_tree &t, const std::vector<size_t> &ids) {
+                std::vector<key_t> k(ids.size());
+                std::vector<value_t> v(ids.size());
+                std::vector<int> r(ids.size());
+                for (size_t j = 0; j < ids.size(); ++j)
+                    k[j] = keys[ids[j]];
+                int found = t.search_batch(k.data(), v.data(), r.data(), ids.size());
+                for (size_t j = 0; j < ids.size(); ++j)
+                {
+                    values[ids[j]] = v[j];
+                    results[ids[j]] = r[j];
+                }
+                return found;
+            });
+        }
+
+        //--------------------------------
+        //范围查找：相关分片同时各取最多max个记录，再多路归并出最小的max个
+        //参数与返回值同bplus_tree::search_range
+        //--------------------------------
+        int search_range(key_t *left, const key_t &right, record_t *records, size_t max,
+                         bool *next = NULL)
+        {
+            if (left == NULL || keycmp(*left, right) > 0)
+                return -1;
+
+            std::vector<cursor_t> cursors;
+            open_cursors(*left, right, max, cursors);
+
+            //各分片的结果都是有序的，每次取出最小的一个
+            merge_heap heap = open_heap(cursors);
+            size_t i = 0;
+            for (; i < max && !heap.empty(); ++i)
+            {
+                size_t s = heap.top();
+                heap.pop();
+                cursor_t &c = cursors[s];
+                records[i] = c.page.records[c.pos++];
+                if (c.pos < c.page.records.size())
+                    heap.push(s);
+            }
+
+            //后面的第一个记录：各分片剩下的第一个记录，或者分片中下一页的开头
+            if (next != NULL)
+            {
+                *next = false;
+                for (size_t s = 0; s < cursors.size(); ++s)
+                {
+                    cursor_t &c = cursors[s];
+                    const key_t *k = c.pos < c.page.records.size() ? &c.page.records[c.pos].key
+                                                                   : c.page.more ? &c.page.left : NULL;
+                    if (k != NULL && (!*next || keycmp(*k, *left) < 0))
+                        *left = *k;
+                    *next = *next || k != NULL;
+                }
+            }
+            return i;
+        }
+
+        //--------------------------------
+        //顺序扫描：各分片按SE_SCAN_PAGE个记录一页并行读取，
+        //归并当前页时下一页已经在分片的线程中读取
+        //返回值：
+        //  扫描的记录数，范围不合法返回-1
+        //--------------------------------
+        int scan(const key_t &left, const key_t &right,
+                 const std::function<void(const record_t &)> &visit)
+        {
+            if (keycmp(left, right) > 0)
+                return -1;
+
+            std::vector<cursor_t> cursors;
+            open_cursors(left, right, SE_SCAN_PAGE, cursors);
+            for (size_t s = 0; s < cursors.size(); ++s)
+                prefetch(cursors[s], right);
+
+            merge_heap heap = open_heap(cursors);
+            int count = 0;
+            while (!heap.empty())
+            {
+                size_t s = heap.top();
+                heap.pop();
+                cursor_t &c = cursors[s];
+                visit(c.page.records[c.pos++]);
+                ++count;
+
+                //当前页用完时换成预读的下一页，同时预读再下一页
+                if (c.pos == c.page.records.size() && c.page.more)
+                {
+                    c.page = c.ahead.get();
+                    c.pos = 0;
+                    prefetch(c, right);
+                }
+                if (c.pos < c.page.records.size())
+                    heap.push(s);
+            }
+            return count;
+        }
+
+        /* 所有分片的统计信息之和 */
+        stats_t stats()
+        {
+            std::vector<std::future<stats_t>> all;
+            for (size_t s = 0; s < parts.size(); ++s)
+                all.push_back(submit(s, [](bplus_tree &t) { return t.stats(); }));
+
+            stats_t sum;
+            memset(&sum, 0, sizeof(sum));
+            for (size_t s = 0; s < all.size(); ++s)
+                stats_add(sum, all[s].get());
+            return sum;
+        }
+
+        /* 各分片的meta（用于观察数据在分片间的分布） */
+        std::vector<meta_t> metas()
+        {
+            std::vector<std::future<meta_t>> all;
+            for (size_t s = 0; s < parts.size(); ++s)
+                all.push_back(submit(s, [](bplus_tree &t) { return t.get_meta(); }));
+
+            std::vector<meta_t> result;
+            for (size_t s = 0; s < all.size(); ++s)
+                result.push_back(all[s].get());
+            return result;
+        }
+
+    private:
+        /* 一个分片：一棵树、一个工作线程和它的任务队列 */
+        struct shard_t
+        {
+            std::unique_ptr<bplus_tree> tree;
+            std::thread worker;
+            std::mutex mtx;
+            std::condition_variable cv;
+            std::deque<std::function<void()>> tasks;
+            bool stopping = false;
+        };
+
+        /* 一个分片一次范围查找的结果 */
+        struct page_t
+        {
+            std::vector<record_t> records;
+            key_t left; //more为true时，下一页的开头
+            bool more;
+        };
+
+        /* 归并时一个分片的位置 */
+        struct cursor_t
+        {
+            size_t shard;
+            page_t page;
+            size_t pos;
+            std::future<page_t> ahead; //预读的下一页
+        };
+
+        struct key_less
+        {
+            bool operator()(const key_t &a, const key_t &b) const
+            {
+                return keycmp(a, b) < 0;
+            }
+        };
+
+        /* 按各分片当前记录的关键字排序的小顶堆，保存分片在cursors中的下标 */
+        struct cursor_greater
+        {
+            const std::vector<cursor_t> *cursors;
+            bool operator()(size_t a, size_t b) const
+            {
+                const cursor_t &x = (*cursors)[a], &y = (*cursors)[b];
+                return keycmp(x.page.records[x.pos].key, y.page.records[y.pos].key) > 0;
+            }
+        };
+        typedef std::priority_queue<size_t, std::vector<size_t>, cursor_greater> merge_heap;
+
+        char prefix[512];
+        shard_mode_t mode;
+        std::vector<key_t> bounds; //按范围分片时的分界（按哈希分片时只用来记录分片个数）
+        std::vector<std::unique_ptr<shard_t>> parts;
+
+        /* 工作线程：依次执行队列中的任务，退出前把队列执行完 */
+        void run(shard_t *part)
+        {
+            while (true)
+            {
+                std::function<void()> task;
+                {
+                    std::unique_lock<std::mutex> lock(part->mtx);
+                    part->cv.wait(lock, [part] { return part->stopping || !part->tasks.empty(); });
+                    if (part->tasks.empty())
+                        return;
+                    task = std::move(part->tasks.front());
+                    part->tasks.pop_front();
+                }
+                task();
+            }
+        }
+
+        static bool file_exists(const char *file)
+        {
+            FILE *f = fopen(file, "rb");
+            if (f == NULL)
+                return false;
+            fclose(f);
+            return true;
+        }
+
+        /* 第s个分片的文件名，buf至少要有sizeof(prefix) + 24个字节 */
+        void shard_path(char *buf, size_t size, size_t s) const
+        {
+            snprintf(buf, size, "%s.%zu", prefix, s);
+        }
+
+        bool any_shard_exists() const
+        {
+            for (size_t s = 0; s < SE_MAX_SHARDS; ++s)
+            {
+                char file[sizeof(prefix) + 24];
+                shard_path(file, sizeof(file), s);
+                if (file_exists(file))
+                    return true;
+            }
+            return false;
+        }
+
+        //--------------------------------
+        //分片描述文件：SE_MANIFEST_MAGIC、分片方式、分片个数、分界关键字
+        //--------------------------------
+        void manifest_path(char *buf, size_t size) const
+        {
+            snprintf(buf, size, "%s.shards", prefix);
+        }
+
+        bool load_manifest()
+        {
+            char file[sizeof(prefix) + 8];
+            manifest_path(file, sizeof(file));
+            FILE *f = fopen(file, "rb");
+            if (f == NULL)
+                return false;
+
+            size_t head[3] = {0, 0, 0};
+            bool ok = fread(head, sizeof(head), 1, f) == 1 && head[0] == SE_MANIFEST_MAGIC &&
+                      head[2] >= 1 && head[2] <= SE_MAX_SHARDS;
+            std::vector<key_t> keys(ok ? head[2] - 1 : 0);
+            ok = ok && (keys.empty() || fread(keys.data(), sizeof(key_t), keys.size(), f) == keys.size());
+            fclose(f);
+            if (!ok)
+                return false;
+
+            mode = (shard_mode_t)head[1];
+            bounds = keys;
+            return true;
+        }
+
+        void save_manifest() const
+        {
+            char file[sizeof(prefix) + 8];
+            manifest_path(file, sizeof(file));
+            FILE *f = fopen(file, "wb");
+            if (f == NULL)
+                return;
+            size_t head[3] = {SE_MANIFEST_MAGIC, (size_t)mode, bounds.size() + 1};
+            fwrite(head, sizeof(head), 1, f);
+            if (!bounds.empty())
+                fwrite(bounds.data(), sizeof(key_t), bounds.size(), f);
+            fclose(f);
+        }
+
+        /* 把n个关键字按所属分片分组，key(i)返回第i个关键字 */
+        template <class Key>
+        std::vector<std::vector<size_t>> group(size_t n, Key key) const
+        {
+            std::vector<std::vector<size_t>> groups(parts.size());
+            for (size_t i = 0; i < n; ++i)
+                groups[shard_of(key(i))].push_back(i);
+            return groups;
+        }
+
+        /* 各分片同时处理自己的那一组，返回各分片返回值之和 */
+        template <class F>
+        int for_groups(const std::vector<std::vector<size_t>> &groups, F f)
+        {
+            std::vector<std::future<int>> all;
+            for (size_t s = 0; s < groups.size(); ++s)
+            {
+                if (groups[s].empty())
+                    continue;
+                const std::vector<size_t> *ids = &groups[s];
+                all.push_back(submit(s, [f, ids](bplus_tree &t) { return f(t, *ids); }));
+            }
+            int sum = 0;
+            for (size_t i = 0; i < all.size(); ++i)
+                sum += all[i].get();
+            return sum;
+        }
+
+        /* 在分片s中读取从left开始最多max个记录 */
+        std::future<page_t> fetch(size_t s, const key_t &left, const key_t &right, size_t max)
+        {
+            return submit(s, [left, right, max](bplus_tree &t) {
+                page_t page;
+                page.records.resize(max);
+                page.left = left;
+                page.more = false;
+                int n = t.search_range(&page.left, right, page.records.data(), max, &page.more);
+                page.records.resize(n < 0 ? 0 : n);
+                return page;
+            });
+        }
+
+        /* 同时在相关的分片中读取第一页（按范围分片时只有与[left, right]相交的分片） */
+        void open_cursors(const key_t &left, const key_t &right, size_t max,
+                          std::vector<cursor_t> &cursors)
+        {
+            size_t first = 0, last = parts.size() - 1;
+            if (mode == SHARD_RANGE)
+            {
+                first = shard_of(left);
+                last = shard_of(right);
+            }
+
+            std::vector<std::future<page_t>> pages;
+            for (size_t s = first; s <= last; ++s)
+                pages.push_back(fetch(s, left, right, max));
+
+            cursors.resize(pages.size());
+            for (size_t i = 0; i < pages.size(); ++i)
+            {
+                cursors[i].shard = first + i;
+                cursors[i].page = pages[i].get();
+                cursors[i].pos = 0;
+            }
+        }
+
+        /* 还有记录的分片放入归并堆 */
+        merge_heap open_heap(const std::vector<cursor_t> &cursors) const
+        {
+            cursor_greater greater = {&cursors};
+            merge_heap heap(greater);
+            for (size_t i = 0; i < cursors.size(); ++i)
+                if (cursors[i].pos < cursors[i].page.records.size())
+                    heap.push(i);
+            return heap;
+        }
+
+        /* 分片的下一页开始预读 */
+        void prefetch(cursor_t &c, const key_t &right)
+        {
+            if (c.page.more)
+                c.ahead = fetch(c.shard, c.page.left, right, SE_SCAN_PAGE);
+        }
+    };
+}
+
+#endif /* SHARD_ENGINE_H */
@@ -0,0 +1,190 @@
+/******************************
+ * Topic: 按批执行的过滤与聚合
+ * Author: Sliverchen
+ * Create file date : 2026 / 10 / 18
+ * Explanation:
+ *      1、以叶子节点为一批：parallel_scan_leaves把一个节点中在范围内的记录整体交给算子，
+ *         不再把value_t逐条复制出来
+ *      2、先把用到的列（age）收集到连续的数组中，过滤条件生成0/1选择掩码；
+ *         age的比较统一成区间[lo, hi]，每条记录一次无符号比较，没有分支
+ *      3、count/sum/min/max在掩码上累加，都是没有分支的循环，编译器可以向量化
+ *      4、email的like条件无法向量化，只对掩码仍为1的记录逐条匹配
+ *      5、每个线程累加自己的结果，扫描结束后合并（bplus_tree::aggregate_leaves）
+ * ****************************/
+
+#ifndef VECTOR_EXEC_H
+#define VECTOR_EXEC_H
+
+#include "Bplus_Tree.h"
+#include <algorithm>
+#include <limits.h>
+#include <string.h>
+
+namespace bpt
+{
+/* 一批最多的记录数（一个叶子节点） */
+#define VE_BATCH BP_ORDER
+
+    //--------------------------------
+    //like匹配：%匹配任意个字符，_匹配一个字符
+    //--------------------------------
+    inline bool like_match(const char *s, const char *pattern)
+    {
+        const char *p = pattern, *star = NULL, *retry = NULL;
+        while (*s != '\0')
+        {
+            if (*p == '%')
+            {
+                star = p++;
+                retry = s;
+            }
+            else if (*p != '\0' && (*p == '_' || *p == *s))
+            {
+                ++p;
+                ++s;
+            }
+            else if (star != NULL)
+            {
+                //回到上一个%，让它多匹配一个字符
+                p = star + 1;
+                s = ++retry;
+            }
+            else
+                return false;
+        }
+        while (*p == '%')
+            ++p;
+        return *p == '\0';
+    }
+
+    /* 一批记录投影出的列与选择掩码 */
+    struct column_batch_t
+    {
+        size_t n;
+        int age[VE_BATCH];
+        unsigned char sel[VE_BATCH]; //1表示记录满足所有条件
+    };
+
+    class vector_query
+    {
+    public:
+        vector_query() : age_lo(INT_MIN), age_hi(INT_MAX), pattern(NULL), skip_negative(false) {}
+
+        /* 只保留 lo <= age <= hi 的记录，多次调用取交集（超出int范围的边界会被截断） */
+        void where_age(long long lo, long long hi)
+        {
+            age_lo = std::max(age_lo, lo);
+            age_hi = std::min(age_hi, hi);
+        }
+
+        /* 只保留email与pattern匹配的记录，pattern在查询期间必须有效 */
+        void where_email_like(const char *p)
+        {
+            pattern = p;
+        }
+
+        /* 跳过关键字以'-'开头的记录：整数关键字按长度排序，负数会落在非负数的范围中 */
+        void skip_negative_keys()
+        {
+            skip_negative = true;
+        }
+
+        //--------------------------------
+        //处理一段记录，把满足条件的记录累加到agg中
+        //--------------------------------
+        void process(const record_t *begin, const record_t *end, aggregate_t &agg) const
+        {
+            column_batch_t batch;
+            while (begin < end)
+            {
+                batch.n = std::min((size_t)(end - begin), (size_t)VE_BATCH);
+                gather(begin, batch);
+                filter(begin, batch);
+                fold(batch, agg);
+                begin += batch.n;
+            }
+        }
+
+        //--------------------------------
+        //并行扫描[left, right]并聚合，有叶子节点读取失败时结果的failed为true
+        //参数说明：
+        //  threads：线程数（0表示每个CPU核心一个线程）
+        //--------------------------------
+        aggregate_t run(const bplus_tree &tree, const key_t &left, const key_t &right,
+                        size_t threads = 0) const
+        {
+            auto fold = [this](const record_t *b, const record_t *e, aggregate_t &agg) {
+                process(b, e, agg);
+            };
+            return tree.aggregate_leaves(left, right, fold, threads);
+        }
+
+    private:
+        long long age_lo, age_hi;
+        const char *pattern;
+        bool skip_negative;
+
+        /* 收集投影列 */
+        static void gather(const record_t *rows, column_batch_t &batch)
+        {
+            for (size_t i = 0; i < batch.n; ++i)
+                batch.age[i] = rows[i].value.age;
+        }
+
+        /* 计算选择掩码 */
+        void filter(const record_t *rows, column_batch_t &batch) const
+        {
+            if (age_lo > age_hi)
+            {
+                memset(batch.sel, 0, batch.n);
+                return;
+            }
+
+            //lo <= age <= hi 等价于 (unsigned)(age - lo) <= (unsigned)(hi - lo)
+            unsigned lo = (unsigned)(int)age_lo, span = (unsigned)(int)age_hi - lo;
+            for (size_t i = 0; i < batch.n; ++i)
+                batch.sel[i] = (unsigned)batch.age[i] - lo <= span;
+
+            if (skip_negative)
+            {
+                for (size_t i = 0; i < batch.n; ++i)
+                    batch.sel[i] &= rows[i].key.k[0] != '-';
+            }
+
+            if (pattern != NULL)
+            {
+                for (size_t i = 0; i < batch.n; ++i)
+                    if (batch.sel[i])
+                        batch.sel[i] = like_match(rows[i].value.email, pattern);
+            }
+        }
+
+        /* 在掩码上累加：未选中的记录对sum贡献0，对min/max贡献单位元 */
+        static void fold(const column_batch_t &batch, aggregate_t &agg)
+        {
+            size_t count = 0;
+            long long sum = 0;
+            int lo = INT_MAX, hi = INT_MIN;
+            for (size_t i = 0; i < batch.n; ++i)
+            {
+                int age = batch.age[i], mask = -(int)batch.sel[i];
+                count += batch.sel[i];
+                sum += age & mask;
+                lo = std::min(lo, (age & mask) | (INT_MAX & ~mask));
+                hi = std::max(hi, (age & mask) | (INT_MIN & ~mask));
+            }
+            if (count == 0)
+                return;
+
+            aggregate_t part;
+            part.clear();
+            part.count = count;
+            part.age_sum = sum;
+            part.age_min = lo;
+            part.age_max = hi;
+            agg.merge(part);
+        }
+    };
+}
+
+#endif /* VECTOR_EXEC_H */
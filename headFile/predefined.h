@@ -19,6 +19,41 @@ namespace bpt
 /* predefined the order of the B plus Tree */
 #define BP_ORDER 50
 
+/* predefined the number of nodes kept in the page cache */
+#define BP_CACHE_PAGES 64
+
+/* predefined the first read size of a compressed leaf */
+#define BP_COMPRESS_READ 4096
+
+/* predefined the initial and maximum number of leaves read ahead by a range scan */
+#define BP_READAHEAD_MIN 2
+#define BP_READAHEAD_MAX 32
+
+/* predefined the number of lookups a batch advances in lockstep */
+#define BP_BATCH_GROUP 8
+
+/* predefined the percentage of a node filled by a bulk load */
+#define BP_BULK_FILL 90
+
+/* predefined the number of underfull leaves a relaxed-fill tree collects before rebalancing them */
+#define BP_RELAXED_PENDING 64
+
+/* predefined the number of messages one internal node buffers in write-optimized mode */
+#define BP_BUFFER_MSGS (BP_ORDER * 4)
+
+/* predefined the number of keys an in-memory memtable holds before it is merged into the tree */
+#define BP_MEMTABLE_KEYS (BP_ORDER * 64)
+
+/* predefined the unit in which a leaf with only a few modified bytes is written back */
+#define BP_SECTOR_SIZE 512
+
+/* software prefetch into the CPU cache */
+#if defined(__GNUC__)
+#define BP_PREFETCH(p) __builtin_prefetch(p)
+#else
+#define BP_PREFETCH(p) ((void)(p))
+#endif
+
     /* predefined key / value type */
     struct value_t
     {